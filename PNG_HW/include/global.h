@@ -7,6 +7,7 @@
 /* Usage/Help Messages */
 #define PRINT_USAGE(prog_name) do { \
     fprintf(stdout, "Usage: %s -f png_file [options]\n", prog_name); \
+    fprintf(stdout, "       %s -b [-J] [-n] [-j threads] [-l list_file] [path...]\n", prog_name); \
     fprintf(stdout, "Options:\n"); \
     fprintf(stdout, "  -f png_file           Input PNG file (required)\n"); \
     fprintf(stdout, "  -h                    Print this help message\n"); \
@@ -16,6 +17,18 @@
     fprintf(stdout, "  -e message -o out_file    Encode message and write to output file\n"); \
     fprintf(stdout, "  -d                    Decode and print hidden message\n"); \
     fprintf(stdout, "  -m file2 -o out_file [-w width] [-g height]  Overlay file2 (smaller) over input and write to output\n"); \
+    fprintf(stdout, "  -a                    Overlay output: choose each scanline's filter adaptively\n"); \
+    fprintf(stdout, "                        (palette images stay unfiltered)\n"); \
+    fprintf(stdout, "  -c                    Encode/overlay output: stream image data into 64 KB IDAT chunks\n"); \
+    fprintf(stdout, "  -L level              Encode/overlay output: compression level 0-9 (default: 6)\n"); \
+    fprintf(stdout, "  -S strategy           Encode/overlay output: default, filtered, huffman, rle or fixed\n"); \
+    fprintf(stdout, "  -M mem_level          Encode/overlay output: zlib memLevel 1-9 (default: 8)\n"); \
+    fprintf(stdout, "  -b                    Batch mode: print IHDR, palette and chunk totals of every file as CSV\n"); \
+    fprintf(stdout, "  -J                    Batch output as one JSON object per line instead of CSV\n"); \
+    fprintf(stdout, "  -n                    Do not check chunk CRCs (batch mode and -s)\n"); \
+    fprintf(stdout, "  -j threads            Batch worker threads (default: one per CPU); encode/overlay\n"); \
+    fprintf(stdout, "                        compression threads (default: 1, 0 for one per CPU)\n"); \
+    fprintf(stdout, "  -l list_file          Batch inputs, one file or directory per line (- for stdin)\n"); \
 } while(0)
 
 /* Error Messages */
@@ -34,10 +47,20 @@
 #define PRINT_ERROR_UNKNOWN_OPTION(option) fprintf(stderr, "Error: Unknown option %s\n", option)
 #define PRINT_ERROR_MISSING_F_FLAG() fprintf(stderr, "Error: -f flag with filename is required\n")
 #define PRINT_ERROR_F_REQUIRES_FILENAME() fprintf(stderr, "Error: -f requires a filename\n")
+#define PRINT_ERROR_THREADS_REQUIRES() fprintf(stderr, "Error: -j requires a thread count\n")
+#define PRINT_ERROR_LIST_REQUIRES() fprintf(stderr, "Error: -l requires a list file\n")
+#define PRINT_ERROR_LEVEL_REQUIRES() fprintf(stderr, "Error: -L requires a compression level from 0 to 9\n")
+#define PRINT_ERROR_STRATEGY_REQUIRES() fprintf(stderr, "Error: -S requires a strategy: default, filtered, huffman, rle or fixed\n")
+#define PRINT_ERROR_MEMLEVEL_REQUIRES() fprintf(stderr, "Error: -M requires a memory level from 1 to 9\n")
+#define PRINT_ERROR_BATCH_INPUTS() fprintf(stderr, "Error: -b requires input paths or -l list_file\n")
 
 /* Chunk Summary Messages */
 #define PRINT_CHUNK_SUMMARY_HEADER(filename) printf("Chunk Summary for %s:\n", filename)
-#define PRINT_CHUNK_INFO(i, chunk) printf("  Chunk %d: Type=%s, Length=%u, CRC=%s\n", i, (chunk).type, (chunk).length, (chunk).crc ? "valid" : "invalid")
+#define PRINT_CHUNK_INFO(i, chunk) printf("  Chunk %d: Type=%s, Length=%u, CRC=%s\n", i, (chunk).type, (chunk).length, \
+    (chunk).crc == PNG_CRC_VALID ? "valid" : (chunk).crc == PNG_CRC_INVALID ? "invalid" : "unchecked")
+
+/* Batch Messages */
+#define PRINT_BATCH_CSV_HEADER() printf("path,status,width,height,bit_depth,color_type,interlace,palette,chunks,idat_bytes,crc\n")
 
 /* Palette Messages */
 #define PRINT_PALETTE_HEADER(filename) printf("Palette Summary for %s:\n", filename)
@@ -0,0 +1,35 @@
+#ifndef PNG_BATCH_H
+#define PNG_BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "png_chunks.h"
+
+/* Output formats for png_batch_run */
+#define PNG_BATCH_CSV  0    /* Header line, then one row per file */
+#define PNG_BATCH_JSON 1    /* One JSON object per line */
+
+/* Metadata of one PNG, gathered in a single pass over its chunk headers */
+typedef struct {
+    png_ihdr_t ihdr;
+    size_t     palette_size;    /* Colors in PLTE, 0 if there is none */
+    uint32_t   num_chunks;
+    uint64_t   idat_bytes;
+    int        crc;             /* PNG_CRC_VALID if every chunk checks out, PNG_CRC_INVALID or PNG_CRC_UNCHECKED */
+} png_info_t;
+
+/* Maps a PNG and reads its IHDR, palette size and chunk totals */
+/* crc_mode is PNG_CRC_CHECK or PNG_CRC_SKIP, as for png_summary_crc */
+/* Returns 0 on success, -1 if the file is not a PNG or its chunks are malformed */
+int png_scan(const char *path, png_info_t *out, int crc_mode);
+
+/* Scans many PNGs on a pool of threads and streams one record per file to
+ * stdout, in path order, as CSV or JSON lines. */
+/* paths: Files, or directories whose *.png files are scanned (not recursive) */
+/* list_file: File with one path per line ("-" for stdin), or NULL */
+/* threads: Worker threads, 0 for one per online CPU */
+/* Returns the number of files that could not be scanned, or -1 if the batch could not start */
+int png_batch_run(char **paths, int num_paths, const char *list_file, int format, int crc_mode, int threads);
+
+#endif
@@ -7,4 +7,8 @@
 /* Compute CRC over chunk type + data */
 uint32_t png_crc(const uint8_t *buf, size_t len);
 
+/* Update a running CRC, for type and data held in separate buffers */
+/* Start from 0xFFFFFFFF and XOR the result with 0xFFFFFFFF when done */
+uint32_t png_crc_update(uint32_t crc, const uint8_t *buf, size_t len);
+
 #endif
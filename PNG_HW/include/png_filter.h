@@ -0,0 +1,54 @@
+#ifndef PNG_FILTER_H
+#define PNG_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "png_chunks.h"
+
+/* Filter types (PNG 1.2 section 6) */
+#define PNG_FILTER_NONE  0
+#define PNG_FILTER_SUB   1
+#define PNG_FILTER_UP    2
+#define PNG_FILTER_AVG   3
+#define PNG_FILTER_PAETH 4
+
+/* Pick the filter of each scanline separately (png_filter_image only) */
+#define PNG_FILTER_ADAPTIVE 5
+
+/* Distance to the "left" byte: bytes per complete pixel, at least 1 */
+/* Returns 0 for a color type / bit depth combination PNG does not allow */
+size_t png_filter_bpp(const png_ihdr_t *ihdr);
+
+/* The filter to write the image with when the caller asked for filter:
+ * PNG_FILTER_NONE instead of PNG_FILTER_ADAPTIVE for palette images and
+ * bit depths below 8, the requested filter otherwise */
+int png_filter_for(const png_ihdr_t *ihdr, int filter);
+
+/* Reverses the filter of one scanline in place */
+/* row: len bytes after the filter type byte */
+/* prev: the previous scanline, already unfiltered, or NULL for the first one */
+/* Returns 0 on success, -1 on an unknown filter type */
+int png_unfilter_row(uint8_t type, uint8_t *row, const uint8_t *prev, size_t len, size_t bpp);
+
+/* Filters one scanline of raw bytes into out (len bytes, no filter type byte) */
+/* prev: the previous raw scanline, or NULL for the first one */
+/* Returns 0 on success, -1 on an unknown filter type */
+int png_filter_row(uint8_t type, const uint8_t *row, const uint8_t *prev, uint8_t *out, size_t len, size_t bpp);
+
+/* Unfilters every scanline of a non-interlaced image in place and sets the
+ * filter type bytes to PNG_FILTER_NONE, leaving raw pixels behind them */
+/* data: height scanlines of 1 + row_bytes bytes */
+/* Returns 0 on success, -1 on an unknown filter type */
+int png_unfilter_image(uint8_t *data, uint32_t height, size_t row_bytes, size_t bpp);
+
+/* Filters every scanline of a raw non-interlaced image into out, both laid
+ * out as height scanlines of 1 + row_bytes bytes. With PNG_FILTER_ADAPTIVE
+ * each scanline gets the filter whose output has the smallest sum of
+ * absolute values, read as signed bytes. */
+/* threads: Threads sharing the scanlines, 0 for one per online CPU */
+/* Returns 0 on success, -1 on an unknown filter type or allocation failure */
+int png_filter_image(const uint8_t *raw, uint8_t *out, uint32_t height, size_t row_bytes,
+                     size_t bpp, int filter, int threads);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PNG_IDAT_H
+#define PNG_IDAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#include "png_chunks.h"
+#include "png_reader.h"
+
+/* Inflates the zlib stream spread over a PNG's IDAT chunks one chunk at a
+ * time, straight into a buffer sized from IHDR. No chunk is concatenated
+ * and the output never grows. */
+typedef struct {
+    z_stream  strm;
+    uint8_t  *out;          /* Filtered scanlines, each led by its filter type byte */
+    size_t    out_size;     /* Size of the decoded image data, from IHDR */
+    size_t    out_len;      /* Bytes decoded so far */
+    size_t    stride;       /* 1 + bytes per scanline (non-interlaced images) */
+    uint32_t  rows_ready;   /* Complete scanlines in out (non-interlaced images) */
+    int       finished;     /* The zlib stream has ended */
+} png_idat_decoder_t;
+
+/* Bytes in one scanline of a pass width pixels wide, without the filter byte */
+/* Returns 0 for a color type / bit depth combination PNG does not allow */
+size_t png_row_bytes(const png_ihdr_t *ihdr, uint32_t width);
+
+/* Size of the decoded (still filtered) image data, all Adam7 passes included */
+/* Returns 0 if the IHDR is invalid or the size does not fit in a size_t */
+size_t png_image_size(const png_ihdr_t *ihdr);
+
+/* Returns 0 on success, -1 on error. Release with png_idat_free(). */
+int png_idat_init(png_idat_decoder_t *dec, const png_ihdr_t *ihdr);
+
+/* Decodes one more IDAT payload; rows_ready is updated as scanlines complete */
+/* Returns 0 on success, -1 on corrupt data or more data than IHDR allows */
+int png_idat_feed(png_idat_decoder_t *dec, const uint8_t *data, size_t len);
+
+/* Returns 0 if the stream ended and filled the image exactly, -1 otherwise */
+int png_idat_finish(png_idat_decoder_t *dec);
+
+/* Frees the decoder; out is freed too unless the caller took it (set it to NULL) */
+void png_idat_free(png_idat_decoder_t *dec);
+
+/* Decodes the IDAT chunks of a mapped PNG straight from the map */
+/* Returns 0 on success, -1 on error. Caller must free *out_data. */
+int png_map_idat(const png_map_t *map, png_ihdr_t *ihdr, uint8_t **out_data, size_t *out_size);
+
+/* Maps a PNG and decodes its IDAT chunks in place */
+/* Returns 0 on success, -1 on error. Caller must free *out_data. */
+int png_read_idat(const char *path, png_ihdr_t *ihdr, uint8_t **out_data, size_t *out_size);
+
+#endif
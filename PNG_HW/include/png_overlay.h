@@ -3,10 +3,16 @@
 
 #include <stdint.h>
 
+#include "png_writer.h"
+
 /* Overlay a smaller image onto a larger one starting at (x_offset, y_offset),
  * replacing the larger image's pixels wherever the smaller image lies. */
 int png_overlay_paste(const char *large_path, const char *small_path,
                       const char *output_path, uint32_t x_offset, uint32_t y_offset);
 
+/* png_overlay_paste, encoding the output as opts says (NULL for the defaults) */
+int png_overlay_paste_opts(const char *large_path, const char *small_path, const char *output_path,
+                           uint32_t x_offset, uint32_t y_offset, const png_write_opts_t *opts);
+
 #endif
 
@@ -7,11 +7,24 @@
 
 #include "png_chunks.h"
 
+/* How chunk CRCs are checked when they are not needed to read the data */
+#define PNG_CRC_CHECK 0     /* Check every chunk */
+#define PNG_CRC_SKIP  1     /* Never hash anything */
+
+/* Values of the crc field in a summary entry */
+#define PNG_CRC_INVALID   0
+#define PNG_CRC_VALID     1
+#define PNG_CRC_UNCHECKED 2
+
 /* Read all chunks from a PNG file and return summary */
 /* Returns 0 on success, -1 on error */
 /* The caller is responsible for freeing the summary array with free() */
 int png_summary(const char *filename, png_chunk_t **out_summary);
 
+/* png_summary with a choice of CRC checking */
+/* With PNG_CRC_SKIP every entry's crc is PNG_CRC_UNCHECKED and only the chunk headers are read */
+int png_summary_crc(const char *filename, png_chunk_t **out_summary, int crc_mode);
+
 /* Opens a PNG file and validates signature */
 FILE *png_open(const char *path);
 
@@ -29,4 +42,47 @@ int png_extract_ihdr(FILE *fp, png_ihdr_t *out);
 /* Returns 0 on success, -1 on error/not found. */
 int png_extract_plte(FILE *fp, png_color_t **out_colors, size_t *out_count);
 
+/* A whole PNG file in memory, mapped when possible */
+typedef struct {
+    const uint8_t *data;
+    size_t         size;
+    int            mapped;  /* 1 if data is an mmap, 0 if it was read into a malloc'd buffer */
+} png_map_t;
+
+/* A chunk inside a png_map_t. Nothing is copied: data points into the map
+ * and stays valid until png_unmap. The CRC is not checked until asked for,
+ * with png_chunk_crc_ok or png_chunk_data. */
+typedef struct {
+    uint32_t       length;
+    char           type[5]; /* Null-terminated */
+    const uint8_t *data;    /* length bytes, preceded in the map by the type */
+    uint32_t       crc;     /* CRC stored in the file, not checked */
+} png_chunk_view_t;
+
+typedef struct {
+    const png_map_t *map;
+    size_t           offset;  /* Start of the next chunk */
+    int              done;    /* IEND has been returned */
+} png_chunk_iter_t;
+
+/* Maps a PNG file and validates signature */
+/* Returns 0 on success, -1 on error. Release the map with png_unmap(). */
+int png_map(const char *path, png_map_t *out);
+
+void png_unmap(png_map_t *map);
+
+/* Starts an iterator at the first chunk after the signature */
+void png_chunk_iter_init(png_chunk_iter_t *it, const png_map_t *map);
+
+/* Returns the next chunk as a view into the map, without allocating */
+/* Returns 1 on success, 0 once IEND has been returned, -1 on a truncated or malformed chunk */
+int png_chunk_next(png_chunk_iter_t *it, png_chunk_view_t *out);
+
+/* Returns 1 if the stored CRC matches the chunk's type and data, 0 otherwise */
+int png_chunk_crc_ok(const png_chunk_view_t *chunk);
+
+/* Returns the chunk data once its CRC has been checked, NULL on a mismatch */
+/* The check runs on every call, so keep the pointer rather than calling again */
+const uint8_t *png_chunk_data(const png_chunk_view_t *chunk);
+
 #endif
@@ -5,10 +5,17 @@
 #include <stdio.h>
 #include <stddef.h>
 
+#include "png_writer.h"
+
 /* Encode a secret string into the LSBs of PNG image data */
 /* Returns 0 on success, -1 on error */
 int png_encode_lsb(const char *input_path, const char *output_path, const char *secret);
 
+/* png_encode_lsb, compressing the output as opts says (NULL for the defaults) */
+/* opts->filter is ignored, since filtering again would scramble the hidden bits */
+int png_encode_lsb_opts(const char *input_path, const char *output_path, const char *secret,
+                        const png_write_opts_t *opts);
+
 /* Extract a secret string from the LSBs of PNG image data */
 /* Returns length of extracted string on success, -1 on error */
 /* The extracted string is written to 'out', which must be at least 'max_len' bytes */
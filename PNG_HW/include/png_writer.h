@@ -0,0 +1,52 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+#include "png_filter.h"
+#include "util.h"
+
+/* How the image data of a written PNG is encoded */
+typedef struct {
+    int filter;     /* PNG_FILTER_NONE to PNG_FILTER_PAETH for every scanline, or PNG_FILTER_ADAPTIVE */
+    int threads;    /* Threads for filtering and compression, 0 for one per online CPU */
+    size_t idat_size;   /* Largest IDAT payload, 0 for a single IDAT */
+    util_deflate_opts_t zlib;   /* Compression level, strategy and memLevel */
+} png_write_opts_t;
+
+/* Unfiltered scanlines, compressed with zlib's defaults on one thread into a single IDAT */
+#define PNG_WRITE_OPTS_DEFAULT { PNG_FILTER_NONE, 1, 0, UTIL_DEFLATE_OPTS_DEFAULT }
+
+/* IDAT payload size for streamed output */
+#define PNG_IDAT_STREAM_SIZE (64 * 1024)
+
+/* Writes the 8-byte PNG signature */
+/* Returns 0 on success, -1 on a write error */
+int png_write_signature(FILE *fp);
+
+/* Writes one chunk: length, type, data and the CRC over type and data */
+/* Returns 0 on success, -1 on a write error */
+int png_write_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t length);
+
+/* Writes an already compressed zlib stream as IDAT chunks */
+/* idat_size: Largest payload per chunk, 0 for a single chunk */
+/* Returns 0 on success, -1 on a write error or a payload too large for one chunk */
+int png_write_idat(FILE *fp, const uint8_t *compressed, size_t size, size_t idat_size);
+
+/* Deflates filtered image data straight into IDAT chunks of idat_size bytes
+ * (the last one shorter), holding only one chunk of output at a time */
+/* zlib: Compression settings, NULL for the defaults */
+/* Returns 0 on success, -1 on a compression or write error */
+int png_write_idat_stream(FILE *fp, const uint8_t *data, size_t size, size_t idat_size,
+                          const util_deflate_opts_t *zlib);
+
+/* Compresses filtered image data and writes it as IDAT chunks, as opts
+ * says; opts->filter is left to the caller */
+/* stride: Bytes per scanline, filter type byte included */
+/* Returns 0 on success, -1 on a compression or write error */
+int png_write_image_data(FILE *fp, const uint8_t *data, size_t size, size_t stride,
+                         const png_write_opts_t *opts);
+
+#endif
@@ -4,6 +4,19 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <zlib.h>
+
+/* zlib settings for the PNG compressors, which always use a 32 KB window */
+typedef struct {
+    int level;      /* Z_DEFAULT_COMPRESSION, or 0 (store) to 9 (smallest) */
+    int strategy;   /* Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED */
+    int mem_level;  /* 1 to 9: memory for the compression state, 8 by default */
+} util_deflate_opts_t;
+
+#define UTIL_DEFLATE_OPTS_DEFAULT { Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, 8 }
+
+/* Returns 1 if deflateInit2 accepts opts' level, strategy and memLevel, 0 if not */
+int util_deflate_opts_valid(const util_deflate_opts_t *opts);
 
 /* Big-endian helpers */
 uint32_t read_u32_be(const uint8_t *buf);
@@ -28,4 +41,18 @@ int util_deflate_data(const uint8_t *data, size_t data_size,
 int util_deflate_data_png(const uint8_t *data, size_t data_size,
                           uint8_t **out_data, size_t *out_size);
 
+/* util_deflate_data_png with the level, strategy and memLevel of opts (NULL for the defaults) */
+/* Returns 0 on success, -1 on error or invalid settings. Caller must free *out_data. */
+int util_deflate_data_png_opts(const uint8_t *data, size_t data_size,
+                               uint8_t **out_data, size_t *out_size, const util_deflate_opts_t *opts);
+
+/* Compress data like util_deflate_data_png, split into bands that are
+ * deflated on separate threads and joined into one zlib stream */
+/* stride: Bands start on a multiple of this (a scanline), or 1 */
+/* threads: Threads to use, 0 for one per online CPU */
+/* opts: zlib settings, NULL for the defaults */
+/* Returns 0 on success, -1 on error. Caller must free *out_data. */
+int util_deflate_data_png_mt(const uint8_t *data, size_t data_size, size_t stride, int threads,
+                             uint8_t **out_data, size_t *out_size, const util_deflate_opts_t *opts);
+
 #endif
@@ -1,14 +1,274 @@
-#include <stdio.h>
-#include <stddef.h>
-#include <stdlib.h>
-#include <string.h>
-#include "global.h"
-#include "png_reader.h"
-#include "png_chunks.h"
-#include "png_steg.h"
-#include "png_overlay.h"
-
-int main(int argc, char **argv)
-{
-    return 0;
-}
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "png_reader.h"
+#include "png_chunks.h"
+#include "png_steg.h"
+#include "png_overlay.h"
+#include "png_batch.h"
+#include "png_writer.h"
+
+#define MAX_SECRET_LEN 4096
+
+int main(int argc, char **argv)
+{
+    const char *filename = NULL;
+    int batch = 0;
+    png_write_opts_t write_opts = PNG_WRITE_OPTS_DEFAULT;
+    int summary_crc = PNG_CRC_CHECK;
+
+    /* First pass: -h wins over everything, then find -f (or batch mode) and
+     * the output settings. The message of -e and the files of -m are
+     * operands, not options, so both loops step over them. */
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-m") == 0) &&
+            i + 3 < argc && strcmp(argv[i + 2], "-o") == 0) {
+            i += 3;
+        } else if (strcmp(argv[i], "-h") == 0) {
+            PRINT_USAGE(argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            if (i + 1 >= argc) {
+                PRINT_ERROR_F_REQUIRES_FILENAME();
+                return EXIT_FAILURE;
+            }
+            filename = argv[++i];
+        } else if ((strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-m") == 0) &&
+                   i + 3 < argc && strcmp(argv[i + 2], "-o") == 0) {
+            /* A malformed -e or -m is reported by the second pass */
+            int overlay = strcmp(argv[i], "-m") == 0;
+            i += 3;
+            while (overlay && i + 2 < argc && (strcmp(argv[i + 1], "-w") == 0 || strcmp(argv[i + 1], "-g") == 0)) {
+                i += 2;
+            }
+        } else if (strcmp(argv[i], "-b") == 0) {
+            batch = 1;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            summary_crc = PNG_CRC_SKIP;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            write_opts.filter = PNG_FILTER_ADAPTIVE;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            write_opts.idat_size = PNG_IDAT_STREAM_SIZE;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            write_opts.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-L") == 0) {
+            char *end = NULL;
+            long level = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : -1;
+            if (end == NULL || *end != '\0' || level < 0 || level > 9) {
+                PRINT_ERROR_LEVEL_REQUIRES();
+                return EXIT_FAILURE;
+            }
+            write_opts.zlib.level = (int)level;
+            i++;
+        } else if (strcmp(argv[i], "-M") == 0) {
+            char *end = NULL;
+            long mem_level = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : 0;
+            if (end == NULL || *end != '\0' || mem_level < 1 || mem_level > 9) {
+                PRINT_ERROR_MEMLEVEL_REQUIRES();
+                return EXIT_FAILURE;
+            }
+            write_opts.zlib.mem_level = (int)mem_level;
+            i++;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            const char *name = i + 1 < argc ? argv[++i] : "";
+            if (strcmp(name, "default") == 0) {
+                write_opts.zlib.strategy = Z_DEFAULT_STRATEGY;
+            } else if (strcmp(name, "filtered") == 0) {
+                write_opts.zlib.strategy = Z_FILTERED;
+            } else if (strcmp(name, "huffman") == 0) {
+                write_opts.zlib.strategy = Z_HUFFMAN_ONLY;
+            } else if (strcmp(name, "rle") == 0) {
+                write_opts.zlib.strategy = Z_RLE;
+            } else if (strcmp(name, "fixed") == 0) {
+                write_opts.zlib.strategy = Z_FIXED;
+            } else {
+                PRINT_ERROR_STRATEGY_REQUIRES();
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (batch) {
+        int format = PNG_BATCH_CSV;
+        int crc_mode = PNG_CRC_CHECK;
+        int threads = 0;
+        const char *list_file = NULL;
+        /* Batch inputs are the arguments that are not options */
+        char **paths = malloc((size_t)argc * sizeof(char *));
+        int num_paths = 0;
+        if (paths == NULL) {
+            return EXIT_FAILURE;
+        }
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-b") == 0) {
+                continue;
+            } else if (strcmp(argv[i], "-J") == 0) {
+                format = PNG_BATCH_JSON;
+            } else if (strcmp(argv[i], "-n") == 0) {
+                crc_mode = PNG_CRC_SKIP;
+            } else if (strcmp(argv[i], "-j") == 0) {
+                if (i + 1 >= argc) {
+                    PRINT_ERROR_THREADS_REQUIRES();
+                    free(paths);
+                    return EXIT_FAILURE;
+                }
+                threads = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "-l") == 0) {
+                if (i + 1 >= argc) {
+                    PRINT_ERROR_LIST_REQUIRES();
+                    free(paths);
+                    return EXIT_FAILURE;
+                }
+                list_file = argv[++i];
+            } else if (strcmp(argv[i], "-f") == 0) {
+                paths[num_paths++] = argv[++i];
+            } else if (argv[i][0] != '-') {
+                paths[num_paths++] = argv[i];
+            } else {
+                PRINT_ERROR_UNKNOWN_OPTION(argv[i]);
+                free(paths);
+                return EXIT_FAILURE;
+            }
+        }
+        int failed = -1;
+        if (num_paths == 0 && list_file == NULL) {
+            PRINT_ERROR_BATCH_INPUTS();
+        } else {
+            failed = png_batch_run(paths, num_paths, list_file, format, crc_mode, threads);
+        }
+        free(paths);
+        return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (filename == NULL) {
+        PRINT_ERROR_MISSING_F_FLAG();
+        return EXIT_FAILURE;
+    }
+
+    /* Second pass: run the operations in the order they were given */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            i++;
+        } else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-n") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "-L") == 0 || strcmp(argv[i], "-M") == 0 || strcmp(argv[i], "-S") == 0) {
+            i++;    /* Checked in the first pass */
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc) {
+                PRINT_ERROR_THREADS_REQUIRES();
+                return EXIT_FAILURE;
+            }
+            i++;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            png_chunk_t *summary = NULL;
+            if (png_summary_crc(filename, &summary, summary_crc) != 0) {
+                PRINT_ERROR_READ_CHUNKS();
+                return EXIT_FAILURE;
+            }
+            PRINT_CHUNK_SUMMARY_HEADER(filename);
+            for (int j = 0; ; j++) {
+                PRINT_CHUNK_INFO(j, summary[j]);
+                if (strcmp(summary[j].type, "IEND") == 0) {
+                    break;
+                }
+            }
+            free(summary);
+        } else if (strcmp(argv[i], "-p") == 0) {
+            FILE *fp = png_open(filename);
+            if (fp == NULL) {
+                PRINT_ERROR_OPEN_FILE(filename);
+                return EXIT_FAILURE;
+            }
+            png_color_t *colors = NULL;
+            size_t count = 0;
+            int ret = png_extract_plte(fp, &colors, &count);
+            fclose(fp);
+            if (ret != 0) {
+                PRINT_ERROR_PLTE_NOT_FOUND();
+                return EXIT_FAILURE;
+            }
+            PRINT_PALETTE_HEADER(filename);
+            PRINT_PALETTE_COUNT(count);
+            for (size_t j = 0; j < count; j++) {
+                PRINT_PALETTE_COLOR(j, colors[j].r, colors[j].g, colors[j].b);
+            }
+            free(colors);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            FILE *fp = png_open(filename);
+            if (fp == NULL) {
+                PRINT_ERROR_OPEN_FILE(filename);
+                return EXIT_FAILURE;
+            }
+            png_ihdr_t ihdr;
+            int ret = png_extract_ihdr(fp, &ihdr);
+            fclose(fp);
+            if (ret != 0) {
+                PRINT_ERROR_READ_IHDR();
+                return EXIT_FAILURE;
+            }
+            PRINT_IHDR(filename, ihdr);
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (i + 3 >= argc || strcmp(argv[i + 2], "-o") != 0) {
+                PRINT_ERROR_ENCODE_REQUIRES();
+                return EXIT_FAILURE;
+            }
+            const char *secret = argv[i + 1];
+            const char *out = argv[i + 3];
+            i += 3;
+            if (png_encode_lsb_opts(filename, out, secret, &write_opts) != 0) {
+                PRINT_ERROR_ENCODE_FAILED();
+                return EXIT_FAILURE;
+            }
+            PRINT_ENCODE_SUCCESS(out);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            char secret[MAX_SECRET_LEN];
+            if (png_extract_lsb(filename, secret, sizeof(secret)) < 0) {
+                PRINT_ERROR_EXTRACT_FAILED();
+                return EXIT_FAILURE;
+            }
+            PRINT_HIDDEN_MESSAGE(secret);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            if (i + 3 >= argc || strcmp(argv[i + 2], "-o") != 0) {
+                PRINT_ERROR_OVERLAY_REQUIRES();
+                return EXIT_FAILURE;
+            }
+            const char *small = argv[i + 1];
+            const char *out = argv[i + 3];
+            uint32_t x = 0, y = 0;
+            i += 3;
+            /* -w and -g may follow in either order */
+            while (i + 1 < argc && (strcmp(argv[i + 1], "-w") == 0 || strcmp(argv[i + 1], "-g") == 0)) {
+                int is_width = strcmp(argv[i + 1], "-w") == 0;
+                if (i + 2 >= argc) {
+                    if (is_width) {
+                        PRINT_ERROR_WIDTH_REQUIRES();
+                    } else {
+                        PRINT_ERROR_HEIGHT_REQUIRES();
+                    }
+                    return EXIT_FAILURE;
+                }
+                uint32_t value = (uint32_t)strtoul(argv[i + 2], NULL, 10);
+                if (is_width) {
+                    x = value;
+                } else {
+                    y = value;
+                }
+                i += 2;
+            }
+            if (png_overlay_paste_opts(filename, small, out, x, y, &write_opts) != 0) {
+                PRINT_ERROR_OVERLAY_FAILED();
+                return EXIT_FAILURE;
+            }
+            PRINT_OVERLAY_SUCCESS(out);
+        } else {
+            PRINT_ERROR_UNKNOWN_OPTION(argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,326 @@
+#include "png_batch.h"
+#include "png_reader.h"
+#include "global.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char       *path;
+    png_info_t  info;
+    int         failed;     /* Set up front for a directory that cannot be listed */
+    int         done;       /* Set under the batch lock once info is filled in */
+} batch_file_t;
+
+typedef struct {
+    batch_file_t   *files;
+    size_t          count;
+    size_t          cap;
+    size_t          next;   /* Next file for the pool, taken with an atomic add */
+    int             crc_mode;
+    pthread_mutex_t lock;
+    pthread_cond_t  file_done;
+} batch_t;
+
+/* Maps a PNG and reads its IHDR, palette size and chunk totals */
+int png_scan(const char *path, png_info_t *out, int crc_mode)
+{
+    if (path == NULL || out == NULL) {
+        return -1;
+    }
+    png_map_t map;
+    if (png_map(path, &map) != 0) {
+        return -1;
+    }
+
+    png_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.crc = crc_mode == PNG_CRC_SKIP ? PNG_CRC_UNCHECKED : PNG_CRC_VALID;
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int ret;
+    png_chunk_iter_init(&it, &map);
+    while ((ret = png_chunk_next(&it, &view)) == 1) {
+        if (info.num_chunks == 0) {
+            /* The view is only read, the cast just fits png_chunk_t */
+            png_chunk_t ihdr = { view.length, "", (uint8_t *)view.data, view.crc };
+            memcpy(ihdr.type, view.type, sizeof(ihdr.type));
+            if (png_parse_ihdr(&ihdr, &info.ihdr) != 0) {
+                ret = -1;
+                break;
+            }
+        } else if (strcmp(view.type, "PLTE") == 0) {
+            info.palette_size = view.length / 3;
+        } else if (strcmp(view.type, "IDAT") == 0) {
+            info.idat_bytes += view.length;
+        }
+        if (crc_mode != PNG_CRC_SKIP && !png_chunk_crc_ok(&view)) {
+            info.crc = PNG_CRC_INVALID;
+        }
+        info.num_chunks++;
+    }
+    png_unmap(&map);
+    if (ret != 0) {
+        return -1;
+    }
+    *out = info;
+    return 0;
+}
+
+static int has_png_suffix(const char *path)
+{
+    size_t len = strlen(path);
+    return len > 4 && strcasecmp(path + len - 4, ".png") == 0;
+}
+
+static int add_file(batch_t *b, const char *path)
+{
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        batch_file_t *tmp = realloc(b->files, cap * sizeof(batch_file_t));
+        if (tmp == NULL) {
+            return -1;
+        }
+        b->files = tmp;
+        b->cap = cap;
+    }
+    batch_file_t *f = &b->files[b->count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (f->path == NULL) {
+        return -1;
+    }
+    b->count++;
+    return 0;
+}
+
+/* Queues a file as given, or the *.png files directly inside a directory */
+static int add_path(batch_t *b, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        /* Files that cannot be opened are reported in their own record */
+        return add_file(b, path);
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        /* Reported like a file that cannot be read, without stopping the batch */
+        if (add_file(b, path) != 0) {
+            return -1;
+        }
+        b->files[b->count - 1].failed = 1;
+        return 0;
+    }
+    int ret = 0;
+    struct dirent *ent;
+    while (ret == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' || !has_png_suffix(ent->d_name)) {
+            continue;
+        }
+        size_t len = strlen(path) + 1 + strlen(ent->d_name) + 1;
+        char *child = malloc(len);
+        if (child == NULL) {
+            ret = -1;
+            break;
+        }
+        snprintf(child, len, "%s/%s", path, ent->d_name);
+        struct stat child_st;
+        if (stat(child, &child_st) == 0 && S_ISREG(child_st.st_mode)) {
+            ret = add_file(b, child);
+        }
+        free(child);
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int add_list_file(batch_t *b, const char *list_file)
+{
+    FILE *list = strcmp(list_file, "-") == 0 ? stdin : fopen(list_file, "r");
+    if (list == NULL) {
+        PRINT_ERROR_OPEN_FILE(list_file);
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+    int ret = 0;
+    while (ret == 0 && (n = getline(&line, &line_cap, list)) != -1) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n > 0) {
+            ret = add_path(b, line);
+        }
+    }
+    free(line);
+    if (list != stdin) {
+        fclose(list);
+    }
+    return ret;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+    return strcmp(((const batch_file_t *)a)->path, ((const batch_file_t *)b)->path);
+}
+
+/* Pool thread: takes the next unclaimed file until none are left */
+static void *batch_worker(void *arg)
+{
+    batch_t *b = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->count) {
+            break;
+        }
+        batch_file_t *f = &b->files[i];
+        if (!f->failed) {
+            f->failed = png_scan(f->path, &f->info, b->crc_mode) != 0;
+        }
+        pthread_mutex_lock(&b->lock);
+        f->done = 1;
+        pthread_cond_broadcast(&b->file_done);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+static void print_csv_path(const char *path)
+{
+    if (strpbrk(path, ",\"\r\n") == NULL) {
+        fputs(path, stdout);
+        return;
+    }
+    putchar('"');
+    for (const char *p = path; *p; p++) {
+        if (*p == '"') {
+            putchar('"');
+        }
+        putchar(*p);
+    }
+    putchar('"');
+}
+
+static void print_json_path(const char *path)
+{
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            printf("\\%c", *p);
+        } else if (*p < 0x20) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+static const char *crc_name(int crc)
+{
+    return crc == PNG_CRC_VALID ? "valid" : crc == PNG_CRC_INVALID ? "invalid" : "unchecked";
+}
+
+static void print_record(const batch_file_t *f, int format)
+{
+    const png_info_t *in = &f->info;
+    if (format == PNG_BATCH_JSON) {
+        printf("{\"path\":");
+        print_json_path(f->path);
+        if (f->failed) {
+            printf(",\"status\":\"error\"}\n");
+            return;
+        }
+        printf(",\"status\":\"ok\",\"width\":%u,\"height\":%u,\"bit_depth\":%u,\"color_type\":%u,"
+               "\"interlace\":%u,\"palette\":%zu,\"chunks\":%u,\"idat_bytes\":%llu,\"crc\":\"%s\"}\n",
+               in->ihdr.width, in->ihdr.height, in->ihdr.bit_depth, in->ihdr.color_type,
+               in->ihdr.interlace, in->palette_size, in->num_chunks,
+               (unsigned long long)in->idat_bytes, crc_name(in->crc));
+    } else {
+        print_csv_path(f->path);
+        if (f->failed) {
+            printf(",error,,,,,,,,,\n");
+            return;
+        }
+        printf(",ok,%u,%u,%u,%u,%u,%zu,%u,%llu,%s\n",
+               in->ihdr.width, in->ihdr.height, in->ihdr.bit_depth, in->ihdr.color_type,
+               in->ihdr.interlace, in->palette_size, in->num_chunks,
+               (unsigned long long)in->idat_bytes, crc_name(in->crc));
+    }
+}
+
+int png_batch_run(char **paths, int num_paths, const char *list_file, int format, int crc_mode, int threads)
+{
+    if (format != PNG_BATCH_CSV && format != PNG_BATCH_JSON) {
+        return -1;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    batch_t b;
+    memset(&b, 0, sizeof(b));
+    b.crc_mode = crc_mode;
+    int ret = 0;
+    for (int i = 0; ret == 0 && i < num_paths; i++) {
+        ret = add_path(&b, paths[i]);
+    }
+    if (ret == 0 && list_file != NULL) {
+        ret = add_list_file(&b, list_file);
+    }
+
+    int failed = 0;
+    if (ret == 0) {
+        qsort(b.files, b.count, sizeof(batch_file_t), cmp_path);
+        pthread_mutex_init(&b.lock, NULL);
+        pthread_cond_init(&b.file_done, NULL);
+
+        int pool = b.count < (size_t)threads ? (int)b.count : threads;
+        pthread_t *tids = malloc((size_t)(pool ? pool : 1) * sizeof(pthread_t));
+        int started = 0;
+        while (tids != NULL && started < pool && pthread_create(&tids[started], NULL, batch_worker, &b) == 0) {
+            started++;
+        }
+        if (started == 0) {
+            batch_worker(&b);
+        }
+
+        /* Records go out in path order as soon as each file is done, so
+         * the stream never waits for the whole batch */
+        if (format == PNG_BATCH_CSV) {
+            PRINT_BATCH_CSV_HEADER();
+        }
+        for (size_t i = 0; i < b.count; i++) {
+            pthread_mutex_lock(&b.lock);
+            while (!b.files[i].done) {
+                pthread_cond_wait(&b.file_done, &b.lock);
+            }
+            pthread_mutex_unlock(&b.lock);
+            print_record(&b.files[i], format);
+            failed += b.files[i].failed;
+        }
+        fflush(stdout);
+
+        for (int i = 0; i < started; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        free(tids);
+        pthread_cond_destroy(&b.file_done);
+        pthread_mutex_destroy(&b.lock);
+    }
+
+    for (size_t i = 0; i < b.count; i++) {
+        free(b.files[i].path);
+    }
+    free(b.files);
+    return ret == 0 ? failed : -1;
+}
@@ -1,11 +1,34 @@
 #include "png_chunks.h"
 #include "util.h"
 #include <stdlib.h>
+#include <string.h>
 
 /* Parse IHDR data from chunk */
 /* Chunk must be an IHDR chunk with length 13 */
 int png_parse_ihdr(const png_chunk_t *chunk, png_ihdr_t *out)
 {
+    if (chunk == NULL || out == NULL || chunk->data == NULL) {
+        return -1;
+    }
+    if (strcmp(chunk->type, "IHDR") != 0 || chunk->length != 13) {
+        return -1;
+    }
+
+    const uint8_t *d = chunk->data;
+    png_ihdr_t ihdr;
+    ihdr.width = read_u32_be(d);
+    ihdr.height = read_u32_be(d + 4);
+    ihdr.bit_depth = d[8];
+    ihdr.color_type = d[9];
+    ihdr.compression = d[10];
+    ihdr.filter = d[11];
+    ihdr.interlace = d[12];
+
+    if (ihdr.width == 0 || ihdr.height == 0 || ihdr.compression != 0 ||
+        ihdr.filter != 0 || ihdr.interlace > 1) {
+        return -1;
+    }
+    *out = ihdr;
     return 0;
 }
 
@@ -13,5 +36,27 @@ int png_parse_ihdr(const png_chunk_t *chunk, png_ihdr_t *out)
 /* Chunk must be a PLTE chunk with length multiple of 3 */
 int png_parse_plte(const png_chunk_t *chunk, png_color_t **out_colors, size_t *out_count)
 {
+    if (chunk == NULL || out_colors == NULL || out_count == NULL || chunk->data == NULL) {
+        return -1;
+    }
+    if (strcmp(chunk->type, "PLTE") != 0 || chunk->length == 0 || chunk->length % 3 != 0) {
+        return -1;
+    }
+
+    size_t count = chunk->length / 3;
+    if (count > 256) {
+        return -1;
+    }
+    png_color_t *colors = malloc(count * sizeof(png_color_t));
+    if (colors == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        colors[i].r = chunk->data[3 * i];
+        colors[i].g = chunk->data[3 * i + 1];
+        colors[i].b = chunk->data[3 * i + 2];
+    }
+    *out_colors = colors;
+    *out_count = count;
     return 0;
-}
\ No newline at end of file
+}
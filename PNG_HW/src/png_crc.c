@@ -1,7 +1,37 @@
 #include "png_crc.h"
+#include <pthread.h>
 
-uint32_t png_crc(const uint8_t *buf, size_t len)
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+/* Table of CRCs of all 8-bit messages, polynomial 0xEDB88320 */
+static void make_crc_table(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            if (c & 1) {
+                c = 0xEDB88320UL ^ (c >> 1);
+            } else {
+                c = c >> 1;
+            }
+        }
+        crc_table[n] = c;
+    }
+}
+
+/* Update a running CRC with len more bytes */
+/* The CRC starts at 0xFFFFFFFF and is finished by inverting it */
+uint32_t png_crc_update(uint32_t crc, const uint8_t *buf, size_t len)
 {
-    return 0xFFFFFFFFUL;
+    pthread_once(&crc_table_once, make_crc_table);
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
 }
 
+uint32_t png_crc(const uint8_t *buf, size_t len)
+{
+    return png_crc_update(0xFFFFFFFFUL, buf, len) ^ 0xFFFFFFFFUL;
+}
@@ -0,0 +1,446 @@
+#include "png_filter.h"
+#include "png_idat.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Paeth predictor (PNG 1.2 section 6.6): the neighbor closest to a + b - c,
+ * ties going to a, then b */
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+    int pa = abs((int)b - c);
+    int pb = abs((int)a - c);
+    int pc = abs((int)a + b - 2 * c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+size_t png_filter_bpp(const png_ihdr_t *ihdr)
+{
+    /* One pixel rounds up to a whole byte for bit depths below 8 */
+    return png_row_bytes(ihdr, 1);
+}
+
+int png_filter_for(const png_ihdr_t *ihdr, int filter)
+{
+    /* PNG 1.2 section 12.8: palette indices and packed samples are not
+     * smooth, so filtering them only adds entropy */
+    if (filter == PNG_FILTER_ADAPTIVE && (ihdr->color_type == 3 || ihdr->bit_depth < 8)) {
+        return PNG_FILTER_NONE;
+    }
+    return filter;
+}
+
+static void unfilter_scalar(uint8_t type, uint8_t *row, const uint8_t *prev, size_t start, size_t len,
+                            size_t bpp)
+{
+    size_t i;
+    switch (type) {
+        case PNG_FILTER_SUB:
+            for (i = start > bpp ? start : bpp; i < len; i++) {
+                row[i] += row[i - bpp];
+            }
+            break;
+        case PNG_FILTER_UP:
+            for (i = start; i < len; i++) {
+                row[i] += prev[i];
+            }
+            break;
+        case PNG_FILTER_AVG:
+            for (i = start; i < len; i++) {
+                unsigned left = i >= bpp ? row[i - bpp] : 0;
+                unsigned up = prev ? prev[i] : 0;
+                row[i] += (uint8_t)((left + up) >> 1);
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (i = start; i < len; i++) {
+                uint8_t a = i >= bpp ? row[i - bpp] : 0;
+                uint8_t b = prev ? prev[i] : 0;
+                uint8_t c = i >= bpp && prev ? prev[i - bpp] : 0;
+                row[i] += paeth(a, b, c);
+            }
+            break;
+    }
+}
+
+static void filter_scalar(uint8_t type, const uint8_t *row, const uint8_t *prev, uint8_t *out,
+                          size_t start, size_t len, size_t bpp)
+{
+    for (size_t i = start; i < len; i++) {
+        uint8_t a = i >= bpp ? row[i - bpp] : 0;
+        uint8_t b = prev ? prev[i] : 0;
+        uint8_t c = i >= bpp && prev ? prev[i - bpp] : 0;
+        switch (type) {
+            case PNG_FILTER_NONE:  out[i] = row[i]; break;
+            case PNG_FILTER_SUB:   out[i] = row[i] - a; break;
+            case PNG_FILTER_UP:    out[i] = row[i] - b; break;
+            case PNG_FILTER_AVG:   out[i] = row[i] - (uint8_t)(((unsigned)a + b) >> 1); break;
+            case PNG_FILTER_PAETH: out[i] = row[i] - paeth(a, b, c); break;
+        }
+    }
+}
+
+#ifdef __SSE2__
+/* Sub, Average and Paeth depend on the byte one pixel to the left, so
+ * unfiltering runs one pixel at a time with every channel in its own lane.
+ * That covers the 3, 4, 6 and 8 byte pixels of 8 and 16-bit RGB(A); the
+ * 1 and 2 byte ones stay scalar. A 3 or 6 byte pixel is moved as 4 or 8
+ * bytes, with the lanes past it masked out of the prediction so the bytes
+ * of the next pixel are stored back unchanged. */
+#define PX_WIDTH(bpp) ((bpp) <= 4 ? 4 : 8)
+
+static inline __m128i load_px(const uint8_t *p, size_t bpp)
+{
+    if (PX_WIDTH(bpp) == 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return _mm_cvtsi32_si128((int)v);
+    }
+    return _mm_loadl_epi64((const __m128i *)p);
+}
+
+static inline void store_px(uint8_t *p, __m128i x, size_t bpp)
+{
+    if (PX_WIDTH(bpp) == 4) {
+        uint32_t v = (uint32_t)_mm_cvtsi128_si32(x);
+        memcpy(p, &v, 4);
+    } else {
+        _mm_storel_epi64((__m128i *)p, x);
+    }
+}
+
+/* All ones in the first bpp byte lanes */
+static inline __m128i px_mask(size_t bpp)
+{
+    static const uint8_t ones[16] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    return _mm_loadl_epi64((const __m128i *)(ones + 8 - bpp));
+}
+
+static inline __m128i if_then_else(__m128i mask, __m128i x, __m128i y)
+{
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+static inline __m128i abs_epi16(__m128i x)
+{
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/* Branchless Paeth on 16-bit lanes: pa = |b - c|, pb = |a - c| and
+ * pc = |(b - c) + (a - c)|, then the smallest wins with a, b, c priority */
+static inline __m128i paeth_epi16(__m128i a, __m128i b, __m128i c)
+{
+    __m128i pa_s = _mm_sub_epi16(b, c);
+    __m128i pb_s = _mm_sub_epi16(a, c);
+    __m128i pc = abs_epi16(_mm_add_epi16(pa_s, pb_s));
+    __m128i pa = abs_epi16(pa_s);
+    __m128i pb = abs_epi16(pb_s);
+    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    __m128i pred = if_then_else(_mm_cmpeq_epi16(pb, smallest), b, c);
+    return if_then_else(_mm_cmpeq_epi16(pa, smallest), a, pred);
+}
+
+/* floor((a + b) / 2); _mm_avg_epu8 rounds up, so take back the odd bit */
+static inline __m128i avg_floor_epu8(__m128i a, __m128i b)
+{
+    __m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+    return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
+}
+
+/* Inlined per pixel size so the loads and stores become plain moves */
+static inline __attribute__((always_inline))
+void unfilter_sse2(uint8_t type, uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = px_mask(bpp);
+    const __m128i mask16 = _mm_unpacklo_epi8(mask, mask);
+    __m128i a = zero, c = zero;
+    size_t i = 0;
+    /* The wide moves of the last pixel would run past the row */
+    size_t end = len >= PX_WIDTH(bpp) ? len - PX_WIDTH(bpp) + 1 : 0;
+    switch (type) {
+        case PNG_FILTER_SUB:
+            for (; i < end; i += bpp) {
+                __m128i x = _mm_add_epi8(load_px(row + i, bpp), a);
+                store_px(row + i, x, bpp);
+                a = _mm_and_si128(x, mask);
+            }
+            break;
+        case PNG_FILTER_AVG:
+            for (; i < end; i += bpp) {
+                __m128i b = prev ? load_px(prev + i, bpp) : zero;
+                __m128i x = _mm_add_epi8(load_px(row + i, bpp), _mm_and_si128(avg_floor_epu8(a, b), mask));
+                store_px(row + i, x, bpp);
+                a = _mm_and_si128(x, mask);
+            }
+            break;
+        case PNG_FILTER_PAETH:
+            for (; i < end; i += bpp) {
+                __m128i b = prev ? _mm_and_si128(_mm_unpacklo_epi8(load_px(prev + i, bpp), zero), mask16) : zero;
+                __m128i x = _mm_unpacklo_epi8(load_px(row + i, bpp), zero);
+                x = _mm_and_si128(_mm_add_epi16(x, paeth_epi16(a, b, c)), _mm_set1_epi16(0xFF));
+                store_px(row + i, _mm_packus_epi16(x, x), bpp);
+                a = _mm_and_si128(x, mask16);
+                c = b;
+            }
+            break;
+    }
+    unfilter_scalar(type, row, prev, i, len, bpp);
+}
+
+/* Up has no dependency along the row, so it runs 16 bytes at a time */
+static void unfilter_up_sse2(uint8_t *row, const uint8_t *prev, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(prev + i));
+        _mm_storeu_si128((__m128i *)(row + i), _mm_add_epi8(x, b));
+    }
+    for (; i < len; i++) {
+        row[i] += prev[i];
+    }
+}
+
+/* Filtering only reads raw bytes, so every type runs 16 bytes at a time
+ * for any pixel size once the first pixel is past */
+static void filter_sse2(uint8_t type, const uint8_t *row, const uint8_t *prev, uint8_t *out,
+                        size_t len, size_t bpp)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t start = bpp < len ? bpp : len;
+    filter_scalar(type, row, prev, out, 0, start, bpp);
+    size_t i = start;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i a = _mm_loadu_si128((const __m128i *)(row + i - bpp));
+        __m128i b = prev ? _mm_loadu_si128((const __m128i *)(prev + i)) : zero;
+        __m128i c = prev ? _mm_loadu_si128((const __m128i *)(prev + i - bpp)) : zero;
+        __m128i pred;
+        switch (type) {
+            case PNG_FILTER_SUB:   pred = a; break;
+            case PNG_FILTER_UP:    pred = b; break;
+            case PNG_FILTER_AVG:   pred = avg_floor_epu8(a, b); break;
+            case PNG_FILTER_PAETH: {
+                __m128i lo = paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                         _mm_unpacklo_epi8(c, zero));
+                __m128i hi = paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                         _mm_unpackhi_epi8(c, zero));
+                pred = _mm_packus_epi16(lo, hi);
+                break;
+            }
+            default:               pred = zero; break;
+        }
+        _mm_storeu_si128((__m128i *)(out + i), _mm_sub_epi8(x, pred));
+    }
+    filter_scalar(type, row, prev, out, i, len, bpp);
+}
+#endif
+
+int png_unfilter_row(uint8_t type, uint8_t *row, const uint8_t *prev, size_t len, size_t bpp)
+{
+    if (type > PNG_FILTER_PAETH || bpp == 0) {
+        return -1;
+    }
+    if (type == PNG_FILTER_NONE || (type == PNG_FILTER_UP && prev == NULL)) {
+        return 0;
+    }
+#ifdef __SSE2__
+    if (type == PNG_FILTER_UP) {
+        unfilter_up_sse2(row, prev, len);
+        return 0;
+    }
+    /* Whole pixels only; a row of 8-bit or 16-bit samples always is. For 3
+     * and 6 byte pixels each wide store overlaps the next load, and only
+     * Paeth has enough arithmetic to hide the stall; Sub and Average are
+     * faster scalar there. */
+    switch (len % bpp == 0 ? bpp : 0) {
+        case 3:
+            if (type == PNG_FILTER_PAETH) {
+                unfilter_sse2(type, row, prev, len, 3);
+                return 0;
+            }
+            break;
+        case 4: unfilter_sse2(type, row, prev, len, 4); return 0;
+        case 6:
+            if (type == PNG_FILTER_PAETH) {
+                unfilter_sse2(type, row, prev, len, 6);
+                return 0;
+            }
+            break;
+        case 8: unfilter_sse2(type, row, prev, len, 8); return 0;
+    }
+#endif
+    unfilter_scalar(type, row, prev, 0, len, bpp);
+    return 0;
+}
+
+int png_filter_row(uint8_t type, const uint8_t *row, const uint8_t *prev, uint8_t *out, size_t len, size_t bpp)
+{
+    if (type > PNG_FILTER_PAETH || bpp == 0) {
+        return -1;
+    }
+#ifdef __SSE2__
+    filter_sse2(type, row, prev, out, len, bpp);
+#else
+    filter_scalar(type, row, prev, out, 0, len, bpp);
+#endif
+    return 0;
+}
+
+int png_unfilter_image(uint8_t *data, uint32_t height, size_t row_bytes, size_t bpp)
+{
+    if (data == NULL) {
+        return -1;
+    }
+    size_t stride = 1 + row_bytes;
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t *line = data + (size_t)y * stride;
+        const uint8_t *prev = y > 0 ? line - stride + 1 : NULL;
+        if (png_unfilter_row(line[0], line + 1, prev, row_bytes, bpp) != 0) {
+            return -1;
+        }
+        line[0] = PNG_FILTER_NONE;
+    }
+    return 0;
+}
+
+/* Sum of the bytes of a filtered scanline read as signed magnitudes, the
+ * filter selection heuristic of PNG 1.2 section 12.8 */
+static uint64_t row_cost(const uint8_t *row, size_t len)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(row + i));
+        /* |x| of a signed byte is min(x, -x) read as unsigned */
+        __m128i mag = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(mag, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < len; i++) {
+        sum += row[i] < 128 ? row[i] : 256 - row[i];
+    }
+    return sum;
+}
+
+/* Scanlines [first, last) of an image, filtered by one thread */
+typedef struct {
+    const uint8_t *raw;
+    uint8_t       *out;
+    size_t         row_bytes;
+    size_t         bpp;
+    int            filter;
+    uint32_t       first;
+    uint32_t       last;
+    uint8_t       *scratch;     /* Two scanlines, for PNG_FILTER_ADAPTIVE */
+} filter_band_t;
+
+/* Bands shorter than this are not worth a thread of their own */
+#define MIN_BAND_ROWS 32
+
+static void filter_band(const filter_band_t *band)
+{
+    size_t len = band->row_bytes;
+    size_t stride = 1 + len;
+    for (uint32_t y = band->first; y < band->last; y++) {
+        const uint8_t *row = band->raw + (size_t)y * stride + 1;
+        const uint8_t *prev = y > 0 ? row - stride : NULL;
+        uint8_t *line = band->out + (size_t)y * stride;
+        if (band->filter != PNG_FILTER_ADAPTIVE) {
+            line[0] = (uint8_t)band->filter;
+            png_filter_row(line[0], row, prev, line + 1, len, band->bpp);
+            continue;
+        }
+        /* The cheapest output so far stays put while the next filter is
+         * tried in the other scratch scanline */
+        const uint8_t *best = row;
+        uint64_t best_cost = row_cost(row, len);
+        uint8_t best_type = PNG_FILTER_NONE;
+        uint8_t *trial = band->scratch;
+        for (uint8_t type = PNG_FILTER_SUB; type <= PNG_FILTER_PAETH; type++) {
+            png_filter_row(type, row, prev, trial, len, band->bpp);
+            uint64_t cost = row_cost(trial, len);
+            if (cost < best_cost) {
+                best = trial;
+                best_cost = cost;
+                best_type = type;
+                trial = trial == band->scratch ? band->scratch + len : band->scratch;
+            }
+        }
+        line[0] = best_type;
+        memcpy(line + 1, best, len);
+    }
+}
+
+static void *filter_worker(void *arg)
+{
+    filter_band(arg);
+    return NULL;
+}
+
+int png_filter_image(const uint8_t *raw, uint8_t *out, uint32_t height, size_t row_bytes,
+                     size_t bpp, int filter, int threads)
+{
+    if (raw == NULL || out == NULL || bpp == 0 || filter < PNG_FILTER_NONE || filter > PNG_FILTER_ADAPTIVE) {
+        return -1;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    uint32_t max_bands = height / MIN_BAND_ROWS > 0 ? height / MIN_BAND_ROWS : 1;
+    uint32_t nbands = (uint32_t)threads < max_bands ? (uint32_t)threads : max_bands;
+    size_t scratch = filter == PNG_FILTER_ADAPTIVE ? 2 * row_bytes : 0;
+
+    filter_band_t *bands = calloc(nbands, sizeof(filter_band_t));
+    uint8_t *scratch_buf = malloc(nbands * scratch + 1);
+    pthread_t *tids = calloc(nbands, sizeof(pthread_t));
+    int *started = calloc(nbands, sizeof(int));
+    if (bands == NULL || scratch_buf == NULL || tids == NULL || started == NULL) {
+        free(bands);
+        free(scratch_buf);
+        free(tids);
+        free(started);
+        return -1;
+    }
+    for (uint32_t i = 0; i < nbands; i++) {
+        bands[i] = (filter_band_t){ raw, out, row_bytes, bpp, filter,
+                                    (uint32_t)((uint64_t)height * i / nbands),
+                                    (uint32_t)((uint64_t)height * (i + 1) / nbands),
+                                    scratch_buf + i * scratch };
+    }
+    /* The calling thread takes the first band; a band whose thread cannot
+     * be started is filtered here too */
+    for (uint32_t i = 1; i < nbands; i++) {
+        started[i] = pthread_create(&tids[i], NULL, filter_worker, &bands[i]) == 0;
+    }
+    for (uint32_t i = 0; i < nbands; i++) {
+        if (!started[i]) {
+            filter_band(&bands[i]);
+        }
+    }
+    for (uint32_t i = 1; i < nbands; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+    free(bands);
+    free(scratch_buf);
+    free(tids);
+    free(started);
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include "png_idat.h"
+#include "png_reader.h"
+#include "debug.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Adam7 pass origins and spacing: x0, y0, dx, dy */
+static const uint8_t adam7[7][4] = {
+    { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 },
+    { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 }
+};
+
+/* Bytes in one scanline of a pass width pixels wide, without the filter byte */
+size_t png_row_bytes(const png_ihdr_t *ihdr, uint32_t width)
+{
+    int channels;
+    switch (ihdr->color_type) {
+        case 0: channels = 1; break;
+        case 2: channels = 3; break;
+        case 3: channels = 1; break;
+        case 4: channels = 2; break;
+        case 6: channels = 4; break;
+        default: return 0;
+    }
+    uint8_t depth = ihdr->bit_depth;
+    int depth_ok = (ihdr->color_type == 0 && (depth == 1 || depth == 2 || depth == 4)) ||
+                   (ihdr->color_type == 3 && (depth == 1 || depth == 2 || depth == 4 || depth == 8)) ||
+                   (ihdr->color_type != 3 && (depth == 8 || depth == 16));
+    if (!depth_ok) {
+        return 0;
+    }
+    return ((uint64_t)width * channels * depth + 7) / 8;
+}
+
+/* Size of the decoded (still filtered) image data, all Adam7 passes included */
+size_t png_image_size(const png_ihdr_t *ihdr)
+{
+    if (png_row_bytes(ihdr, 1) == 0) {
+        return 0;
+    }
+    uint64_t size = 0;
+    if (ihdr->interlace == 0) {
+        size = (uint64_t)ihdr->height * (1 + png_row_bytes(ihdr, ihdr->width));
+    } else {
+        for (int p = 0; p < 7; p++) {
+            if (ihdr->width <= adam7[p][0] || ihdr->height <= adam7[p][1]) {
+                continue;   /* Empty passes have no scanlines, not even filter bytes */
+            }
+            uint32_t w = (ihdr->width - adam7[p][0] + adam7[p][2] - 1) / adam7[p][2];
+            uint32_t h = (ihdr->height - adam7[p][1] + adam7[p][3] - 1) / adam7[p][3];
+            size += (uint64_t)h * (1 + png_row_bytes(ihdr, w));
+        }
+    }
+    return size > SIZE_MAX ? 0 : (size_t)size;
+}
+
+int png_idat_init(png_idat_decoder_t *dec, const png_ihdr_t *ihdr)
+{
+    if (dec == NULL || ihdr == NULL) {
+        return -1;
+    }
+    memset(dec, 0, sizeof(*dec));
+    dec->out_size = png_image_size(ihdr);
+    if (dec->out_size == 0) {
+        return -1;
+    }
+    dec->stride = ihdr->interlace == 0 ? 1 + png_row_bytes(ihdr, ihdr->width) : 0;
+    dec->out = malloc(dec->out_size);
+    if (dec->out == NULL) {
+        return -1;
+    }
+    if (inflateInit(&dec->strm) != Z_OK) {
+        free(dec->out);
+        dec->out = NULL;
+        return -1;
+    }
+    dec->strm.next_out = dec->out;
+    dec->strm.avail_out = 0;
+    return 0;
+}
+
+int png_idat_feed(png_idat_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    if (dec == NULL || dec->out == NULL || (data == NULL && len > 0)) {
+        return -1;
+    }
+    if (dec->finished) {
+        /* Nothing may follow the end of the stream but empty chunks */
+        return len == 0 ? 0 : -1;
+    }
+    dec->strm.next_in = (uint8_t *)data;
+    dec->strm.next_out = dec->out + dec->out_len;
+    while (len > 0 || dec->strm.avail_in > 0) {
+        /* avail_in and avail_out are 32-bit, so hand over at most 1 GB at a time */
+        if (dec->strm.avail_in == 0) {
+            uInt n = len > (1u << 30) ? (1u << 30) : (uInt)len;
+            dec->strm.avail_in = n;
+            len -= n;
+        }
+        size_t room = dec->out_size - dec->out_len;
+        dec->strm.avail_out = room > (1u << 30) ? (1u << 30) : (uInt)room;
+        uInt before = dec->strm.avail_out;
+        int ret = inflate(&dec->strm, Z_NO_FLUSH);
+        dec->out_len += before - dec->strm.avail_out;
+        if (ret == Z_STREAM_END) {
+            dec->finished = 1;
+            if (dec->strm.avail_in > 0 || len > 0) {
+                debug("data after the end of the zlib stream");
+                return -1;
+            }
+            break;
+        }
+        if (ret != Z_OK) {
+            /* Z_BUF_ERROR here means the image is full but the stream goes on */
+            debug("inflate failed: %d", ret);
+            return -1;
+        }
+    }
+    if (dec->stride > 0) {
+        dec->rows_ready = (uint32_t)(dec->out_len / dec->stride);
+    }
+    return 0;
+}
+
+int png_idat_finish(png_idat_decoder_t *dec)
+{
+    if (dec == NULL || !dec->finished || dec->out_len != dec->out_size) {
+        return -1;
+    }
+    return 0;
+}
+
+void png_idat_free(png_idat_decoder_t *dec)
+{
+    if (dec == NULL) {
+        return;
+    }
+    inflateEnd(&dec->strm);
+    free(dec->out);
+    dec->out = NULL;
+}
+
+/* Decodes the IDAT chunks of a mapped PNG straight from the map */
+int png_map_idat(const png_map_t *map, png_ihdr_t *ihdr, uint8_t **out_data, size_t *out_size)
+{
+    if (map == NULL || ihdr == NULL || out_data == NULL || out_size == NULL) {
+        return -1;
+    }
+    png_idat_decoder_t dec;
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int have_ihdr = 0, ret;
+    png_chunk_iter_init(&it, map);
+    while ((ret = png_chunk_next(&it, &view)) == 1) {
+        int is_idat = strcmp(view.type, "IDAT") == 0;
+        if (have_ihdr && !is_idat) {
+            continue;
+        }
+        /* Only the chunks that are used get their CRC checked */
+        const uint8_t *data = png_chunk_data(&view);
+        if (data == NULL) {
+            ret = -1;
+            break;
+        }
+        if (!have_ihdr) {
+            png_chunk_t chunk = { view.length, "", (uint8_t *)data, view.crc };
+            memcpy(chunk.type, view.type, sizeof(chunk.type));
+            if (png_parse_ihdr(&chunk, ihdr) != 0 || png_idat_init(&dec, ihdr) != 0) {
+                ret = -1;
+                break;
+            }
+            have_ihdr = 1;
+        } else if (png_idat_feed(&dec, data, view.length) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0 && png_idat_finish(&dec) == 0) {
+        *out_data = dec.out;
+        *out_size = dec.out_len;
+        dec.out = NULL;
+    } else {
+        ret = -1;
+    }
+    if (have_ihdr) {
+        png_idat_free(&dec);
+    }
+    return ret;
+}
+
+/* Maps a PNG and decodes its IDAT chunks in place */
+int png_read_idat(const char *path, png_ihdr_t *ihdr, uint8_t **out_data, size_t *out_size)
+{
+    png_map_t map;
+    if (path == NULL || png_map(path, &map) != 0) {
+        return -1;
+    }
+    int ret = png_map_idat(&map, ihdr, out_data, out_size);
+    png_unmap(&map);
+    return ret;
+}
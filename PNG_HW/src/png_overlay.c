@@ -2,15 +2,235 @@
 #include "png_reader.h"
 #include "png_chunks.h"
 #include "png_crc.h"
+#include "png_idat.h"
+#include "png_filter.h"
+#include "png_writer.h"
 #include "util.h"
 #include "debug.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* One input image, mapped and decoded to raw scanlines */
+typedef struct {
+    png_map_t     map;
+    png_ihdr_t    ihdr;
+    uint8_t      *data;         /* Scanlines with filter bytes, unfiltered */
+    size_t        size;
+    size_t        row_bytes;
+    png_color_t   plte[256];
+    size_t        plte_count;
+} overlay_src_t;
+
+static void free_source(overlay_src_t *src)
+{
+    free(src->data);
+    src->data = NULL;
+    png_unmap(&src->map);
+}
+
+/* Copies PLTE out of the map, if there is one before the first IDAT */
+static int read_palette(overlay_src_t *src)
+{
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    png_chunk_iter_init(&it, &src->map);
+    while (png_chunk_next(&it, &view) == 1) {
+        if (strcmp(view.type, "IDAT") == 0) {
+            break;
+        }
+        if (strcmp(view.type, "PLTE") == 0) {
+            const uint8_t *data = png_chunk_data(&view);
+            png_color_t *colors = NULL;
+            png_chunk_t chunk = { view.length, "PLTE", (uint8_t *)data, view.crc };
+            if (data == NULL || png_parse_plte(&chunk, &colors, &src->plte_count) != 0) {
+                return -1;
+            }
+            memcpy(src->plte, colors, src->plte_count * sizeof(png_color_t));
+            free(colors);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int load_source(const char *path, overlay_src_t *src)
+{
+    if (png_map(path, &src->map) != 0) {
+        return -1;
+    }
+    if (png_map_idat(&src->map, &src->ihdr, &src->data, &src->size) != 0) {
+        return -1;
+    }
+    if (src->ihdr.bit_depth != 8 || src->ihdr.interlace != 0) {
+        debug("%s: only 8-bit, non-interlaced images can be overlaid", path);
+        return -1;
+    }
+    src->row_bytes = png_row_bytes(&src->ihdr, src->ihdr.width);
+    if (src->ihdr.color_type == 3 && read_palette(src) != 0) {
+        return -1;
+    }
+    return png_unfilter_image(src->data, src->ihdr.height, src->row_bytes, png_filter_bpp(&src->ihdr));
+}
+
+/* Adds the small image's colors that the large palette lacks and points
+ * the small image's indices at the merged entries */
+static int merge_palettes(overlay_src_t *large, overlay_src_t *small)
+{
+    uint8_t index_map[256] = {0};
+    for (size_t i = 0; i < small->plte_count; i++) {
+        png_color_t c = small->plte[i];
+        size_t j = 0;
+        while (j < large->plte_count &&
+               (large->plte[j].r != c.r || large->plte[j].g != c.g || large->plte[j].b != c.b)) {
+            j++;
+        }
+        if (j == large->plte_count) {
+            if (large->plte_count == 256) {
+                debug("merged palette needs more than 256 colors");
+                return -1;
+            }
+            large->plte[large->plte_count++] = c;
+        }
+        index_map[i] = (uint8_t)j;
+    }
+    for (uint32_t y = 0; y < small->ihdr.height; y++) {
+        uint8_t *row = small->data + (size_t)y * (1 + small->row_bytes) + 1;
+        for (size_t x = 0; x < small->row_bytes; x++) {
+            row[x] = index_map[row[x]];
+        }
+    }
+    return 0;
+}
+
+/* Ancillary chunks before (after_idat = 0) or after (1) the image data */
+static int write_ancillary(FILE *out, const png_map_t *map, int after_idat)
+{
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int seen_idat = 0;
+    png_chunk_iter_init(&it, map);
+    while (png_chunk_next(&it, &view) == 1) {
+        if (strcmp(view.type, "IDAT") == 0) {
+            seen_idat = 1;
+            continue;
+        }
+        /* A lowercase first letter marks an ancillary chunk */
+        if (view.type[0] >= 'a' && view.type[0] <= 'z' && seen_idat == after_idat &&
+            png_write_chunk(out, view.type, view.data, view.length) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int write_output(const char *output_path, overlay_src_t *large, overlay_src_t *small,
+                        const png_write_opts_t *opts)
+{
+    /* The pasted scanlines are raw, which is already filter type None */
+    const uint8_t *image = large->data;
+    uint8_t *filtered = NULL;
+    int filter = png_filter_for(&large->ihdr, opts->filter);
+    if (filter != PNG_FILTER_NONE) {
+        filtered = malloc(large->size);
+        if (filtered == NULL ||
+            png_filter_image(large->data, filtered, large->ihdr.height, large->row_bytes,
+                             png_filter_bpp(&large->ihdr), filter, opts->threads) != 0) {
+            free(filtered);
+            return -1;
+        }
+        image = filtered;
+    }
+    FILE *out = fopen(output_path, "wb");
+    if (out == NULL) {
+        free(filtered);
+        return -1;
+    }
+
+    /* IHDR is the first chunk of the map, right after the signature */
+    int ret = png_write_signature(out) != 0 ||
+              png_write_chunk(out, "IHDR", large->map.data + 16, 13) != 0;
+    if (ret == 0 && large->ihdr.color_type == 3) {
+        uint8_t plte[256 * 3];
+        for (size_t i = 0; i < large->plte_count; i++) {
+            plte[3 * i] = large->plte[i].r;
+            plte[3 * i + 1] = large->plte[i].g;
+            plte[3 * i + 2] = large->plte[i].b;
+        }
+        ret = png_write_chunk(out, "PLTE", plte, (uint32_t)(large->plte_count * 3));
+    }
+    ret = ret || write_ancillary(out, &large->map, 0) || write_ancillary(out, &small->map, 0) ||
+          png_write_image_data(out, image, large->size, 1 + large->row_bytes, opts) ||
+          write_ancillary(out, &large->map, 1) || write_ancillary(out, &small->map, 1) ||
+          png_write_chunk(out, "IEND", NULL, 0);
+    free(filtered);
+    if (fclose(out) != 0) {
+        ret = 1;
+    }
+    /* Leave no truncated image behind */
+    if (ret) {
+        remove(output_path);
+    }
+    return ret ? -1 : 0;
+}
+
 int png_overlay_paste(const char *large_path, const char *small_path,
                       const char *output_path, uint32_t x_offset, uint32_t y_offset)
 {
-  
-    return 0;
+    return png_overlay_paste_opts(large_path, small_path, output_path, x_offset, y_offset, NULL);
+}
+
+int png_overlay_paste_opts(const char *large_path, const char *small_path, const char *output_path,
+                           uint32_t x_offset, uint32_t y_offset, const png_write_opts_t *opts)
+{
+    static const png_write_opts_t defaults = PNG_WRITE_OPTS_DEFAULT;
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+    if (large_path == NULL || small_path == NULL || output_path == NULL) {
+        return -1;
+    }
+    if (!util_deflate_opts_valid(&opts->zlib)) {
+        debug("invalid zlib level, strategy or memLevel");
+        return -1;
+    }
+    overlay_src_t large, small;
+    int ret = -1;
+    memset(&large, 0, sizeof(large));
+    memset(&small, 0, sizeof(small));
+    if (load_source(large_path, &large) != 0 || load_source(small_path, &small) != 0) {
+        goto done;
+    }
+    if (large.ihdr.color_type != small.ihdr.color_type ||
+        png_filter_bpp(&large.ihdr) != png_filter_bpp(&small.ihdr)) {
+        debug("images differ in color type");
+        goto done;
+    }
+    if (large.ihdr.color_type == 3 && merge_palettes(&large, &small) != 0) {
+        goto done;
+    }
+
+    /* Clip the pasted region to the large image */
+    size_t bpp = png_filter_bpp(&large.ihdr);
+    if (x_offset < large.ihdr.width && y_offset < large.ihdr.height) {
+        uint32_t w = small.ihdr.width;
+        uint32_t h = small.ihdr.height;
+        if (w > large.ihdr.width - x_offset) {
+            w = large.ihdr.width - x_offset;
+        }
+        if (h > large.ihdr.height - y_offset) {
+            h = large.ihdr.height - y_offset;
+        }
+        for (uint32_t y = 0; y < h; y++) {
+            uint8_t *dst = large.data + (size_t)(y_offset + y) * (1 + large.row_bytes) + 1 + (size_t)x_offset * bpp;
+            const uint8_t *src = small.data + (size_t)y * (1 + small.row_bytes) + 1;
+            memcpy(dst, src, (size_t)w * bpp);
+        }
+    }
+    ret = write_output(output_path, &large, &small, opts);
+
+done:
+    free_source(&large);
+    free_source(&small);
+    return ret;
 }
@@ -2,38 +2,378 @@
 #include "png_crc.h"
 #include "util.h"
 #include "global.h"
+#include "debug.h"
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PNG_SIG_LEN 8
+/* Chunk lengths are limited to 2^31 - 1 by the specification */
+#define PNG_MAX_CHUNK_LEN 0x7FFFFFFFUL
+
+static const uint8_t png_signature[PNG_SIG_LEN] = {
+    0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A
+};
 
 /* Opens a PNG file and validates signature */
 FILE *png_open(const char *path)
 {
-    return NULL;
+    if (path == NULL) {
+        return NULL;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    uint8_t sig[PNG_SIG_LEN];
+    if (read_exact(fp, sig, PNG_SIG_LEN) != 0 || memcmp(sig, png_signature, PNG_SIG_LEN) != 0) {
+        debug("%s is not a PNG file", path);
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/* Reads a chunk's length and type; head holds them as stored in the file */
+static int read_chunk_header(FILE *fp, uint8_t head[8], uint32_t *length)
+{
+    if (read_exact(fp, head, 8) != 0) {
+        return -1;
+    }
+    *length = read_u32_be(head);
+    if (*length > PNG_MAX_CHUNK_LEN) {
+        debug("chunk length %u out of range", *length);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads the data and CRC that follow a chunk header and validates the CRC */
+static int read_chunk_body(FILE *fp, const uint8_t head[8], uint32_t length, uint8_t *data, uint32_t *out_crc)
+{
+    uint8_t crc_buf[4];
+    if (read_exact(fp, data, length) != 0 || read_exact(fp, crc_buf, sizeof(crc_buf)) != 0) {
+        return -1;
+    }
+    uint32_t crc = png_crc_update(0xFFFFFFFFUL, head + 4, 4);
+    crc = png_crc_update(crc, data, length) ^ 0xFFFFFFFFUL;
+    if (crc != read_u32_be(crc_buf)) {
+        debug("CRC mismatch in %.4s chunk", (const char *)head + 4);
+        return -1;
+    }
+    *out_crc = crc;
+    return 0;
+}
+
+/* Moves past a chunk's data and CRC without reading them */
+static int skip_chunk_body(FILE *fp, uint32_t length)
+{
+    if (fseek(fp, (long)length + 4, SEEK_CUR) == 0) {
+        return 0;
+    }
+    /* Not seekable (e.g. a pipe), so the bytes have to be read after all */
+    uint8_t discard[4096];
+    size_t left = (size_t)length + 4;
+    while (left > 0) {
+        size_t n = left < sizeof(discard) ? left : sizeof(discard);
+        if (read_exact(fp, discard, n) != 0) {
+            return -1;
+        }
+        left -= n;
+    }
+    return 0;
 }
 
 /* Reads the next chunk from the file */
 int png_read_chunk(FILE *fp, png_chunk_t *out)
 {
+    if (fp == NULL || out == NULL) {
+        return -1;
+    }
+    uint8_t head[8];
+    uint32_t length;
+    if (read_chunk_header(fp, head, &length) != 0) {
+        return -1;
+    }
+    uint8_t *data = malloc(length ? length : 1);
+    if (data == NULL) {
+        return -1;
+    }
+    if (read_chunk_body(fp, head, length, data, &out->crc) != 0) {
+        free(data);
+        return -1;
+    }
+    out->length = length;
+    memcpy(out->type, head + 4, 4);
+    out->type[4] = '\0';
+    out->data = data;
     return 0;
 }
 
 /* Frees memory allocated inside png_chunk_t */
 void png_free_chunk(png_chunk_t *chunk)
 {
-	
+    if (chunk == NULL) {
+        return;
+    }
+    free(chunk->data);
+    chunk->data = NULL;
 }
 
+/* IHDR is always the first chunk and only 13 bytes, so it is read onto the stack */
 int png_extract_ihdr(FILE *fp, png_ihdr_t *out)
 {
-    return 0;
+    if (fp == NULL || out == NULL) {
+        return -1;
+    }
+    uint8_t head[8], data[13];
+    png_chunk_t chunk;
+    if (read_chunk_header(fp, head, &chunk.length) != 0) {
+        return -1;
+    }
+    if (memcmp(head + 4, "IHDR", 4) != 0 || chunk.length != sizeof(data)) {
+        return -1;
+    }
+    if (read_chunk_body(fp, head, chunk.length, data, &chunk.crc) != 0) {
+        return -1;
+    }
+    memcpy(chunk.type, "IHDR", 5);
+    chunk.data = data;
+    return png_parse_ihdr(&chunk, out);
 }
 
+/* Only the PLTE payload is read; other chunks are seeked over. PLTE must
+ * come before the first IDAT, so the search stops there. */
 int png_extract_plte(FILE *fp, png_color_t **out_colors, size_t *out_count)
 {
+    if (fp == NULL || out_colors == NULL || out_count == NULL) {
+        return -1;
+    }
+    uint8_t head[8];
+    uint32_t length;
+    while (read_chunk_header(fp, head, &length) == 0) {
+        if (memcmp(head + 4, "PLTE", 4) == 0) {
+            /* At most 256 colors; anything longer is rejected unread */
+            uint8_t data[256 * 3];
+            png_chunk_t chunk;
+            if (length > sizeof(data) || read_chunk_body(fp, head, length, data, &chunk.crc) != 0) {
+                return -1;
+            }
+            chunk.length = length;
+            memcpy(chunk.type, "PLTE", 5);
+            chunk.data = data;
+            return png_parse_plte(&chunk, out_colors, out_count);
+        }
+        if (memcmp(head + 4, "IDAT", 4) == 0 || memcmp(head + 4, "IEND", 4) == 0) {
+            break;
+        }
+        if (skip_chunk_body(fp, length) != 0) {
+            break;
+        }
+    }
+    return -1;
+}
+
+/* Reads a file that cannot be mapped (e.g. a pipe) into memory */
+static int read_whole(int fd, png_map_t *out)
+{
+    size_t cap = 1 << 16, size = 0;
+    uint8_t *buf = malloc(cap);
+    if (buf == NULL) {
+        return -1;
+    }
+    for (;;) {
+        if (size == cap) {
+            uint8_t *tmp = realloc(buf, cap * 2);
+            if (tmp == NULL) {
+                free(buf);
+                return -1;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + size, cap - size);
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += (size_t)n;
+    }
+    out->data = buf;
+    out->size = size;
+    out->mapped = 0;
+    return 0;
+}
+
+/* Maps a PNG file and validates signature */
+int png_map(const char *path, png_map_t *out)
+{
+    if (path == NULL || out == NULL) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    int ret = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            out->data = p;
+            out->size = (size_t)st.st_size;
+            out->mapped = 1;
+            ret = 0;
+        }
+    }
+    if (ret != 0) {
+        ret = read_whole(fd, out);
+    }
+    close(fd);
+    if (ret != 0) {
+        return -1;
+    }
+
+    if (out->size < PNG_SIG_LEN || memcmp(out->data, png_signature, PNG_SIG_LEN) != 0) {
+        debug("%s is not a PNG file", path);
+        png_unmap(out);
+        return -1;
+    }
     return 0;
 }
 
+void png_unmap(png_map_t *map)
+{
+    if (map == NULL || map->data == NULL) {
+        return;
+    }
+    if (map->mapped) {
+        munmap((void *)map->data, map->size);
+    } else {
+        free((void *)map->data);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+/* Starts an iterator at the first chunk after the signature */
+void png_chunk_iter_init(png_chunk_iter_t *it, const png_map_t *map)
+{
+    it->map = map;
+    it->offset = PNG_SIG_LEN;
+    it->done = 0;
+}
+
+/* Returns the next chunk as a view into the map, without allocating */
+int png_chunk_next(png_chunk_iter_t *it, png_chunk_view_t *out)
+{
+    if (it == NULL || out == NULL || it->map == NULL) {
+        return -1;
+    }
+    if (it->done) {
+        return 0;
+    }
+    const uint8_t *base = it->map->data;
+    size_t left = it->map->size - it->offset;
+    /* Length, type and CRC must fit before the data length is even looked at */
+    if (left < 12) {
+        debug("truncated chunk at offset %zu", it->offset);
+        return -1;
+    }
+    uint32_t length = read_u32_be(base + it->offset);
+    if (length > PNG_MAX_CHUNK_LEN || length > left - 12) {
+        debug("chunk length %u out of range at offset %zu", length, it->offset);
+        return -1;
+    }
+
+    out->length = length;
+    memcpy(out->type, base + it->offset + 4, 4);
+    out->type[4] = '\0';
+    out->data = base + it->offset + 8;
+    out->crc = read_u32_be(out->data + length);
+    it->offset += 12 + (size_t)length;
+    it->done = strcmp(out->type, "IEND") == 0;
+    return 1;
+}
+
+/* Returns 1 if the stored CRC matches the chunk's type and data, 0 otherwise */
+int png_chunk_crc_ok(const png_chunk_view_t *chunk)
+{
+    /* The type sits right before the data, so both are one contiguous run */
+    return png_crc(chunk->data - 4, (size_t)chunk->length + 4) == chunk->crc;
+}
+
+/* Returns the chunk data once its CRC has been checked, NULL on a mismatch */
+const uint8_t *png_chunk_data(const png_chunk_view_t *chunk)
+{
+    if (chunk == NULL || !png_chunk_crc_ok(chunk)) {
+        return NULL;
+    }
+    return chunk->data;
+}
+
 int png_summary(const char *filename, png_chunk_t **out_summary)
 {
+    return png_summary_crc(filename, out_summary, PNG_CRC_CHECK);
+}
+
+int png_summary_crc(const char *filename, png_chunk_t **out_summary, int crc_mode)
+{
+    if (filename == NULL || out_summary == NULL) {
+        return -1;
+    }
+    png_map_t map;
+    if (png_map(filename, &map) != 0) {
+        return -1;
+    }
+    /* Only the chunk headers are touched, so do not read ahead through the data */
+    if (crc_mode == PNG_CRC_SKIP && map.mapped) {
+        madvise((void *)map.data, map.size, MADV_RANDOM);
+    }
+
+    size_t count = 0, cap = 16;
+    png_chunk_t *summary = malloc(cap * sizeof(png_chunk_t));
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int ret = summary ? 1 : -1;
+    png_chunk_iter_init(&it, &map);
+    while (ret == 1 && (ret = png_chunk_next(&it, &view)) == 1) {
+        /* One slot is always kept free for the zeroed terminator */
+        if (count + 1 == cap) {
+            png_chunk_t *tmp = realloc(summary, cap * 2 * sizeof(png_chunk_t));
+            if (tmp == NULL) {
+                ret = -1;
+                break;
+            }
+            summary = tmp;
+            cap *= 2;
+        }
+        png_chunk_t *entry = &summary[count++];
+        entry->length = view.length;
+        memcpy(entry->type, view.type, sizeof(entry->type));
+        entry->data = NULL;
+        /* The summary stores whether the CRC is valid, not the CRC itself */
+        if (crc_mode == PNG_CRC_SKIP) {
+            entry->crc = PNG_CRC_UNCHECKED;
+        } else {
+            entry->crc = png_chunk_crc_ok(&view) ? PNG_CRC_VALID : PNG_CRC_INVALID;
+        }
+    }
+    png_unmap(&map);
+
+    /* The iterator only ends cleanly after IEND */
+    if (ret != 0) {
+        free(summary);
+        return -1;
+    }
+    memset(&summary[count], 0, sizeof(png_chunk_t));
+    *out_summary = summary;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,20 +1,207 @@
+
 #include "png_steg.h"
 #include "png_reader.h"
 #include "png_chunks.h"
 #include "png_crc.h"
+#include "png_idat.h"
+#include "png_filter.h"
+#include "png_writer.h"
 #include "util.h"
+#include "debug.h"
 #include <stdlib.h>
 #include <string.h>
 
+/* One PNG, mapped and decoded, and where its message bits go. Truecolor
+ * and grayscale images carry one bit in the LSB of the first byte of each
+ * pixel, as stored (filtered). Palette images carry it in the index: the
+ * palette is stored twice, and an index into the second copy is a 1. */
+typedef struct {
+    png_map_t      map;
+    png_ihdr_t     ihdr;
+    uint8_t       *data;        /* Decoded scanlines, each led by its filter type byte */
+    size_t         size;
+    size_t         stride;      /* 1 + bytes per scanline */
+    size_t         bpp;         /* Bytes from one carrier byte to the next */
+    size_t         slots;       /* Carrier bytes per scanline */
+    const uint8_t *plte;        /* PLTE payload in the map, palette images only */
+    size_t         plte_count;
+} steg_image_t;
+
+static void free_image(steg_image_t *img)
+{
+    free(img->data);
+    img->data = NULL;
+    png_unmap(&img->map);
+}
+
+static int load_image(const char *path, steg_image_t *img)
+{
+    if (png_map(path, &img->map) != 0 ||
+        png_map_idat(&img->map, &img->ihdr, &img->data, &img->size) != 0) {
+        return -1;
+    }
+    if (img->ihdr.interlace != 0) {
+        debug("%s: interlaced images cannot carry a message", path);
+        return -1;
+    }
+    size_t row_bytes = png_row_bytes(&img->ihdr, img->ihdr.width);
+    img->stride = 1 + row_bytes;
+    img->bpp = png_filter_bpp(&img->ihdr);
+    img->slots = row_bytes / img->bpp;
+    if (img->ihdr.color_type != 3) {
+        return 0;
+    }
+
+    /* Indices are only comparable once the scanlines are unfiltered */
+    if (img->ihdr.bit_depth != 8) {
+        debug("%s: only 8-bit palette images can carry a message", path);
+        return -1;
+    }
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    png_chunk_iter_init(&it, &img->map);
+    while (png_chunk_next(&it, &view) == 1 && strcmp(view.type, "IDAT") != 0) {
+        if (strcmp(view.type, "PLTE") == 0) {
+            img->plte = png_chunk_data(&view);
+            img->plte_count = view.length / 3;
+            break;
+        }
+    }
+    if (img->plte == NULL || img->plte_count == 0) {
+        return -1;
+    }
+    return png_unfilter_image(img->data, img->ihdr.height, row_bytes, img->bpp);
+}
+
+/* Offset of the k-th carrier byte */
+static inline size_t carrier(const steg_image_t *img, size_t k)
+{
+    return (k / img->slots) * img->stride + 1 + (k % img->slots) * img->bpp;
+}
+
+/* Copies every chunk, with the palette doubled and the image data recompressed */
+static int write_image(const char *output_path, const steg_image_t *img, const png_write_opts_t *opts)
+{
+    FILE *out = fopen(output_path, "wb");
+    if (out == NULL) {
+        return -1;
+    }
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int ret = png_write_signature(out), next = 0, wrote_idat = 0;
+    png_chunk_iter_init(&it, &img->map);
+    while (ret == 0 && (next = png_chunk_next(&it, &view)) == 1) {
+        if (strcmp(view.type, "IDAT") == 0) {
+            if (!wrote_idat) {
+                ret = png_write_image_data(out, img->data, img->size, img->stride, opts);
+                wrote_idat = 1;
+            }
+        } else if (strcmp(view.type, "PLTE") == 0 && img->ihdr.color_type == 3) {
+            uint8_t plte[256 * 3];
+            memcpy(plte, img->plte, img->plte_count * 3);
+            memcpy(plte + img->plte_count * 3, img->plte, img->plte_count * 3);
+            ret = png_write_chunk(out, "PLTE", plte, (uint32_t)(img->plte_count * 6));
+        } else {
+            ret = png_write_chunk(out, view.type, view.data, view.length);
+        }
+    }
+    if (fclose(out) != 0 || next != 0) {
+        ret = -1;
+    }
+    /* Leave no truncated image behind */
+    if (ret != 0) {
+        remove(output_path);
+    }
+    return ret;
+}
+
 /* Encode secret string into LSBs of image data */
 int png_encode_lsb(const char *input_path, const char *output_path, const char *secret)
 {
-    return 0;
+    return png_encode_lsb_opts(input_path, output_path, secret, NULL);
+}
+
+int png_encode_lsb_opts(const char *input_path, const char *output_path, const char *secret,
+                        const png_write_opts_t *opts)
+{
+    static const png_write_opts_t defaults = PNG_WRITE_OPTS_DEFAULT;
+    if (input_path == NULL || output_path == NULL || secret == NULL) {
+        return -1;
+    }
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+    if (!util_deflate_opts_valid(&opts->zlib)) {
+        debug("invalid zlib level, strategy or memLevel");
+        return -1;
+    }
+    steg_image_t img;
+    memset(&img, 0, sizeof(img));
+    int ret = -1;
+    if (load_image(input_path, &img) != 0) {
+        goto done;
+    }
+
+    /* The terminating NUL is hidden too */
+    size_t bits = (strlen(secret) + 1) * 8;
+    if (bits > (size_t)img.ihdr.height * img.slots) {
+        debug("%s: image too small for a %zu byte message", input_path, strlen(secret));
+        goto done;
+    }
+    if (img.ihdr.color_type == 3 && img.plte_count > 128) {
+        debug("%s: palette has no room for a second copy", input_path);
+        goto done;
+    }
+    for (size_t k = 0; k < bits; k++) {
+        uint8_t bit = ((uint8_t)secret[k / 8] >> (k % 8)) & 1;
+        uint8_t *p = img.data + carrier(&img, k);
+        if (img.ihdr.color_type != 3) {
+            *p = (uint8_t)((*p & 0xFE) | bit);
+        } else if (*p < img.plte_count) {
+            *p = (uint8_t)(*p + bit * img.plte_count);
+        } else {
+            goto done;
+        }
+    }
+    ret = write_image(output_path, &img, opts);
+
+done:
+    free_image(&img);
+    return ret;
 }
 
 /* Extract secret string from LSBs of image data */
 int png_extract_lsb(const char *input_path, char *out, size_t max_len)
 {
-    return 0;
-}
+    if (input_path == NULL || out == NULL || max_len == 0) {
+        return -1;
+    }
+    steg_image_t img;
+    memset(&img, 0, sizeof(img));
+    int ret = -1;
+    if (load_image(input_path, &img) != 0) {
+        goto done;
+    }
 
+    size_t capacity = (size_t)img.ihdr.height * img.slots / 8;
+    size_t half = img.plte_count / 2;
+    for (size_t i = 0; i < capacity; i++) {
+        uint8_t c = 0;
+        for (size_t b = 0; b < 8; b++) {
+            uint8_t v = img.data[carrier(&img, i * 8 + b)];
+            uint8_t bit = img.ihdr.color_type == 3 ? v >= half : v & 1;
+            c |= (uint8_t)(bit << b);
+        }
+        /* A message longer than out is cut short */
+        if (c == '\0' || i + 1 == max_len) {
+            out[i] = '\0';
+            ret = (int)i;
+            break;
+        }
+        out[i] = (char)c;
+    }
+
+done:
+    free_image(&img);
+    return ret;
+}
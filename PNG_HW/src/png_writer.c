@@ -0,0 +1,138 @@
+#include "png_writer.h"
+#include "png_crc.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t png_signature[8] = {
+    0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A
+};
+
+static void write_u32_be(uint8_t *buf, uint32_t v)
+{
+    buf[0] = (uint8_t)(v >> 24);
+    buf[1] = (uint8_t)(v >> 16);
+    buf[2] = (uint8_t)(v >> 8);
+    buf[3] = (uint8_t)v;
+}
+
+/* Writes the 8-byte PNG signature */
+int png_write_signature(FILE *fp)
+{
+    return fwrite(png_signature, 1, sizeof(png_signature), fp) == sizeof(png_signature) ? 0 : -1;
+}
+
+/* Writes one chunk: length, type, data and the CRC over type and data */
+int png_write_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t length)
+{
+    uint8_t head[8], tail[4];
+    write_u32_be(head, length);
+    memcpy(head + 4, type, 4);
+    uint32_t crc = png_crc_update(0xFFFFFFFFUL, head + 4, 4);
+    crc = png_crc_update(crc, data, length) ^ 0xFFFFFFFFUL;
+    write_u32_be(tail, crc);
+
+    if (fwrite(head, 1, sizeof(head), fp) != sizeof(head) ||
+        (length > 0 && fwrite(data, 1, length, fp) != length) ||
+        fwrite(tail, 1, sizeof(tail), fp) != sizeof(tail)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* PNG chunk lengths may not exceed 2^31 - 1 */
+#define PNG_MAX_CHUNK 0x7FFFFFFFUL
+
+/* Writes an already compressed zlib stream as IDAT chunks */
+int png_write_idat(FILE *fp, const uint8_t *compressed, size_t size, size_t idat_size)
+{
+    if (idat_size == 0) {
+        idat_size = size;
+    }
+    if (idat_size > PNG_MAX_CHUNK) {
+        return -1;
+    }
+    size_t pos = 0;
+    do {
+        size_t n = size - pos < idat_size ? size - pos : idat_size;
+        if (png_write_chunk(fp, "IDAT", compressed + pos, (uint32_t)n) != 0) {
+            return -1;
+        }
+        pos += n;
+    } while (pos < size);
+    return 0;
+}
+
+/* Deflates filtered image data straight into fixed-size IDAT chunks */
+int png_write_idat_stream(FILE *fp, const uint8_t *data, size_t size, size_t idat_size,
+                          const util_deflate_opts_t *zlib)
+{
+    static const util_deflate_opts_t defaults = UTIL_DEFLATE_OPTS_DEFAULT;
+    if (zlib == NULL) {
+        zlib = &defaults;
+    }
+    if (fp == NULL || data == NULL || idat_size == 0 || idat_size > PNG_MAX_CHUNK) {
+        return -1;
+    }
+    uint8_t *buf = malloc(idat_size);
+    if (buf == NULL) {
+        return -1;
+    }
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, zlib->level, Z_DEFLATED, 15, zlib->mem_level, zlib->strategy) != Z_OK) {
+        free(buf);
+        return -1;
+    }
+
+    strm.next_in = (uint8_t *)data;
+    strm.next_out = buf;
+    strm.avail_out = (uInt)idat_size;
+    size_t in_left = size;
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        /* avail_in is 32-bit, so hand over at most 1 GB at a time */
+        if (strm.avail_in == 0 && in_left > 0) {
+            strm.avail_in = in_left > (1u << 30) ? (1u << 30) : (uInt)in_left;
+            in_left -= strm.avail_in;
+        }
+        ret = deflate(&strm, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            break;
+        }
+        /* A full buffer is one IDAT; the last one takes whatever is left */
+        size_t n = idat_size - strm.avail_out;
+        if ((strm.avail_out == 0 || ret == Z_STREAM_END) && n > 0) {
+            if (png_write_chunk(fp, "IDAT", buf, (uint32_t)n) != 0) {
+                ret = Z_ERRNO;
+                break;
+            }
+            strm.next_out = buf;
+            strm.avail_out = (uInt)idat_size;
+        }
+    }
+    deflateEnd(&strm);
+    free(buf);
+    return ret == Z_STREAM_END ? 0 : -1;
+}
+
+/* Compresses filtered image data and writes it as IDAT chunks */
+int png_write_image_data(FILE *fp, const uint8_t *data, size_t size, size_t stride,
+                         const png_write_opts_t *opts)
+{
+    /* One thread streams into fixed-size chunks without a full-size buffer */
+    if (opts->threads == 1 && opts->idat_size > 0) {
+        return png_write_idat_stream(fp, data, size, opts->idat_size, &opts->zlib);
+    }
+    uint8_t *compressed = NULL;
+    size_t compressed_size = 0;
+    int ret = opts->threads == 1
+              ? util_deflate_data_png_opts(data, size, &compressed, &compressed_size, &opts->zlib)
+              : util_deflate_data_png_mt(data, size, stride, opts->threads, &compressed, &compressed_size,
+                                         &opts->zlib);
+    if (ret == 0) {
+        ret = png_write_idat(fp, compressed, compressed_size, opts->idat_size);
+    }
+    free(compressed);
+    return ret;
+}
@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <zlib.h>
+#include <pthread.h>
+#include <unistd.h>
 
 /* Big-endian helpers */
 uint32_t read_u32_be(const uint8_t *buf)
@@ -95,43 +97,238 @@ int util_inflate_data(const uint8_t *compressed, size_t compressed_size,
 /* Returns 0 on success, -1 on error. Caller must free *out_data. */
 int util_deflate_data_png(const uint8_t *data, size_t data_size,
                           uint8_t **out_data, size_t *out_size)
+{
+    return util_deflate_data_png_opts(data, data_size, out_data, out_size, NULL);
+}
+
+static const util_deflate_opts_t deflate_defaults = UTIL_DEFLATE_OPTS_DEFAULT;
+
+int util_deflate_opts_valid(const util_deflate_opts_t *opts)
+{
+    return opts->level >= Z_DEFAULT_COMPRESSION && opts->level <= 9 &&
+           opts->mem_level >= 1 && opts->mem_level <= 9 &&
+           opts->strategy >= Z_DEFAULT_STRATEGY && opts->strategy <= Z_FIXED;
+}
+
+/* Compress data with PNG-compatible settings and the given level, strategy and memLevel */
+/* Returns 0 on success, -1 on error. Caller must free *out_data. */
+int util_deflate_data_png_opts(const uint8_t *data, size_t data_size,
+                               uint8_t **out_data, size_t *out_size, const util_deflate_opts_t *opts)
 {
     if (data == NULL || out_data == NULL || out_size == NULL) {
         return -1;
     }
+    if (opts == NULL) {
+        opts = &deflate_defaults;
+    }
 
     z_stream strm;
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
-    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    if (deflateInit2(&strm, opts->level, Z_DEFLATED, 15, opts->mem_level, opts->strategy) != Z_OK) {
         return -1;
     }
 
-    strm.avail_in = data_size;
-    strm.next_in = (uint8_t *)data;
-
-    size_t compressed_capacity = data_size;
+    /* Room for the worst case, so incompressible data still fits */
+    size_t compressed_capacity = deflateBound(&strm, data_size);
     uint8_t *compressed = (uint8_t *)malloc(compressed_capacity);
     if (compressed == NULL) {
         deflateEnd(&strm);
         return -1;
     }
 
-    strm.avail_out = compressed_capacity;
+    strm.next_in = (uint8_t *)data;
+    strm.avail_in = 0;
     strm.next_out = compressed;
-
-    int ret = deflate(&strm, Z_FINISH);
+    size_t in_left = data_size;
+    int ret;
+    do {
+        /* avail_in and avail_out are 32-bit, so hand over at most 1 GB at a time */
+        if (strm.avail_in == 0) {
+            strm.avail_in = in_left > (1u << 30) ? (1u << 30) : (uInt)in_left;
+            in_left -= strm.avail_in;
+        }
+        size_t room = compressed_capacity - (size_t)(strm.next_out - compressed);
+        strm.avail_out = room > (1u << 30) ? (1u << 30) : (uInt)room;
+        ret = deflate(&strm, in_left == 0 ? Z_FINISH : Z_NO_FLUSH);
+    } while (ret == Z_OK);
     if (ret != Z_STREAM_END) {
         free(compressed);
         deflateEnd(&strm);
         return -1;
     }
 
-    size_t compressed_size = compressed_capacity - strm.avail_out;
+    size_t compressed_size = (size_t)(strm.next_out - compressed);
     deflateEnd(&strm);
 
     *out_data = compressed;
     *out_size = compressed_size;
     return 0;
 }
+
+/* Smallest band worth a thread; below this the shorter matches near band
+ * edges cost more than the thread saves */
+#define DEFLATE_MIN_BAND (128 * 1024)
+
+/* One band of a parallel deflate, compressed into its own raw deflate
+ * stream that the next band picks up from */
+typedef struct {
+    const uint8_t *data;        /* Start of the whole input */
+    size_t         start;
+    size_t         len;
+    int            last;        /* Ends the stream (Z_FINISH) */
+    uint8_t       *out;
+    size_t         out_len;
+    uLong          adler;       /* Adler-32 of this band's input */
+    const util_deflate_opts_t *opts;
+    int            ret;
+} deflate_band_t;
+
+static void deflate_band(deflate_band_t *band)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    band->ret = -1;
+    if (band->len > 0xFFFFFFFFUL) {
+        return;
+    }
+    /* Negative window bits: raw deflate, no header or trailer per band */
+    if (deflateInit2(&strm, band->opts->level, Z_DEFLATED, -15, band->opts->mem_level, band->opts->strategy) != Z_OK) {
+        return;
+    }
+    /* Prime the window with the 32 KB before the band, so matches reach back
+     * across the boundary as they would in one stream */
+    if (band->start > 0) {
+        size_t dict = band->start < 32768 ? band->start : 32768;
+        if (deflateSetDictionary(&strm, band->data + band->start - dict, (uInt)dict) != Z_OK) {
+            deflateEnd(&strm);
+            return;
+        }
+    }
+    /* The bound covers Z_FINISH; a full flush adds at most an empty stored block */
+    size_t capacity = deflateBound(&strm, band->len) + 16;
+    band->out = malloc(capacity);
+    if (band->out == NULL) {
+        deflateEnd(&strm);
+        return;
+    }
+    strm.next_in = (uint8_t *)band->data + band->start;
+    strm.avail_in = band->len;
+    strm.next_out = band->out;
+    strm.avail_out = capacity;
+    /* A full flush leaves the band on a byte boundary, so the next one can
+     * simply be appended */
+    int ret = deflate(&strm, band->last ? Z_FINISH : Z_FULL_FLUSH);
+    band->out_len = capacity - strm.avail_out;
+    deflateEnd(&strm);
+    if ((band->last && ret != Z_STREAM_END) || (!band->last && (ret != Z_OK || strm.avail_in != 0 || strm.avail_out == 0))) {
+        return;
+    }
+    band->adler = adler32(adler32(0L, Z_NULL, 0), band->data + band->start, band->len);
+    band->ret = 0;
+}
+
+static void *deflate_worker(void *arg)
+{
+    deflate_band(arg);
+    return NULL;
+}
+
+/* Compress data in bands on separate threads, joined into one zlib stream */
+/* Returns 0 on success, -1 on error. Caller must free *out_data. */
+int util_deflate_data_png_mt(const uint8_t *data, size_t data_size, size_t stride, int threads,
+                             uint8_t **out_data, size_t *out_size, const util_deflate_opts_t *opts)
+{
+    if (data == NULL || out_data == NULL || out_size == NULL || stride == 0) {
+        return -1;
+    }
+    if (opts == NULL) {
+        opts = &deflate_defaults;
+    }
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    size_t rows = (data_size + stride - 1) / stride;
+    size_t nbands = data_size / DEFLATE_MIN_BAND;
+    if (nbands > (size_t)threads) {
+        nbands = (size_t)threads;
+    }
+    /* avail_in is 32-bit, so very large inputs need more bands than threads */
+    while (nbands > 0 && data_size / nbands > (1u << 30)) {
+        nbands++;
+    }
+    if (nbands > rows) {
+        nbands = rows;
+    }
+    if (nbands <= 1) {
+        return util_deflate_data_png_opts(data, data_size, out_data, out_size, opts);
+    }
+
+    deflate_band_t *bands = calloc(nbands, sizeof(deflate_band_t));
+    pthread_t *tids = calloc(nbands, sizeof(pthread_t));
+    int *started = calloc(nbands, sizeof(int));
+    if (bands == NULL || tids == NULL || started == NULL) {
+        free(bands);
+        free(tids);
+        free(started);
+        return -1;
+    }
+    for (size_t i = 0; i < nbands; i++) {
+        size_t start = rows * i / nbands * stride;
+        size_t end = i + 1 == nbands ? data_size : rows * (i + 1) / nbands * stride;
+        bands[i] = (deflate_band_t){ data, start, end - start, i + 1 == nbands, NULL, 0, 0, opts, -1 };
+    }
+    for (size_t i = 1; i < nbands; i++) {
+        started[i] = pthread_create(&tids[i], NULL, deflate_worker, &bands[i]) == 0;
+    }
+    for (size_t i = 0; i < nbands; i++) {
+        if (!started[i]) {
+            deflate_band(&bands[i]);
+        }
+    }
+    size_t total = 2 + 4;
+    int ret = 0;
+    for (size_t i = 0; i < nbands; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        ret |= bands[i].ret;
+        total += bands[i].out_len;
+    }
+
+    uint8_t *compressed = ret == 0 ? malloc(total) : NULL;
+    if (compressed != NULL) {
+        /* The header deflateInit2 would write: a 32 KB window, then the
+         * level hint that zlib derives from the level and strategy */
+        int level = opts->level == Z_DEFAULT_COMPRESSION ? 6 : opts->level;
+        int hint = opts->strategy >= Z_HUFFMAN_ONLY || level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        unsigned header = (0x78 << 8) | (hint << 6);
+        header += 31 - header % 31;
+        size_t pos = 0;
+        compressed[pos++] = (uint8_t)(header >> 8);
+        compressed[pos++] = (uint8_t)header;
+        uLong adler = bands[0].adler;
+        for (size_t i = 0; i < nbands; i++) {
+            memcpy(compressed + pos, bands[i].out, bands[i].out_len);
+            pos += bands[i].out_len;
+            if (i > 0) {
+                adler = adler32_combine(adler, bands[i].adler, (z_off_t)bands[i].len);
+            }
+        }
+        compressed[pos++] = (uint8_t)(adler >> 24);
+        compressed[pos++] = (uint8_t)(adler >> 16);
+        compressed[pos++] = (uint8_t)(adler >> 8);
+        compressed[pos++] = (uint8_t)adler;
+        *out_data = compressed;
+        *out_size = pos;
+    }
+    for (size_t i = 0; i < nbands; i++) {
+        free(bands[i].out);
+    }
+    free(bands);
+    free(tids);
+    free(started);
+    return compressed != NULL ? 0 : -1;
+}
@@ -0,0 +1,42 @@
+#include <criterion/criterion.h>
+#include "png_batch.h"
+#include "png_reader.h"
+#include <string.h>
+#include <stdlib.h>
+
+Test(batch, scan_matches_reader) {
+    const char *path = "tests/data/Large_batman_6.png";
+    png_info_t info, skipped;
+    cr_assert_eq(png_scan(path, &info, PNG_CRC_CHECK), 0, "Should scan valid PNG file");
+    cr_assert_eq(png_scan(path, &skipped, PNG_CRC_SKIP), 0, "Should scan without CRCs");
+
+    FILE *fp = png_open(path);
+    cr_assert_not_null(fp, "Failed to open test PNG file");
+    png_ihdr_t ihdr;
+    cr_assert_eq(png_extract_ihdr(fp, &ihdr), 0);
+    fclose(fp);
+    cr_assert_eq(info.ihdr.width, ihdr.width, "Width should match png_extract_ihdr");
+    cr_assert_eq(info.ihdr.height, ihdr.height, "Height should match png_extract_ihdr");
+    cr_assert_eq(info.ihdr.bit_depth, ihdr.bit_depth);
+    cr_assert_eq(info.ihdr.color_type, ihdr.color_type);
+
+    png_chunk_t *summary = NULL;
+    cr_assert_eq(png_summary(path, &summary), 0);
+    uint32_t count = 0;
+    uint64_t idat_bytes = 0;
+    for (; strcmp(summary[count].type, "IEND") != 0; count++) {
+        if (strcmp(summary[count].type, "IDAT") == 0) {
+            idat_bytes += summary[count].length;
+        }
+    }
+    free(summary);
+    cr_assert_eq(info.num_chunks, count + 1, "Chunk count should include IEND");
+    cr_assert_eq(info.idat_bytes, idat_bytes);
+    cr_assert_eq(info.palette_size, 0, "Color type 6 has no palette");
+    cr_assert_eq(info.crc, PNG_CRC_VALID);
+
+    cr_assert_eq(skipped.num_chunks, info.num_chunks);
+    cr_assert_eq(skipped.crc, PNG_CRC_UNCHECKED);
+
+    cr_assert_neq(png_scan("tests/data/Batnan.png", &info, PNG_CRC_CHECK), 0, "Should reject a missing file");
+}
@@ -0,0 +1,88 @@
+#include <criterion/criterion.h>
+#include "png_filter.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* Straight from the filter definitions, one byte at a time */
+static uint8_t ref_predict(uint8_t type, const uint8_t *row, const uint8_t *prev, size_t i, size_t bpp)
+{
+    int a = i >= bpp ? row[i - bpp] : 0;
+    int b = prev ? prev[i] : 0;
+    int c = i >= bpp && prev ? prev[i - bpp] : 0;
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    switch (type) {
+        case PNG_FILTER_SUB:   return a;
+        case PNG_FILTER_UP:    return b;
+        case PNG_FILTER_AVG:   return (a + b) / 2;
+        case PNG_FILTER_PAETH: return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        default:               return 0;
+    }
+}
+
+Test(filter, rows_match_reference) {
+    const size_t bpps[] = { 1, 2, 3, 4, 6, 8 };
+    uint8_t prev[300], row[300], filtered[300], ref[300];
+    srand(320);
+    for (size_t k = 0; k < sizeof(bpps) / sizeof(bpps[0]); k++) {
+        size_t bpp = bpps[k];
+        /* Lengths around the 16-byte vector width, whole pixels only */
+        for (size_t len = bpp; len <= 40 * bpp && len <= sizeof(row); len += bpp) {
+            for (size_t i = 0; i < len; i++) {
+                prev[i] = rand();
+                /* Smooth data reaches the ties and small gradients too */
+                row[i] = (len % 3 == 0) ? (uint8_t)(prev[i] + rand() % 3) : (uint8_t)rand();
+            }
+            for (uint8_t type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++) {
+                for (int first = 0; first < 2; first++) {
+                    const uint8_t *up = first ? NULL : prev;
+                    for (size_t i = 0; i < len; i++) {
+                        ref[i] = row[i] - ref_predict(type, row, up, i, bpp);
+                    }
+                    cr_assert_eq(png_filter_row(type, row, up, filtered, len, bpp), 0);
+                    cr_assert_eq(memcmp(filtered, ref, len), 0,
+                                 "Filter %u differs for bpp %zu, len %zu", type, bpp, len);
+                    cr_assert_eq(png_unfilter_row(type, filtered, up, len, bpp), 0);
+                    cr_assert_eq(memcmp(filtered, row, len), 0,
+                                 "Unfilter %u differs for bpp %zu, len %zu", type, bpp, len);
+                }
+            }
+        }
+    }
+    cr_assert_neq(png_unfilter_row(5, row, prev, 8, 4), 0, "Should reject unknown filter types");
+    cr_assert_neq(png_filter_row(5, row, prev, filtered, 8, 4), 0, "Should reject unknown filter types");
+}
+
+Test(filter, adaptive_image_round_trips) {
+    const uint32_t height = 200;
+    const size_t row_bytes = 3 * 97, stride = 1 + row_bytes;
+    uint8_t *raw = malloc(height * stride);
+    uint8_t *one = malloc(height * stride);
+    uint8_t *many = malloc(height * stride);
+    cr_assert(raw != NULL && one != NULL && many != NULL);
+    srand(47);
+    /* A gradient with noise, so that no single filter wins every row */
+    for (uint32_t y = 0; y < height; y++) {
+        raw[y * stride] = PNG_FILTER_NONE;
+        for (size_t i = 0; i < row_bytes; i++) {
+            raw[y * stride + 1 + i] = (uint8_t)(y < 100 ? i + y : rand() % 4 + (y & 1) * 128);
+        }
+    }
+
+    cr_assert_eq(png_filter_image(raw, one, height, row_bytes, 3, PNG_FILTER_ADAPTIVE, 1), 0);
+    cr_assert_eq(png_filter_image(raw, many, height, row_bytes, 3, PNG_FILTER_ADAPTIVE, 4), 0);
+    cr_assert_eq(memcmp(one, many, height * stride), 0, "Threads should not change the output");
+    cr_assert_eq(png_unfilter_image(one, height, row_bytes, 3), 0);
+    cr_assert_eq(memcmp(one, raw, height * stride), 0, "Unfiltering should give the image back");
+
+    for (int filter = PNG_FILTER_NONE; filter <= PNG_FILTER_PAETH; filter++) {
+        cr_assert_eq(png_filter_image(raw, many, height, row_bytes, 3, filter, 2), 0);
+        for (uint32_t y = 0; y < height; y++) {
+            cr_assert_eq(many[y * stride], filter, "Every scanline should use filter %d", filter);
+        }
+    }
+    cr_assert_neq(png_filter_image(raw, many, height, row_bytes, 3, PNG_FILTER_ADAPTIVE + 1, 1), 0);
+
+    free(raw);
+    free(one);
+    free(many);
+}
@@ -0,0 +1,86 @@
+#include <criterion/criterion.h>
+#include "png_idat.h"
+#include "png_reader.h"
+#include "util.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* The old way: concatenate every IDAT and inflate the result in one go */
+static uint8_t *inflate_concatenated(const char *path, size_t *out_size)
+{
+    FILE *fp = png_open(path);
+    cr_assert_not_null(fp, "Failed to open test PNG file");
+    uint8_t *all = NULL;
+    size_t all_len = 0;
+    png_chunk_t chunk;
+    while (png_read_chunk(fp, &chunk) == 0) {
+        int end = strcmp(chunk.type, "IEND") == 0;
+        if (strcmp(chunk.type, "IDAT") == 0) {
+            all = realloc(all, all_len + chunk.length);
+            memcpy(all + all_len, chunk.data, chunk.length);
+            all_len += chunk.length;
+        }
+        png_free_chunk(&chunk);
+        if (end) {
+            break;
+        }
+    }
+    fclose(fp);
+    uint8_t *out = NULL;
+    cr_assert_eq(util_inflate_data(all, all_len, &out, out_size), 0);
+    free(all);
+    return out;
+}
+
+Test(idat, read_idat_matches_concatenated) {
+    const char *files[] = { "tests/data/Large_batman_6.png", "tests/data/Batman.png" };
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+        size_t want_size = 0, got_size = 0;
+        uint8_t *want = inflate_concatenated(files[f], &want_size);
+        png_ihdr_t ihdr;
+        uint8_t *got = NULL;
+        cr_assert_eq(png_read_idat(files[f], &ihdr, &got, &got_size), 0, "Should decode %s", files[f]);
+        cr_assert_eq(got_size, png_image_size(&ihdr), "Output should be sized from IHDR");
+        cr_assert_eq(got_size, want_size);
+        cr_assert_eq(memcmp(got, want, want_size), 0, "Decoded data differs for %s", files[f]);
+        free(got);
+        free(want);
+    }
+}
+
+Test(idat, feed_hands_back_rows_incrementally) {
+    const char *path = "tests/data/Batman.png";
+    png_map_t map;
+    cr_assert_eq(png_map(path, &map), 0);
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    png_chunk_iter_init(&it, &map);
+    cr_assert_eq(png_chunk_next(&it, &view), 1);
+    png_chunk_t chunk = { view.length, "IHDR", (uint8_t *)view.data, view.crc };
+    png_ihdr_t ihdr;
+    cr_assert_eq(png_parse_ihdr(&chunk, &ihdr), 0);
+
+    /* Feed the stream a few bytes at a time, as if it were split over many IDATs */
+    png_idat_decoder_t dec;
+    cr_assert_eq(png_idat_init(&dec, &ihdr), 0);
+    uint32_t last_rows = 0;
+    int grew = 0;
+    while (png_chunk_next(&it, &view) == 1) {
+        if (strcmp(view.type, "IDAT") != 0) {
+            continue;
+        }
+        for (size_t off = 0; off < view.length; off += 7) {
+            size_t n = view.length - off < 7 ? view.length - off : 7;
+            cr_assert_eq(png_idat_feed(&dec, view.data + off, n), 0, "Feed failed at %zu", off);
+            cr_assert_geq(dec.rows_ready, last_rows);
+            grew += dec.rows_ready > last_rows;
+            last_rows = dec.rows_ready;
+        }
+    }
+    cr_assert_eq(png_idat_finish(&dec), 0, "Stream should end exactly at the image size");
+    cr_assert_eq(dec.rows_ready, ihdr.height);
+    cr_assert_gt(grew, 1, "Rows should become ready before the end");
+    cr_assert_neq(png_idat_feed(&dec, view.data, 1), 0, "Nothing may follow the stream");
+    png_idat_free(&dec);
+    png_unmap(&map);
+}
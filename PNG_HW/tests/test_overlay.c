@@ -1,5 +1,7 @@
 #include <criterion/criterion.h>
 #include "png_overlay.h"
+#include "png_idat.h"
+#include "png_reader.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -99,3 +101,123 @@ Test(overlay, overlay_null_parameters) {
     cr_assert_neq(png_overlay_paste(input, NULL, output, 0, 0), 0);
     cr_assert_neq(png_overlay_paste(input, input, NULL, 0, 0), 0);
 }
+
+Test(overlay, overlay_rejects_bad_zlib_settings) {
+    const char *large = "tests/data/Large_batman_6.png";
+    const char *small = "tests/data/Small_batman_6.png";
+    const char *output = "tests/data/test_overlay_bad_zlib.png";
+    png_write_opts_t opts = PNG_WRITE_OPTS_DEFAULT;
+    opts.zlib.strategy = Z_FIXED + 1;
+
+    unlink(output);
+    cr_assert_neq(png_overlay_paste_opts(large, small, output, 0, 0, &opts), 0, "Bad strategy should be rejected");
+    cr_assert_neq(access(output, F_OK), 0, "A rejected overlay should leave no file");
+}
+
+Test(overlay, overlay_adaptive_filter_same_pixels) {
+    const char *large = "tests/data/Large_batman_6.png";
+    const char *small = "tests/data/Small_batman_6.png";
+    const char *output = "tests/data/test_overlay_adaptive.png";
+    const char *answer = "tests/data/answer_test_overlay_type6.png";
+    png_write_opts_t opts = PNG_WRITE_OPTS_DEFAULT;
+    opts.filter = PNG_FILTER_ADAPTIVE;
+    opts.threads = 4;
+
+    cr_assert_eq(png_overlay_paste_opts(large, small, output, 50, 50, &opts), 0, "Paste should succeed");
+
+    /* Different filters, same pixels */
+    png_ihdr_t ihdr_out, ihdr_ans;
+    uint8_t *out_data = NULL, *ans_data = NULL;
+    size_t out_size = 0, ans_size = 0;
+    cr_assert_eq(png_read_idat(output, &ihdr_out, &out_data, &out_size), 0);
+    cr_assert_eq(png_read_idat(answer, &ihdr_ans, &ans_data, &ans_size), 0);
+    cr_assert_eq(out_size, ans_size);
+    size_t row_bytes = png_row_bytes(&ihdr_out, ihdr_out.width);
+    size_t bpp = png_filter_bpp(&ihdr_out);
+    int filtered = 0;
+    for (uint32_t y = 0; y < ihdr_out.height; y++) {
+        filtered |= out_data[(size_t)y * (1 + row_bytes)] != PNG_FILTER_NONE;
+    }
+    cr_assert(filtered, "Some scanline should be filtered");
+    cr_assert_eq(png_unfilter_image(out_data, ihdr_out.height, row_bytes, bpp), 0);
+    cr_assert_eq(png_unfilter_image(ans_data, ihdr_ans.height, row_bytes, bpp), 0);
+    cr_assert_eq(memcmp(out_data, ans_data, out_size), 0, "Pixels should match the answer file");
+
+    free(out_data);
+    free(ans_data);
+    unlink(output);
+}
+
+Test(overlay, overlay_adaptive_filter_skips_palette) {
+    const char *large = "tests/data/Large_batman_3.png";
+    const char *small = "tests/data/Small_arrow_3.png";
+    const char *output = "tests/data/test_overlay_adaptive_type3.png";
+    const char *answer = "tests/data/answer_test_overlay_type3.png";
+    png_write_opts_t opts = PNG_WRITE_OPTS_DEFAULT;
+    opts.filter = PNG_FILTER_ADAPTIVE;
+
+    cr_assert_eq(png_overlay_paste_opts(large, small, output, 0, 0, &opts), 0, "Paste should succeed");
+
+    /* Palette indices are written unfiltered, so no larger than the answer */
+    FILE *fp = fopen(output, "rb");
+    cr_assert_not_null(fp);
+    fseek(fp, 0, SEEK_END);
+    long out_size = ftell(fp);
+    fclose(fp);
+    fp = fopen(answer, "rb");
+    cr_assert_not_null(fp);
+    fseek(fp, 0, SEEK_END);
+    long ans_size = ftell(fp);
+    fclose(fp);
+    cr_assert_leq(out_size, ans_size, "Adaptive filtering should not grow a palette image");
+
+    unlink(output);
+}
+
+/* Concatenated IDAT payloads and the number of IDAT chunks */
+static uint8_t *read_idat_stream(const char *path, size_t *size, int *count)
+{
+    png_map_t map;
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    cr_assert_eq(png_map(path, &map), 0);
+    uint8_t *stream = malloc(map.size);
+    cr_assert_not_null(stream);
+    *size = 0;
+    *count = 0;
+    png_chunk_iter_init(&it, &map);
+    while (png_chunk_next(&it, &view) == 1) {
+        if (strcmp(view.type, "IDAT") == 0) {
+            cr_assert_not_null(png_chunk_data(&view), "IDAT CRC should check out");
+            memcpy(stream + *size, view.data, view.length);
+            *size += view.length;
+            (*count)++;
+        }
+    }
+    png_unmap(&map);
+    return stream;
+}
+
+Test(overlay, overlay_streamed_idat_chunks) {
+    const char *large = "tests/data/Large_batman_6.png";
+    const char *small = "tests/data/Small_batman_6.png";
+    const char *output = "tests/data/test_overlay_streamed.png";
+    const char *answer = "tests/data/answer_test_overlay_type6.png";
+    png_write_opts_t opts = PNG_WRITE_OPTS_DEFAULT;
+    opts.idat_size = PNG_IDAT_STREAM_SIZE;
+
+    cr_assert_eq(png_overlay_paste_opts(large, small, output, 50, 50, &opts), 0, "Paste should succeed");
+
+    /* Same zlib stream as the answer file, just cut into chunks */
+    size_t out_size, ans_size;
+    int out_count, ans_count;
+    uint8_t *out_stream = read_idat_stream(output, &out_size, &out_count);
+    uint8_t *ans_stream = read_idat_stream(answer, &ans_size, &ans_count);
+    cr_assert_eq(out_count, (int)((ans_size + PNG_IDAT_STREAM_SIZE - 1) / PNG_IDAT_STREAM_SIZE));
+    cr_assert_eq(out_size, ans_size);
+    cr_assert_eq(memcmp(out_stream, ans_stream, out_size), 0, "IDAT data should match the answer file");
+
+    free(out_stream);
+    free(ans_stream);
+    unlink(output);
+}
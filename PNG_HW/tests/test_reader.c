@@ -1,6 +1,8 @@
 #include <criterion/criterion.h>
 #include "png_reader.h"
+#include "png_crc.h"
 #include <string.h>
+#include <stdlib.h>
 
 Test(reader, png_open_valid) {
     FILE *fp = png_open("tests/data/Large_batman_6.png");
@@ -144,3 +146,142 @@ Test(reader, png_free_chunk) {
     
     fclose(fp);
 }
+
+Test(reader, chunk_iter_matches_read_chunk) {
+    png_map_t map;
+    cr_assert_eq(png_map("tests/data/Large_batman_6.png", &map), 0, "Should map valid PNG file");
+    FILE *fp = png_open("tests/data/Large_batman_6.png");
+    cr_assert_not_null(fp, "Failed to open test PNG file");
+
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    png_chunk_t chunk;
+    int chunk_count = 0;
+    png_chunk_iter_init(&it, &map);
+    while (png_chunk_next(&it, &view) == 1) {
+        cr_assert_eq(png_read_chunk(fp, &chunk), 0, "Should read chunk %d", chunk_count);
+        cr_assert_str_eq(view.type, chunk.type, "Chunk %d type differs", chunk_count);
+        cr_assert_eq(view.length, chunk.length, "Chunk %d length differs", chunk_count);
+        cr_assert_eq(view.crc, chunk.crc, "Chunk %d CRC differs", chunk_count);
+        cr_assert(png_chunk_crc_ok(&view), "Chunk %d CRC should be valid", chunk_count);
+        cr_assert_eq(memcmp(view.data, chunk.data, chunk.length), 0, "Chunk %d data differs", chunk_count);
+        png_free_chunk(&chunk);
+        chunk_count++;
+    }
+    cr_assert(it.done, "Iteration should end at IEND");
+    cr_assert_gt(chunk_count, 2, "Should have multiple chunks");
+    cr_assert_eq(png_chunk_next(&it, &view), 0, "Nothing follows IEND");
+
+    fclose(fp);
+    png_unmap(&map);
+}
+
+Test(reader, summary_skip_crc) {
+    const char *bad = "/tmp/test_summary_bad_crc.png";
+    FILE *in = fopen("tests/data/Large_batman_6.png", "rb");
+    cr_assert_not_null(in, "Failed to open test PNG file");
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    rewind(in);
+    uint8_t *buf = malloc(size);
+    cr_assert_eq(fread(buf, 1, size, in), (size_t)size);
+    fclose(in);
+
+    /* Flip a byte in the middle of the file, inside some IDAT payload */
+    buf[size / 2] ^= 0xFF;
+    FILE *out = fopen(bad, "wb");
+    cr_assert_not_null(out);
+    cr_assert_eq(fwrite(buf, 1, size, out), (size_t)size);
+    fclose(out);
+    free(buf);
+
+    png_chunk_t *checked = NULL, *skipped = NULL;
+    cr_assert_eq(png_summary_crc(bad, &checked, PNG_CRC_CHECK), 0);
+    cr_assert_eq(png_summary_crc(bad, &skipped, PNG_CRC_SKIP), 0);
+
+    int invalid = 0, i;
+    for (i = 0; strcmp(checked[i].type, "IEND") != 0; i++) {
+        cr_assert_str_eq(checked[i].type, skipped[i].type);
+        cr_assert_eq(checked[i].length, skipped[i].length);
+        cr_assert_eq(skipped[i].crc, PNG_CRC_UNCHECKED, "Chunk %d should not be checked", i);
+        invalid += checked[i].crc == PNG_CRC_INVALID;
+    }
+    cr_assert_str_eq(skipped[i].type, "IEND");
+    cr_assert_eq(invalid, 1, "Exactly one chunk should fail its CRC");
+
+    /* Lazy check: the corrupted chunk's data is refused when accessed */
+    png_map_t map;
+    png_chunk_iter_t it;
+    png_chunk_view_t view;
+    int refused = 0;
+    cr_assert_eq(png_map(bad, &map), 0);
+    png_chunk_iter_init(&it, &map);
+    while (png_chunk_next(&it, &view) == 1) {
+        refused += png_chunk_data(&view) == NULL;
+    }
+    cr_assert_eq(refused, 1, "Only the corrupted chunk's data should be refused");
+
+    png_unmap(&map);
+    free(checked);
+    free(skipped);
+    remove(bad);
+}
+
+static void write_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t len, int bad_crc)
+{
+    uint8_t buf[4 + 256];
+    uint8_t be[4] = { len >> 24, len >> 16, len >> 8, len };
+    memcpy(buf, type, 4);
+    if (len > 0) {
+        memcpy(buf + 4, data, len);
+    }
+    uint32_t crc = png_crc(buf, 4 + len) ^ (bad_crc ? 1 : 0);
+    uint8_t crc_be[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    fwrite(be, 1, 4, fp);
+    fwrite(buf, 1, 4 + len, fp);
+    fwrite(crc_be, 1, 4, fp);
+}
+
+Test(reader, extract_plte_skips_other_payloads) {
+    const char *path = "/tmp/test_extract_plte.png";
+    const uint8_t sig[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+    const uint8_t ihdr[13] = { 0, 0, 0, 1, 0, 0, 0, 1, 8, 3, 0, 0, 0 };
+    const uint8_t plte[6] = { 1, 2, 3, 4, 5, 6 };
+    const uint8_t text[8] = "a\0bcdefg";
+
+    /* The tEXt chunk before PLTE has a bad CRC: it is seeked over, never read */
+    FILE *fp = fopen(path, "wb");
+    cr_assert_not_null(fp);
+    fwrite(sig, 1, 8, fp);
+    write_chunk(fp, "IHDR", ihdr, 13, 0);
+    write_chunk(fp, "tEXt", text, 8, 1);
+    write_chunk(fp, "PLTE", plte, 6, 0);
+    write_chunk(fp, "IEND", NULL, 0, 0);
+    fclose(fp);
+
+    png_color_t *colors = NULL;
+    size_t count = 0;
+    fp = png_open(path);
+    cr_assert_not_null(fp);
+    cr_assert_eq(png_extract_plte(fp, &colors, &count), 0, "Should find PLTE past the damaged chunk");
+    cr_assert_eq(count, 2);
+    cr_assert_eq(colors[1].r, 4);
+    free(colors);
+    fclose(fp);
+
+    /* A PLTE after the first IDAT is not looked for */
+    fp = fopen(path, "wb");
+    cr_assert_not_null(fp);
+    fwrite(sig, 1, 8, fp);
+    write_chunk(fp, "IHDR", ihdr, 13, 0);
+    write_chunk(fp, "IDAT", text, 8, 0);
+    write_chunk(fp, "PLTE", plte, 6, 0);
+    write_chunk(fp, "IEND", NULL, 0, 0);
+    fclose(fp);
+
+    fp = png_open(path);
+    cr_assert_not_null(fp);
+    cr_assert_neq(png_extract_plte(fp, &colors, &count), 0, "Should stop at IDAT");
+    fclose(fp);
+    remove(path);
+}
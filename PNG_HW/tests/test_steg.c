@@ -288,3 +288,29 @@ Test(steg_extract, extract_null_parameters) {
     cr_assert_neq(png_extract_lsb(input, NULL, sizeof(extracted)), 0);
     cr_assert_neq(png_extract_lsb(input, extracted, 0), 0);
 }
+
+Test(steg_encode, encode_with_options_type6) {
+    const char *input = "tests/data/Large_batman_6.png";
+    const char *output = "tests/data/test_steg_options_type6.png";
+    const char *secret = "Hello World";
+    char extracted[256] = {0};
+    png_write_opts_t opts = PNG_WRITE_OPTS_DEFAULT;
+    opts.zlib.level = 1;
+    opts.zlib.strategy = Z_RLE;
+    opts.zlib.mem_level = 9;
+    opts.idat_size = PNG_IDAT_STREAM_SIZE;
+
+    cr_assert_eq(png_encode_lsb_opts(input, output, secret, &opts), 0, "Encoding should succeed");
+    int ret = png_extract_lsb(output, extracted, sizeof(extracted));
+    cr_assert_eq(ret, (int)strlen(secret), "Extraction should succeed");
+    cr_assert_str_eq(extracted, secret, "Extracted secret should match");
+    unlink(output);
+
+    opts.zlib.level = 10;
+    cr_assert_neq(png_encode_lsb_opts(input, output, secret, &opts), 0, "Level 10 should be rejected");
+    cr_assert_neq(access(output, F_OK), 0, "A rejected encode should leave no file");
+    opts.zlib.level = 1;
+    opts.zlib.mem_level = 0;
+    cr_assert_neq(png_encode_lsb_opts(input, output, secret, &opts), 0, "memLevel 0 should be rejected");
+    cr_assert_neq(access(output, F_OK), 0, "A rejected encode should leave no file");
+}
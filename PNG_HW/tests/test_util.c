@@ -0,0 +1,77 @@
+#include <criterion/criterion.h>
+#include "util.h"
+#include <string.h>
+#include <stdlib.h>
+
+Test(util, deflate_mt_is_one_zlib_stream) {
+    /* Repeats that cross band edges, then noise */
+    const size_t stride = 1001, size = 1200 * stride;
+    uint8_t *data = malloc(size);
+    cr_assert_not_null(data);
+    srand(48);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = i < size / 2 ? (uint8_t)(i % 251) : (uint8_t)rand();
+    }
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        uint8_t *compressed = NULL, *inflated = NULL;
+        size_t compressed_size = 0, inflated_size = 0;
+        cr_assert_eq(util_deflate_data_png_mt(data, size, stride, threads, &compressed, &compressed_size, NULL), 0);
+        /* inflate checks the combined Adler-32 trailer */
+        cr_assert_eq(util_inflate_data(compressed, compressed_size, &inflated, &inflated_size), 0,
+                     "Stream from %d threads should inflate", threads);
+        cr_assert_eq(inflated_size, size);
+        cr_assert_eq(memcmp(inflated, data, size), 0, "Stream from %d threads should round-trip", threads);
+        free(compressed);
+        free(inflated);
+    }
+    free(data);
+}
+
+Test(util, deflate_incompressible_data) {
+    const size_t size = 256 * 1024;
+    uint8_t *data = malloc(size);
+    cr_assert_not_null(data);
+    srand(49);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)rand();
+    }
+
+    uint8_t *compressed = NULL, *inflated = NULL;
+    size_t compressed_size = 0, inflated_size = 0;
+    cr_assert_eq(util_deflate_data_png(data, size, &compressed, &compressed_size), 0,
+                 "Noise should compress even though it grows");
+    cr_assert_gt(compressed_size, size);
+    cr_assert_eq(util_inflate_data(compressed, compressed_size, &inflated, &inflated_size), 0);
+    cr_assert_eq(inflated_size, size);
+    cr_assert_eq(memcmp(inflated, data, size), 0);
+    free(compressed);
+    free(inflated);
+    free(data);
+}
+
+Test(util, deflate_mt_header_follows_level) {
+    const size_t stride = 1001, size = 600 * stride;
+    const util_deflate_opts_t settings[] = {
+        { 1, Z_RLE, 9 }, { 4, Z_FILTERED, 8 }, { 9, Z_DEFAULT_STRATEGY, 1 }, UTIL_DEFLATE_OPTS_DEFAULT
+    };
+    uint8_t *data = malloc(size);
+    cr_assert_not_null(data);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i % 97 + i / 4096);
+    }
+
+    for (size_t k = 0; k < sizeof(settings) / sizeof(settings[0]); k++) {
+        uint8_t *one = NULL, *many = NULL, *inflated = NULL;
+        size_t one_size = 0, many_size = 0, inflated_size = 0;
+        cr_assert_eq(util_deflate_data_png_opts(data, size, &one, &one_size, &settings[k]), 0);
+        cr_assert_eq(util_deflate_data_png_mt(data, size, stride, 4, &many, &many_size, &settings[k]), 0);
+        cr_assert_eq(memcmp(one, many, 2), 0, "Band header should match zlib's for setting %zu", k);
+        cr_assert_eq(util_inflate_data(many, many_size, &inflated, &inflated_size), 0);
+        cr_assert_eq(memcmp(inflated, data, size), 0);
+        free(one);
+        free(many);
+        free(inflated);
+    }
+    free(data);
+}
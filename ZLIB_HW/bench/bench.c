@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include "our_zlib.h"
+#include "lz.h"
+#include "huff.h"
+#include "crc.h"
+
+#define DEFAULT_SIZE (64 * 1024)
+#define DEFAULT_RUNS 5
+#define MAX_RUNS     1000
+
+/* Usage/Help Messages */
+#define PRINT_BENCH_USAGE(prog_name) do { \
+    fprintf(stdout, "Usage: %s [options]\n", prog_name); \
+    fprintf(stdout, "Options:\n"); \
+    fprintf(stdout, "  -s bytes              Size of each generated corpus input (default %d)\n", DEFAULT_SIZE); \
+    fprintf(stdout, "  -n runs               Timed runs per stage (default %d)\n", DEFAULT_RUNS); \
+    fprintf(stdout, "  -c corpus             Only run the named corpus input\n"); \
+    fprintf(stdout, "  -j                    Print results as JSON\n"); \
+    fprintf(stdout, "  -z                    Compare deflate/inflate against system libz and gzip\n"); \
+    fprintf(stdout, "  -h                    Print this help message\n"); \
+} while(0)
+
+typedef struct {
+	const char*		name;
+	unsigned char*	data;
+	size_t			len;
+} corpus_t;
+
+typedef struct {
+	const char*	corpus;
+	const char*	stage;
+	size_t		in_len;		// uncompressed bytes processed per run
+	size_t		out_len;	// bytes produced (0 when a ratio makes no sense)
+	int			ok;
+	double		secs[MAX_RUNS];
+	int			runs;
+} result_t;
+
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* ───────────────────────── corpus generators ─────────────────────── */
+
+static unsigned char* make_zeros(size_t len) {
+	return calloc(len ? len : 1, 1);
+}
+
+static unsigned char* make_sequential(size_t len) {
+	unsigned char* data = malloc(len ? len : 1);
+	if (!data) return NULL;
+	for (size_t i = 0; i < len; i++)
+		data[i] = (unsigned char)(i & 0xFF);
+	return data;
+}
+
+static unsigned char* make_pseudo_random(size_t len) {
+	unsigned char* data = malloc(len ? len : 1);
+	if (!data) return NULL;
+	unsigned s = 42;
+	for (size_t i = 0; i < len; i++) {
+		s = s * 1103515245u + 12345u;
+		data[i] = (unsigned char)(s >> 16);
+	}
+	return data;
+}
+
+static unsigned char* make_repeating_pattern(size_t len) {
+	static const char pat[] = "ABCDEFGHIJKLMNOP";
+	unsigned char* data = malloc(len ? len : 1);
+	if (!data) return NULL;
+	for (size_t i = 0; i < len; i++)
+		data[i] = (unsigned char)pat[i % (sizeof(pat) - 1)];
+	return data;
+}
+
+/* Log-like text: words drawn from a small skewed vocabulary, with numbers and newlines */
+static unsigned char* make_text(size_t len) {
+	static const char* words[] = {
+		"the", "request", "GET", "POST", "/api/v1/users", "status", "200", "404",
+		"latency", "ms", "user", "session", "cache", "miss", "hit", "error",
+		"compress", "block", "INFO", "WARN", "connection", "closed", "from", "to"
+	};
+	const size_t nwords = sizeof(words) / sizeof(words[0]);
+	unsigned char* data = malloc(len ? len : 1);
+	if (!data) return NULL;
+	unsigned s = 7;
+	size_t i = 0;
+	while (i < len) {
+		s = s * 1103515245u + 12345u;
+		unsigned r = s >> 16;
+		// Square the draw to skew towards the first words like natural text
+		const char* w = words[((r % nwords) * (r % nwords)) / nwords];
+		for (size_t k = 0; w[k] && i < len; k++)
+			data[i++] = (unsigned char)w[k];
+		if (i < len) data[i++] = (r % 11 == 0) ? '\n' : ' ';
+		if (i < len && r % 5 == 0) {
+			char num[16];
+			int n = snprintf(num, sizeof(num), "%u", r % 10000);
+			for (int k = 0; k < n && i < len; k++)
+				data[i++] = (unsigned char)num[k];
+			if (i < len) data[i++] = ' ';
+		}
+	}
+	return data;
+}
+
+/* Binary records: fixed-layout structs with slowly changing counters and random fields */
+static unsigned char* make_binary(size_t len) {
+	unsigned char* data = malloc(len ? len : 1);
+	if (!data) return NULL;
+	unsigned s = 99;
+	unsigned int counter = 0;
+	for (size_t i = 0; i < len; i += 16) {
+		unsigned char rec[16];
+		s = s * 1103515245u + 12345u;
+		counter += 1 + (s >> 28);
+		memcpy(rec, &counter, 4);
+		rec[4] = 0xFE; rec[5] = 0xED;					// magic
+		rec[6] = (unsigned char)(s >> 16);				// random byte
+		rec[7] = (unsigned char)((s >> 24) & 0x03);		// small enum
+		memset(rec + 8, 0, 6);							// padding
+		rec[14] = (unsigned char)(counter & 0xFF);
+		rec[15] = 0x0A;
+		size_t n = len - i < 16 ? len - i : 16;
+		memcpy(data + i, rec, n);
+	}
+	return data;
+}
+
+/* Already-compressed input: the first len bytes of a gzip stream of text
+ * followed by pseudo-random bytes. The random half keeps the stream at least
+ * len bytes long, so nothing repeats. */
+static unsigned char* make_compressed(size_t len, const char* tmp_path) {
+	unsigned char* text = make_text(len);
+	unsigned char* noise = make_pseudo_random(len);
+	unsigned char* src = malloc(2 * len + 1);
+	if (!text || !noise || !src) { free(text); free(noise); free(src); return NULL; }
+	memcpy(src, text, len);
+	memcpy(src + len, noise, len);
+	free(text);
+	free(noise);
+	FILE* f = fopen(tmp_path, "wb");
+	if (!f) { free(src); return NULL; }
+	fwrite(src, 1, 2 * len, f);
+	fclose(f);
+	size_t gz_len = 0;
+	char* gz = deflate((char*)tmp_path, (char*)src, 2 * len, &gz_len);
+	free(src);
+	if (!gz || gz_len < len) { free(gz); return NULL; }
+	unsigned char* data = realloc(gz, len ? len : 1);
+	return data ? data : (unsigned char*)gz;
+}
+
+/* ───────────────────────────── reporting ─────────────────────────── */
+
+static int cmp_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted run times */
+static double percentile(const double* sorted, int n, double p) {
+	int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+	if (idx < 0) idx = 0;
+	if (idx >= n) idx = n - 1;
+	return sorted[idx];
+}
+
+static double mb_per_sec(size_t bytes, double secs) {
+	return secs > 0 ? (double)bytes / secs / 1e6 : 0.0;
+}
+
+static void print_table_header(void) {
+	fprintf(stdout, "%-18s %-22s %10s %9s %9s %9s %9s %8s\n",
+		"corpus", "stage", "bytes", "med MB/s", "p10 MB/s", "p90 MB/s", "max MB/s", "ratio");
+}
+
+static void print_table_row(const result_t* r) {
+	if (!r->ok) {
+		fprintf(stdout, "%-18s %-22s %10zu %9s\n", r->corpus, r->stage, r->in_len, "FAILED");
+		return;
+	}
+	double sorted[MAX_RUNS];
+	memcpy(sorted, r->secs, sizeof(double) * r->runs);
+	qsort(sorted, r->runs, sizeof(double), cmp_double);
+	// Slow runs give low throughput: p10 throughput comes from the p90 time
+	fprintf(stdout, "%-18s %-22s %10zu %9.2f %9.2f %9.2f %9.2f ",
+		r->corpus, r->stage, r->in_len,
+		mb_per_sec(r->in_len, percentile(sorted, r->runs, 50)),
+		mb_per_sec(r->in_len, percentile(sorted, r->runs, 90)),
+		mb_per_sec(r->in_len, percentile(sorted, r->runs, 10)),
+		mb_per_sec(r->in_len, sorted[0]));
+	if (r->out_len)
+		fprintf(stdout, "%8.4f\n", (double)r->out_len / (double)r->in_len);
+	else
+		fprintf(stdout, "%8s\n", "-");
+}
+
+static void print_json_row(const result_t* r, int first) {
+	fprintf(stdout, "%s\n    {\"corpus\": \"%s\", \"stage\": \"%s\", \"bytes\": %zu, \"ok\": %s",
+		first ? "" : ",", r->corpus, r->stage, r->in_len, r->ok ? "true" : "false");
+	if (r->ok) {
+		double sorted[MAX_RUNS];
+		memcpy(sorted, r->secs, sizeof(double) * r->runs);
+		qsort(sorted, r->runs, sizeof(double), cmp_double);
+		fprintf(stdout, ", \"out_bytes\": %zu", r->out_len);
+		if (r->out_len)
+			fprintf(stdout, ", \"ratio\": %.6f", (double)r->out_len / (double)r->in_len);
+		else
+			fprintf(stdout, ", \"ratio\": null");
+		fprintf(stdout, ", \"mb_per_sec\": {\"median\": %.3f, \"p10\": %.3f, \"p90\": %.3f, \"min\": %.3f, \"max\": %.3f}",
+			mb_per_sec(r->in_len, percentile(sorted, r->runs, 50)),
+			mb_per_sec(r->in_len, percentile(sorted, r->runs, 90)),
+			mb_per_sec(r->in_len, percentile(sorted, r->runs, 10)),
+			mb_per_sec(r->in_len, sorted[r->runs - 1]),
+			mb_per_sec(r->in_len, sorted[0]));
+	}
+	fprintf(stdout, "}");
+}
+
+/* ─────────────────────────────── stages ──────────────────────────── */
+
+/* Locate the deflate payload inside a gzip member produced by deflate() */
+static int gz_payload(char* gz, size_t gz_len, char** payload, size_t* payload_len) {
+	FILE* f = fmemopen(gz, gz_len, "rb");
+	if (!f) return -1;
+	gz_header_t hdr = {0};
+	int rc = skip_gz_header_to_compressed_data(f, &hdr);
+	long start = ftell(f);
+	fclose(f);
+	if (rc != 0 || start < 0 || (size_t)start + 8 > gz_len) return -1;
+	*payload = gz + start;
+	*payload_len = gz_len - 8 - (size_t)start;
+	return 0;
+}
+
+/**
+ * Times deflate() over a corpus input. The last output is left in gz/gz_len (caller frees).
+ */
+static void bench_deflate(const corpus_t* c, int runs, const char* tmp_path, result_t* r, char** gz, size_t* gz_len) {
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "deflate"; r->in_len = c->len; r->ok = 1;
+	*gz = NULL;
+	*gz_len = 0;
+	for (int i = 0; i < runs && r->ok; i++) {
+		free(*gz);
+		double t0 = now_sec();
+		*gz = deflate((char*)tmp_path, (char*)c->data, c->len, gz_len);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (!*gz) r->ok = 0;
+	}
+	r->out_len = *gz_len;
+}
+
+/**
+ * Times inflate() over the gzip member deflate() produced for a corpus input and checks the result.
+ */
+static void bench_inflate(const corpus_t* c, int runs, char* gz, size_t gz_len, result_t* r) {
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "inflate"; r->in_len = c->len;
+	char* payload = NULL;
+	size_t payload_len = 0;
+	r->ok = gz && gz_payload(gz, gz_len, &payload, &payload_len) == 0;
+	for (int i = 0; i < runs && r->ok; i++) {
+		double t0 = now_sec();
+		char* dec = inflate(payload, payload_len);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (!dec || (c->len && memcmp(dec, c->data, c->len) != 0)) r->ok = 0;
+		free(dec);
+	}
+}
+
+/**
+ * Runs every stage over one corpus input, appending a result per stage.
+ * @return Number of results appended
+ */
+static int bench_corpus(const corpus_t* c, int runs, const char* tmp_path, result_t* out) {
+	int n = 0;
+	FILE* f = fopen(tmp_path, "wb");	// deflate() stats the file for the gzip header
+	if (f) {
+		fwrite(c->data, 1, c->len, f);
+		fclose(f);
+	}
+
+	// deflate
+	char* gz = NULL;
+	size_t gz_len = 0;
+	bench_deflate(c, runs, tmp_path, &out[n++], &gz, &gz_len);
+
+	// inflate
+	bench_inflate(c, runs, gz, gz_len, &out[n++]);
+	free(gz);
+
+	// lz_compress_tokens
+	result_t* r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "lz_compress_tokens"; r->in_len = c->len; r->ok = 1;
+	lz_token_t* tokens = NULL;
+	size_t num_tokens = 0;
+	for (int i = 0; i < runs && r->ok; i++) {
+		free(tokens);
+		double t0 = now_sec();
+		tokens = lz_compress_tokens(c->data, c->len, &num_tokens);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (!tokens) r->ok = 0;
+	}
+
+	// huffman_encode_tokens
+	r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "huffman_encode_tokens"; r->in_len = c->len; r->ok = tokens != NULL;
+	unsigned char* enc = NULL;
+	size_t enc_len = 0;
+	unsigned long bits = 0;
+	unsigned char btype = 0;
+	for (int i = 0; i < runs && r->ok; i++) {
+		free(enc);
+		double t0 = now_sec();
+		enc = huffman_encode_tokens(tokens, num_tokens, &bits, &enc_len, &btype);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (!enc) r->ok = 0;
+	}
+	r->out_len = enc_len;
+	free(tokens);
+
+	// huffman_decode
+	r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "huffman_decode"; r->in_len = c->len; r->ok = enc != NULL;
+	for (int i = 0; i < runs && r->ok; i++) {
+		unsigned long bits_read = 0;
+		size_t dec_len = 0;
+		double t0 = now_sec();
+		unsigned char* dec = huffman_decode(enc, enc_len, btype, &bits_read, &dec_len, NULL, 0);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (!dec || dec_len != c->len || memcmp(dec, c->data, c->len) != 0) r->ok = 0;
+		free(dec);
+	}
+	free(enc);
+
+	// get_crc
+	r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "get_crc"; r->in_len = c->len; r->ok = 1;
+	volatile unsigned int sink = 0;
+	for (int i = 0; i < runs; i++) {
+		double t0 = now_sec();
+		sink ^= get_crc(c->data, c->len);
+		r->secs[r->runs++] = now_sec() - t0;
+	}
+	(void)sink;
+
+	remove(tmp_path);
+	return n;
+}
+
+/* ─────────────────── reference zlib comparison (-z) ─────────────── */
+
+/* libz exports deflate/inflate symbols of its own. It is loaded with RTLD_DEEPBIND
+ * so its compress2/uncompress keep calling libz internals instead of ours. */
+typedef int (*compress2_fn)(unsigned char*, unsigned long*, const unsigned char*, unsigned long, int);
+typedef int (*uncompress_fn)(unsigned char*, unsigned long*, const unsigned char*, unsigned long);
+typedef unsigned long (*compress_bound_fn)(unsigned long);
+
+static struct {
+	void*				handle;
+	compress2_fn		compress2;
+	uncompress_fn		uncompress;
+	compress_bound_fn	compress_bound;
+} libz;
+
+#define NUM_REF_LEVELS 3
+static const int ref_levels[NUM_REF_LEVELS] = { 1, 6, 9 };
+static const char* ref_level_names[NUM_REF_LEVELS] = { "zlib compress2 -1", "zlib compress2 -6", "zlib compress2 -9" };
+#define COMPARE_RESULTS_PER_CORPUS (2 + NUM_REF_LEVELS + 2)
+
+static int load_libz(void) {
+	libz.handle = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+	if (!libz.handle) return -1;
+	libz.compress2 = (compress2_fn)dlsym(libz.handle, "compress2");
+	libz.uncompress = (uncompress_fn)dlsym(libz.handle, "uncompress");
+	libz.compress_bound = (compress_bound_fn)dlsym(libz.handle, "compressBound");
+	if (!libz.compress2 || !libz.uncompress || !libz.compress_bound) {
+		dlclose(libz.handle);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Runs our deflate/inflate, libz compress2 at each reference level, libz
+ * uncompress and the gzip CLI over one corpus input.
+ * @return Number of results appended (COMPARE_RESULTS_PER_CORPUS)
+ */
+static int compare_corpus(const corpus_t* c, int runs, const char* tmp_path, result_t* out) {
+	int n = 0;
+	FILE* f = fopen(tmp_path, "wb");
+	if (f) {
+		fwrite(c->data, 1, c->len, f);
+		fclose(f);
+	}
+
+	char* gz = NULL;
+	size_t gz_len = 0;
+	bench_deflate(c, runs, tmp_path, &out[n++], &gz, &gz_len);
+	bench_inflate(c, runs, gz, gz_len, &out[n++]);
+	free(gz);
+
+	unsigned long bound = libz.compress_bound(c->len);
+	unsigned char* ref = malloc(bound);
+	unsigned long ref_len = 0;
+	for (int l = 0; l < NUM_REF_LEVELS; l++) {
+		result_t* r = &out[n++];
+		memset(r, 0, sizeof(*r));
+		r->corpus = c->name; r->stage = ref_level_names[l]; r->in_len = c->len; r->ok = ref != NULL;
+		for (int i = 0; i < runs && r->ok; i++) {
+			ref_len = bound;
+			double t0 = now_sec();
+			int rc = libz.compress2(ref, &ref_len, c->data, c->len, ref_levels[l]);
+			r->secs[r->runs++] = now_sec() - t0;
+			if (rc != 0) r->ok = 0;
+		}
+		r->out_len = ref_len;
+	}
+
+	// Decompress the strongest level's output
+	result_t* r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "zlib uncompress"; r->in_len = c->len; r->ok = out[n - 2].ok;
+	unsigned char* dec = malloc(c->len ? c->len : 1);
+	if (!dec) r->ok = 0;
+	for (int i = 0; i < runs && r->ok; i++) {
+		unsigned long dec_len = c->len;
+		double t0 = now_sec();
+		int rc = libz.uncompress(dec, &dec_len, ref, ref_len);
+		r->secs[r->runs++] = now_sec() - t0;
+		if (rc != 0 || dec_len != c->len || memcmp(dec, c->data, c->len) != 0) r->ok = 0;
+	}
+	free(dec);
+	free(ref);
+
+	// System gzip, including process start-up, as test_zlib.c uses it
+	r = &out[n++];
+	memset(r, 0, sizeof(*r));
+	r->corpus = c->name; r->stage = "gzip -6 (process)"; r->in_len = c->len; r->ok = 1;
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -c -6 %s > %s.gz", tmp_path, tmp_path);
+	for (int i = 0; i < runs && r->ok; i++) {
+		double t0 = now_sec();
+		if (system(cmd) != 0) r->ok = 0;
+		r->secs[r->runs++] = now_sec() - t0;
+	}
+	snprintf(cmd, sizeof(cmd), "%s.gz", tmp_path);
+	struct stat st;
+	if (stat(cmd, &st) == 0) r->out_len = (size_t)st.st_size;
+	remove(cmd);
+
+	remove(tmp_path);
+	return n;
+}
+
+static double median_mb_per_sec(const result_t* r) {
+	if (!r->ok || r->runs == 0) return 0.0;
+	double sorted[MAX_RUNS];
+	memcpy(sorted, r->secs, sizeof(double) * r->runs);
+	qsort(sorted, r->runs, sizeof(double), cmp_double);
+	return mb_per_sec(r->in_len, percentile(sorted, r->runs, 50));
+}
+
+static double ratio_of(const result_t* r) {
+	return r->ok && r->in_len ? (double)r->out_len / (double)r->in_len : 0.0;
+}
+
+/**
+ * Prints median MB/s and ratio of every implementation side by side, one row
+ * per corpus input. The gap columns are how many times faster zlib -6 is.
+ */
+static void print_compare_table(const result_t* results, int nresults) {
+	fprintf(stdout, "Compression (median MB/s / ratio)\n");
+	fprintf(stdout, "%-18s %17s %17s %17s %17s %17s %8s\n",
+		"corpus", "ours", "zlib -1", "zlib -6", "zlib -9", "gzip -6 (proc)", "gap -6");
+	for (int i = 0; i + COMPARE_RESULTS_PER_CORPUS <= nresults; i += COMPARE_RESULTS_PER_CORPUS) {
+		const result_t* g = results + i;
+		const int cols[] = { 0, 2, 3, 4, 6 };
+		fprintf(stdout, "%-18s", g[0].corpus);
+		for (int k = 0; k < 5; k++) {
+			if (g[cols[k]].ok)
+				fprintf(stdout, " %8.2f / %6.4f", median_mb_per_sec(&g[cols[k]]), ratio_of(&g[cols[k]]));
+			else
+				fprintf(stdout, " %17s", "FAILED");
+		}
+		double ours = median_mb_per_sec(&g[0]);
+		fprintf(stdout, " %7.1fx\n", ours > 0 ? median_mb_per_sec(&g[3]) / ours : 0.0);
+	}
+
+	fprintf(stdout, "\nDecompression (median MB/s)\n");
+	fprintf(stdout, "%-18s %17s %17s %8s\n", "corpus", "ours", "zlib", "gap");
+	for (int i = 0; i + COMPARE_RESULTS_PER_CORPUS <= nresults; i += COMPARE_RESULTS_PER_CORPUS) {
+		const result_t* g = results + i;
+		double ours = median_mb_per_sec(&g[1]);
+		double ref = median_mb_per_sec(&g[5]);
+		fprintf(stdout, "%-18s", g[0].corpus);
+		if (g[1].ok) fprintf(stdout, " %17.2f", ours); else fprintf(stdout, " %17s", "FAILED");
+		if (g[5].ok) fprintf(stdout, " %17.2f", ref); else fprintf(stdout, " %17s", "FAILED");
+		fprintf(stdout, " %7.1fx\n", ours > 0 ? ref / ours : 0.0);
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t size = DEFAULT_SIZE;
+	int runs = DEFAULT_RUNS;
+	int json = 0;
+	int compare = 0;
+	const char* only = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			PRINT_BENCH_USAGE(argv[0]);
+			return 0;
+		}
+		if (strcmp(argv[i], "-s") == 0 && i < argc - 1)
+			size = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0 && i < argc - 1)
+			runs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0 && i < argc - 1)
+			only = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0)
+			json = 1;
+		else if (strcmp(argv[i], "-z") == 0)
+			compare = 1;
+		else {
+			PRINT_BENCH_USAGE(argv[0]);
+			return 1;
+		}
+	}
+	if (runs < 1) runs = 1;
+	if (runs > MAX_RUNS) runs = MAX_RUNS;
+	if (compare && load_libz() != 0) {
+		fprintf(stderr, "Error: could not load libz.so.1 for -z\n");
+		return 1;
+	}
+
+	char tmp_path[64];
+	snprintf(tmp_path, sizeof(tmp_path), "/tmp/zlib_bench_%ld.bin", (long)getpid());
+
+	corpus_t corpus[] = {
+		{ "all_zeros",         make_zeros(size),             size },
+		{ "sequential",        make_sequential(size),        size },
+		{ "pseudo_random",     make_pseudo_random(size),     size },
+		{ "repeating_pattern", make_repeating_pattern(size), size },
+		{ "text",              make_text(size),              size },
+		{ "binary",            make_binary(size),            size },
+		{ "compressed",        make_compressed(size, tmp_path), size },
+	};
+	const int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+
+	result_t* results = calloc((size_t)ncorpus * (compare ? COMPARE_RESULTS_PER_CORPUS : 6), sizeof(result_t));
+	if (!results) return 1;
+	int nresults = 0;
+	for (int i = 0; i < ncorpus; i++) {
+		if (only && strcmp(only, corpus[i].name) != 0) continue;
+		if (!corpus[i].data) {
+			fprintf(stderr, "Error: could not generate corpus %s\n", corpus[i].name);
+			continue;
+		}
+		if (compare)
+			nresults += compare_corpus(&corpus[i], runs, tmp_path, results + nresults);
+		else
+			nresults += bench_corpus(&corpus[i], runs, tmp_path, results + nresults);
+	}
+
+	if (json) {
+		fprintf(stdout, "{\n  \"size\": %zu,\n  \"runs\": %d,\n  \"mode\": \"%s\",\n  \"results\": [",
+			size, runs, compare ? "compare" : "stages");
+		for (int i = 0; i < nresults; i++)
+			print_json_row(&results[i], i == 0);
+		fprintf(stdout, "\n  ]\n}\n");
+	} else if (compare) {
+		print_compare_table(results, nresults);
+	} else {
+		print_table_header();
+		for (int i = 0; i < nresults; i++)
+			print_table_row(&results[i]);
+	}
+
+	int failed = 0;
+	for (int i = 0; i < nresults; i++)
+		if (!results[i].ok) failed = 1;
+	for (int i = 0; i < ncorpus; i++)
+		free(corpus[i].data);
+	free(results);
+	if (libz.handle) dlclose(libz.handle);
+	return failed;
+}
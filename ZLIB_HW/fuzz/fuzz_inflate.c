@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "our_zlib.h"
+#include "ref_zlib.h"
+
+/*
+ * Differential fuzzer for inflate(): every input goes to our decoder and to
+ * libz's raw inflate. Build with `make fuzz`, which adds AddressSanitizer and
+ * UBSan so out-of-bounds reads abort instead of passing silently.
+ *
+ *   bin/zlib_fuzz [-n iters] [-s seed]     mutate libz-made seed streams
+ *   bin/zlib_fuzz file...                  replay inputs (AFL: bin/zlib_fuzz @@)
+ *   bin/zlib_fuzz -w dir                   write the seed corpus for AFL/libFuzzer
+ *
+ * With clang, -DZLIB_FUZZ_LIBFUZZER -fsanitize=fuzzer drops main() and leaves
+ * LLVMFuzzerTestOneInput for libFuzzer.
+ */
+
+#define DEFAULT_ITERS	100000
+#define DEFAULT_SEED	1
+#define MAX_INPUT		(1 << 16)
+
+/* Usage/Help Messages */
+#define PRINT_FUZZ_USAGE(prog_name) do { \
+    fprintf(stdout, "Usage: %s [options] [input_file...]\n", prog_name); \
+    fprintf(stdout, "Options:\n"); \
+    fprintf(stdout, "  -n iters              Mutated inputs to try (default %d)\n", DEFAULT_ITERS); \
+    fprintf(stdout, "  -s seed               PRNG seed, rerun with the same one to reproduce (default %d)\n", DEFAULT_SEED); \
+    fprintf(stdout, "  -w dir                Write the seed corpus to dir and exit\n"); \
+    fprintf(stdout, "  -h                    Print this help message\n"); \
+    fprintf(stdout, "  input_file            Replay these inputs instead of mutating\n"); \
+} while(0)
+
+typedef struct {
+	unsigned long	runs;
+	unsigned long	both_ok;
+	unsigned long	both_rejected;
+	unsigned long	lenient;		// libz rejected, we decoded something
+	unsigned long	mismatches;
+} fuzz_counts_t;
+
+static fuzz_counts_t counts;
+
+/**
+ * Runs one input through both decoders.
+ * @return 0 if they agree (or only we are lenient), 1 on a mismatch
+ */
+static int fuzz_one(const unsigned char* data, size_t size) {
+	// Exact-size copy so the sanitizer sees any read past the end
+	char* in = malloc(size ? size : 1);
+	if (!in) return 0;
+	memcpy(in, data, size);
+
+	size_t ours_len = 0;
+	char* ours = inflate_sized(in, size, &ours_len);
+	unsigned char* ref = NULL;
+	size_t ref_len = 0;
+	int ref_ok = ref_inflate_raw(data, size, &ref, &ref_len) == 0;
+
+	int mismatch = 0;
+	counts.runs++;
+	if (ref_ok && !ours) {
+		fprintf(stderr, "mismatch: libz decoded %zu bytes, inflate rejected the stream\n", ref_len);
+		mismatch = 1;
+	} else if (ref_ok && (ours_len != ref_len || memcmp(ours, ref, ref_len) != 0)) {
+		fprintf(stderr, "mismatch: libz decoded %zu bytes, inflate %zu bytes of different data\n", ref_len, ours_len);
+		mismatch = 1;
+	} else if (ref_ok) {
+		counts.both_ok++;
+	} else if (ours) {
+		counts.lenient++;
+	} else {
+		counts.both_rejected++;
+	}
+	counts.mismatches += mismatch;
+
+	free(ours);
+	free(ref);
+	free(in);
+	return mismatch;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	static int loaded = 0;
+	if (!loaded) {
+		if (ref_zlib_load() != 0) abort();
+		loaded = 1;
+	}
+	if (fuzz_one(data, size)) abort();
+	return 0;
+}
+
+#ifndef ZLIB_FUZZ_LIBFUZZER
+
+/* ────────────────────────── seed corpus ─────────────────────────── */
+
+typedef struct {
+	unsigned char*	data;
+	size_t			len;
+} buf_t;
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t rng_below(size_t n) {
+	return n ? (size_t)(rng_next() % n) : 0;
+}
+
+/* Plain inputs of every flavor the encoder treats differently */
+static unsigned char* make_plain(int kind, size_t len) {
+	static const char* words[] = { "the ", "deflate ", "stream ", "window ", "of ", "gzip ", "member\n" };
+	unsigned char* p = malloc(len ? len : 1);
+	if (!p) return NULL;
+	for (size_t i = 0; i < len; i++) {
+		switch (kind) {
+			case 0: p[i] = 0; break;
+			case 1: p[i] = (unsigned char)i; break;
+			case 2: p[i] = (unsigned char)rng_next(); break;
+			default: {
+				const char* w = words[(i / 7) % 7];
+				p[i] = (unsigned char)w[i % strlen(w)];
+				break;
+			}
+		}
+	}
+	return p;
+}
+
+/**
+ * Compresses every plain input with libz at levels 0 (stored), 1, 6 and 9,
+ * covering stored, fixed and dynamic blocks and multi-block streams.
+ * @return Number of seeds in *seeds (caller frees)
+ */
+static size_t make_seeds(buf_t** seeds) {
+	static const size_t sizes[] = { 0, 1, 17, 300, 5000, 70000 };
+	static const int levels[] = { 0, 1, 6, 9 };
+	size_t cap = 4 * 6 * 4, n = 0;
+	*seeds = calloc(cap, sizeof(buf_t));
+	if (!*seeds) return 0;
+	for (int kind = 0; kind < 4; kind++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			unsigned char* plain = make_plain(kind, sizes[s]);
+			if (!plain) continue;
+			for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+				buf_t* b = &(*seeds)[n];
+				if (ref_deflate_raw(plain, sizes[s], levels[l], &b->data, &b->len) == 0) n++;
+			}
+			free(plain);
+		}
+	}
+	return n;
+}
+
+/**
+ * Applies one to four random edits: bit flips, byte overwrites, truncation,
+ * chunk duplication and random insertions. One input in 16 is pure noise.
+ */
+static size_t mutate(const buf_t* seed, unsigned char* out) {
+	if (rng_below(16) == 0) {
+		size_t len = rng_below(512);
+		for (size_t i = 0; i < len; i++) out[i] = (unsigned char)rng_next();
+		return len;
+	}
+	size_t len = seed->len < MAX_INPUT ? seed->len : MAX_INPUT;
+	memcpy(out, seed->data, len);
+	int edits = 1 + (int)rng_below(4);
+	for (int e = 0; e < edits && len > 0; e++) {
+		size_t at = rng_below(len);
+		switch (rng_below(5)) {
+			case 0: out[at] ^= (unsigned char)(1u << rng_below(8)); break;
+			case 1: out[at] = (unsigned char)rng_next(); break;
+			case 2: len = at; break;
+			case 3: {
+				unsigned char chunk[64];
+				size_t from = rng_below(len);
+				size_t n = rng_below(sizeof(chunk));
+				if (n > len - from) n = len - from;
+				if (n > MAX_INPUT - len) n = MAX_INPUT - len;
+				memcpy(chunk, out + from, n);
+				memmove(out + at + n, out + at, len - at);
+				memcpy(out + at, chunk, n);
+				len += n;
+				break;
+			}
+			default: {
+				size_t n = 1 + rng_below(8);
+				if (n > MAX_INPUT - len) n = MAX_INPUT - len;
+				memmove(out + at + n, out + at, len - at);
+				for (size_t i = 0; i < n; i++) out[at + i] = (unsigned char)rng_next();
+				len += n;
+				break;
+			}
+		}
+	}
+	return len;
+}
+
+static int write_seeds(const char* dir, const buf_t* seeds, size_t num_seeds) {
+	char path[4096];
+	for (size_t i = 0; i < num_seeds; i++) {
+		snprintf(path, sizeof(path), "%s/seed_%03zu.deflate", dir, i);
+		FILE* f = fopen(path, "wb");
+		if (!f) {
+			fprintf(stderr, "Error: Failed to open file %s\n", path);
+			return 1;
+		}
+		fwrite(seeds[i].data, 1, seeds[i].len, f);
+		fclose(f);
+	}
+	fprintf(stdout, "Wrote %zu seeds to %s\n", num_seeds, dir);
+	return 0;
+}
+
+static int replay_file(const char* path) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Error: Failed to open file %s\n", path);
+		return 1;
+	}
+	unsigned char* buf = malloc(MAX_INPUT);
+	size_t len = buf ? fread(buf, 1, MAX_INPUT, f) : 0;
+	fclose(f);
+	int mismatch = buf ? fuzz_one(buf, len) : 1;
+	if (mismatch) fprintf(stderr, "  in %s\n", path);
+	free(buf);
+	return mismatch;
+}
+
+int main(int argc, char** argv) {
+	unsigned long iters = DEFAULT_ITERS;
+	uint64_t seed = DEFAULT_SEED;
+	const char* seed_dir = NULL;
+	int num_files = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			PRINT_FUZZ_USAGE(argv[0]);
+			return 0;
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i < argc - 1)
+			iters = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-s") == 0 && i < argc - 1)
+			seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-w") == 0 && i < argc - 1)
+			seed_dir = argv[++i];
+		else if (argv[i][0] == '-') {
+			PRINT_FUZZ_USAGE(argv[0]);
+			return 1;
+		}
+		else
+			num_files++;
+	}
+
+	if (ref_zlib_load() != 0) {
+		fprintf(stderr, "Error: could not load libz.so.1\n");
+		return 1;
+	}
+	rng_state = seed ? seed : DEFAULT_SEED;
+
+	int failed = 0;
+	if (num_files > 0) {
+		for (int i = 1; i < argc; i++) {
+			if (argv[i][0] == '-') { i++; continue; }  // every option takes a value
+			failed |= replay_file(argv[i]);
+		}
+	} else {
+		buf_t* seeds = NULL;
+		size_t num_seeds = make_seeds(&seeds);
+		if (num_seeds == 0) {
+			fprintf(stderr, "Error: could not build seed corpus\n");
+			ref_zlib_unload();
+			return 1;
+		}
+		if (seed_dir) {
+			failed = write_seeds(seed_dir, seeds, num_seeds);
+		} else {
+			unsigned char* buf = malloc(MAX_INPUT);
+			for (size_t i = 0; buf && i < num_seeds; i++)
+				failed |= fuzz_one(seeds[i].data, seeds[i].len);
+			for (unsigned long it = 0; buf && it < iters; it++) {
+				size_t len = mutate(&seeds[rng_below(num_seeds)], buf);
+				if (fuzz_one(buf, len)) {
+					fprintf(stderr, "  at iteration %lu (-s %llu)\n", it, (unsigned long long)seed);
+					failed = 1;
+				}
+			}
+			free(buf);
+		}
+		for (size_t i = 0; i < num_seeds; i++) free(seeds[i].data);
+		free(seeds);
+	}
+
+	if (!seed_dir)
+		fprintf(stdout, "runs: %lu, both decoded: %lu, both rejected: %lu, only ours decoded: %lu, mismatches: %lu\n",
+			counts.runs, counts.both_ok, counts.both_rejected, counts.lenient, counts.mismatches);
+	ref_zlib_unload();
+	return failed;
+}
+
+#endif /* ZLIB_FUZZ_LIBFUZZER */
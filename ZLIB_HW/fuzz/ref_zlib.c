@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <zlib.h>
+#include "ref_zlib.h"
+
+/* Our deflate()/inflate() are global symbols of the executable, so plain calls
+ * to libz's would bind to ours. dlsym on the libz handle returns libz's own. */
+typedef int (*inflate_init2_fn)(z_streamp, int, const char*, int);
+typedef int (*deflate_init2_fn)(z_streamp, int, int, int, int, int, const char*, int);
+typedef int (*stream_fn)(z_streamp, int);
+typedef int (*stream_end_fn)(z_streamp);
+
+static struct {
+	void*				handle;
+	inflate_init2_fn	inflate_init2;
+	stream_fn			inflate;
+	stream_end_fn		inflate_end;
+	deflate_init2_fn	deflate_init2;
+	stream_fn			deflate;
+	stream_end_fn		deflate_end;
+} libz;
+
+int ref_zlib_load(void) {
+	libz.handle = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+	if (!libz.handle) return -1;
+	libz.inflate_init2 = (inflate_init2_fn)dlsym(libz.handle, "inflateInit2_");
+	libz.inflate = (stream_fn)dlsym(libz.handle, "inflate");
+	libz.inflate_end = (stream_end_fn)dlsym(libz.handle, "inflateEnd");
+	libz.deflate_init2 = (deflate_init2_fn)dlsym(libz.handle, "deflateInit2_");
+	libz.deflate = (stream_fn)dlsym(libz.handle, "deflate");
+	libz.deflate_end = (stream_end_fn)dlsym(libz.handle, "deflateEnd");
+	if (!libz.inflate_init2 || !libz.inflate || !libz.inflate_end ||
+		!libz.deflate_init2 || !libz.deflate || !libz.deflate_end) {
+		ref_zlib_unload();
+		return -1;
+	}
+	return 0;
+}
+
+void ref_zlib_unload(void) {
+	if (libz.handle) dlclose(libz.handle);
+	memset(&libz, 0, sizeof(libz));
+}
+
+int ref_inflate_raw(const unsigned char* in, size_t in_len, unsigned char** out, size_t* out_len) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	*out = NULL;
+	*out_len = 0;
+	if (libz.inflate_init2(&strm, -MAX_WBITS, ZLIB_VERSION, (int)sizeof(z_stream)) != Z_OK) return -1;
+
+	size_t cap = in_len * 4 + 64;
+	unsigned char* buf = malloc(cap);
+	if (!buf) { libz.inflate_end(&strm); return -1; }
+	strm.next_in = (Bytef*)in;
+	strm.avail_in = (uInt)in_len;
+
+	int rc;
+	do {
+		if (strm.total_out == cap) {
+			unsigned char* tmp = realloc(buf, cap * 2);
+			if (!tmp) break;
+			buf = tmp;
+			cap *= 2;
+		}
+		strm.next_out = buf + strm.total_out;
+		strm.avail_out = (uInt)(cap - strm.total_out);
+		rc = libz.inflate(&strm, Z_NO_FLUSH);
+	} while (rc == Z_OK);
+
+	*out = buf;
+	*out_len = strm.total_out;
+	libz.inflate_end(&strm);
+	return rc == Z_STREAM_END ? 0 : -1;
+}
+
+int ref_deflate_raw(const unsigned char* in, size_t in_len, int level, unsigned char** out, size_t* out_len) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	*out = NULL;
+	*out_len = 0;
+	if (libz.deflate_init2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY,
+			ZLIB_VERSION, (int)sizeof(z_stream)) != Z_OK)
+		return -1;
+
+	// Stored blocks cost 5 bytes per 16 KB at worst
+	size_t cap = in_len + in_len / 1000 + 64;
+	unsigned char* buf = malloc(cap);
+	if (!buf) { libz.deflate_end(&strm); return -1; }
+	strm.next_in = (Bytef*)in;
+	strm.avail_in = (uInt)in_len;
+	strm.next_out = buf;
+	strm.avail_out = (uInt)cap;
+	int rc = libz.deflate(&strm, Z_FINISH);
+	libz.deflate_end(&strm);
+	if (rc != Z_STREAM_END) { free(buf); return -1; }
+	*out = buf;
+	*out_len = strm.total_out;
+	return 0;
+}
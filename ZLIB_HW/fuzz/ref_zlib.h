@@ -0,0 +1,23 @@
+#ifndef REF_ZLIB_H
+#define REF_ZLIB_H
+
+#include <stddef.h>
+
+/* Raw DEFLATE (no zlib/gzip wrapper) through the system libz. Kept in its own
+ * translation unit because zlib.h and our_zlib.h both declare inflate/deflate. */
+
+int ref_zlib_load(void);
+void ref_zlib_unload(void);
+
+/**
+ * @return 0 if the stream reached its final block, -1 if libz rejected it
+ * Output is malloc'd in *out (caller frees, also set on error).
+ */
+int ref_inflate_raw(const unsigned char* in, size_t in_len, unsigned char** out, size_t* out_len);
+
+/**
+ * @return 0 on success, -1 on error
+ */
+int ref_deflate_raw(const unsigned char* in, size_t in_len, int level, unsigned char** out, size_t* out_len);
+
+#endif /* REF_ZLIB_H */
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+/* Files at least this large are compressed one at a time with every thread
+ * working on their blocks, so they cannot straggle behind the small ones */
+#define BATCH_SPLIT_SIZE (16 * 65535L)
+
+/**
+ * Prints the member summary of a .gz file (M_INFO, -m) or a validity line per
+ * member (M_TEST, -t). A summary only walks the member headers and block
+ * boundaries unless check_crc is set. Checking decodes each member through a
+ * 32 KB window against its trailer (CRC32, ISIZE and HCRC), so memory use
+ * does not depend on the file size and nothing is written.
+ * @param check_crc: With M_INFO, also check and print each member's CRC
+ * @return 0 if every checked member is valid, 1 if one is not, 2 if a
+ *         member is truncated or malformed, -1 if the file does not start
+ *         with a member
+ */
+int check_members(const char* path, int mode, int check_crc);
+
+/**
+ * Compresses (M_DEFLATE, writing <name>.gz), decompresses (M_INFLATE, .gz
+ * inputs only, writing <name> without the suffix), or summarizes (M_INFO) or
+ * verifies (M_TEST) .gz inputs in path order, for many files in one process.
+ * @param paths: Files or directories (their regular files, not recursive)
+ * @param num_paths: Number of entries in paths
+ * @param list_file: File with one path per line ("-" for stdin), or NULL
+ * @param mode: M_DEFLATE, M_INFLATE, M_INFO or M_TEST
+ * @param check_crc: With M_INFO, decode members to check their CRC too
+ * @param threads: Worker threads, 0 for one per online CPU
+ * @return Number of files that failed, or -1 if the batch could not start
+ */
+int batch_run(char** paths, int num_paths, const char* list_file, int mode, int check_crc, int threads);
+
+#endif /* BATCH_H */
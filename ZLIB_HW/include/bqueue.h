@@ -0,0 +1,28 @@
+#ifndef BQUEUE_H
+#define BQUEUE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* Bounded FIFO of pointers shared between threads. Producers block while it
+ * is full, consumers block while it is empty, and closing it wakes everyone. */
+typedef struct {
+	void**			items;
+	size_t			cap;
+	size_t			head;
+	size_t			count;
+	int				closed;
+	pthread_mutex_t	lock;
+	pthread_cond_t	not_empty;
+	pthread_cond_t	not_full;
+} bqueue_t;
+
+int bqueue_init(bqueue_t* q, size_t cap);
+void bqueue_destroy(bqueue_t* q);
+/* Returns 0, or -1 if the queue was closed (item not added) */
+int bqueue_push(bqueue_t* q, void* item);
+/* Returns the oldest item, or NULL once the queue is closed and drained */
+void* bqueue_pop(bqueue_t* q);
+void bqueue_close(bqueue_t* q);
+
+#endif /* BQUEUE_H */
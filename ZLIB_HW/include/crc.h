@@ -6,5 +6,9 @@
 
 /* Compute CRC over chunk type + data */
 unsigned int get_crc(const unsigned char *buf, size_t len);
+/* Extend a finished CRC over more data, starting from 0 */
+unsigned int crc_update(unsigned int crc, const unsigned char *buf, size_t len);
+/* CRC of a + b from get_crc(a), get_crc(b) and the length of b */
+unsigned int crc_combine(unsigned int crc1, unsigned int crc2, size_t len2);
 
 #endif
@@ -7,29 +7,50 @@
 /* Usage/Help Messages */
 #define PRINT_USAGE(prog_name) do { \
     fprintf(stdout, "Usage: %s -i gz_file [options]\n", prog_name); \
+    fprintf(stdout, "       %s -b -c|-d|-m [-C]|-t [-j threads] [-l list_file] [path...]\n", prog_name); \
     fprintf(stdout, "Options:\n"); \
     fprintf(stdout, "  -i gz_file            Input GZ file (required)\n"); \
     fprintf(stdout, "  -h                    Print this help message\n"); \
-    fprintf(stdout, "  -m                    Print member summary\n"); \
+    fprintf(stdout, "  -m                    Print member summary from the headers, without decoding\n"); \
+    fprintf(stdout, "  -C                    With -m, decode every member and show whether its CRC is valid\n"); \
+    fprintf(stdout, "  -t                    Test every member's CRC and size without writing output\n"); \
     fprintf(stdout, "  -c                    Compress the file\n"); \
     fprintf(stdout, "  -d                    Decompress the file\n"); \
     fprintf(stdout, "  -o out_file           Output file for -c or -d (required for compress/decompress)\n"); \
+    fprintf(stdout, "  -v                    Print stage timings and counters to stderr (make stats build)\n"); \
+    fprintf(stdout, "  -j threads            Compression threads for -c (default: one per CPU)\n"); \
+    fprintf(stdout, "  -b                    Batch mode: -c writes <path>.gz, -d turns <path>.gz into <path>, -m/-t list/test .gz files\n"); \
+    fprintf(stdout, "  -l list_file          Batch inputs, one file or directory per line (- for stdin)\n"); \
+    fprintf(stdout, "  path...               Batch inputs: files, or directories (not recursive)\n"); \
 } while(0)
 
 /* Error Messages */
 #define PRINT_ERROR_BAD_HEADER() fprintf(stderr, "Error: Missing .gz file ID\n")
 #define PRINT_ERROR_OPEN_FILE(filename) fprintf(stderr, "Error: Failed to open file %s\n", filename)
 #define PRINT_ERROR_MISSING_I_FLAG() fprintf(stderr, "Error: -i with input file is required\n")
-#define PRINT_ERROR_REQUIRE_ONE_OF_MCD() fprintf(stderr, "Error: exactly one of -m, -c, or -d is required\n")
+#define PRINT_ERROR_REQUIRE_ONE_OF_MCD() fprintf(stderr, "Error: exactly one of -m, -t, -c, or -d is required\n")
 #define PRINT_ERROR_MISSING_O_FLAG() fprintf(stderr, "Error: -o with output file is required for -c and -d\n")
+#define PRINT_ERROR_COMPRESS(filename) fprintf(stderr, "Error: Failed to compress %s\n", filename)
+#define PRINT_ERROR_DECOMPRESS(filename) fprintf(stderr, "Error: Failed to decompress %s\n", filename)
+#define PRINT_ERROR_BAD_MEMBER(filename) fprintf(stderr, "Error: %s is not a valid .gz file or has corrupt members\n", filename)
+#define PRINT_ERROR_BATCH_MODE() fprintf(stderr, "Error: -b requires -c, -d, -m or -t\n")
+#define PRINT_ERROR_BATCH_INPUTS() fprintf(stderr, "Error: -b requires input paths or -l list_file\n")
+
+/* Batch mode */
+#define PRINT_BATCH_SUMMARY(total, failed) fprintf(stdout, "Batch: %zu files, %d failed\n", (size_t)(total), (int)(failed))
 
 /* Member Summary (gzip) */
 #define PRINT_MEMBER_SUMMARY_HEADER(filename) fprintf(stdout, "Member Summary for %s:\n", (filename))
 #define PRINT_MEMBER_LINE(member_label, cm, mtime, os, extra, comment, size, crc_valid) do { \
     fprintf(stdout, "  Member %s: Compression Method: %u, Last Modified: %u, OS: %u, Extra: %u, ", (member_label), (unsigned)(cm), (unsigned)(mtime), (unsigned)(os), (unsigned)(extra)); \
     if ((comment) && (comment)[0]) fprintf(stdout, "Comment: %s, ", (comment)); \
-    fprintf(stdout, "Size: %u, CRC: %s\n", (unsigned)(size), (crc_valid) ? "valid" : "invalid"); \
+    fprintf(stdout, "Size: %u", (unsigned)(size)); \
+    if ((crc_valid) >= 0) fprintf(stdout, ", CRC: %s", (crc_valid) ? "valid" : "invalid"); \
+    fprintf(stdout, "\n"); \
 } while(0)
 
+/* Test mode (-t) */
+#define PRINT_TEST_MEMBER(filename, member_label, valid) \
+    fprintf(stdout, "%s: member %s: %s\n", (filename), (member_label), (valid) ? "OK" : "FAILED")
 
 #endif /* GLOBAL_H */
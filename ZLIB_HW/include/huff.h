@@ -10,6 +10,96 @@
  * Pass NULL/0 for single-block or standalone decode. */
 unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigned int btype_val, unsigned long*bits_read, size_t* out_len, const unsigned char* history, size_t history_len);
 
+/* Sliding window for decoding without keeping the output: the last 32 KB a
+ * match can reach, plus bytes not yet folded into the CRC */
+#define HUFF_WINDOW_SIZE 32768
+#define HUFF_RING_SIZE (2 * HUFF_WINDOW_SIZE)
+typedef struct huff_window {
+    unsigned char ring[HUFF_RING_SIZE];
+    size_t pos;                                       /* bytes decoded so far */
+    size_t checked;                                   /* bytes already in crc */
+    unsigned int crc;
+} huff_window_t;
+
+/* Append decoded bytes (a stored block) to the window. */
+void huff_window_write(huff_window_t* window, const unsigned char* buf, size_t len);
+/* Fold every byte still pending into window->crc. */
+void huff_window_flush(huff_window_t* window);
+
+/* Walk one block like huffman_decode without keeping its output; *out_len gets
+ * its decoded length. produced: bytes decoded before it in the member. With a
+ * window the block is also decoded into it, NULL only checks and counts.
+ * Returns 0 on success, -1 on a truncated or malformed block. */
+int huffman_skip_block(const unsigned char* data, size_t enc_len, unsigned int btype_val, unsigned long* bits_read, size_t produced, size_t* out_len, huff_window_t* window);
+
+#define HUFF_NUM_CODE_LENGTH_CODES 19
+/* Most code lengths a dynamic header describes (HLIT + HDIST at their maximum) */
+#define HUFF_MAX_HEADER_LENS (LZ_NUM_LITLEN_SYMS + LZ_NUM_DIST_SYMS)
+
+/* One code-length symbol of a dynamic header: 0-15, or 16/17/18 with its repeat extra bits */
+#define HUFF_CL_ENTRY(sym, extra)   ((unsigned short)((sym) | (extra) << 5))
+#define HUFF_CL_SYM(entry)          ((entry) & 0x1f)
+#define HUFF_CL_EXTRA(entry)        ((entry) >> 5)
+
+/* Codes chosen for one block, plus its encoded size (without the 3-bit BFINAL/BTYPE) */
+typedef struct {
+    unsigned char btype;                              /* BT_STATIC or BT_DYNAMIC */
+    unsigned long bits;
+    unsigned long lit_codes[LZ_NUM_LITLEN_SYMS];
+    unsigned char lit_lens[LZ_NUM_LITLEN_SYMS];
+    unsigned long dist_codes[LZ_NUM_DIST_SYMS];
+    unsigned char dist_lens[LZ_NUM_DIST_SYMS];
+    unsigned int hlit, hdist, hclen;                  /* dynamic header fields */
+    unsigned long cl_codes[HUFF_NUM_CODE_LENGTH_CODES];
+    unsigned char cl_lens[HUFF_NUM_CODE_LENGTH_CODES];
+    unsigned short cl_seq[HUFF_MAX_HEADER_LENS];      /* run-length coded lit/dist lengths */
+    unsigned int cl_seq_len;
+} huff_plan_t;
+
+/* Bits of the dynamic header (HLIT/HDIST/HCLEN, code-length code and the
+ * run-length coded lengths) that would describe these codes, without writing
+ * it. Returns 0 if no valid header exists for them. */
+unsigned long huffman_header_bits(const unsigned char* lit_lens, const unsigned char* dist_lens);
+
+/* Pick fixed or dynamic codes for a block from its histogram. Returns 0 on success. */
+int huffman_plan_block(const lz_hist_t* hist, huff_plan_t* plan);
+
+/* Write a planned block body at *bit_pos in out (zeroed, room for plan->bits more bits). */
+void huffman_emit_block(const huff_plan_t* plan, const lz_packed_t* tokens, size_t num_tokens, unsigned char* out, unsigned long* bit_pos);
+
+/* Most input chunks merged into one block, bounding the tokens kept back */
+#define HUFF_GROUP_MAX_CHUNKS 8
+/* A chunk keeps the open block's codes while they cost it at most
+ * 1/HUFF_GROUP_REUSE_SLACK more than a block of its own */
+#define HUFF_GROUP_REUSE_SLACK 64
+
+/* The block still being built: chunks coded with the codes planned for the
+ * first of them, because that is about as small as coding them apart */
+typedef struct {
+    lz_packed_t* tokens;
+    size_t num_tokens;
+    size_t cap;                                       /* in tokens */
+    size_t in_len;                                    /* input bytes covered */
+    unsigned int chunks;
+    huff_plan_t plan;                                 /* codes of the block, bits of all its chunks */
+    unsigned long reuse_bits;                         /* cost of the chunk offered last under plan */
+} huff_group_t;
+
+/* chunk_tokens: most tokens one chunk can produce. Returns 0 on success. */
+int huff_group_init(huff_group_t* group, size_t chunk_tokens);
+void huff_group_free(huff_group_t* group);
+/* Costs the chunk under the open block's codes; returns 1 if the chunk joins
+ * the open block, 0 if the open block must be emitted first. */
+int huff_group_fits(huff_group_t* group, const lz_hist_t* hist, const huff_plan_t* chunk_plan);
+/* Adds a chunk after huff_group_fits (and huff_group_emit when it returned 0). */
+void huff_group_append(huff_group_t* group, const lz_packed_t* tokens, size_t num_tokens, const huff_plan_t* chunk_plan, size_t in_len);
+/* Writes BFINAL/BTYPE and the open block at *bit_pos in zeroed out (room for
+ * 3 + group->plan.bits bits), then empties the group. */
+void huff_group_emit(huff_group_t* group, int is_last, unsigned char* out, unsigned long* bit_pos);
+
 unsigned char* huffman_encode_tokens(const lz_token_t* tokens, size_t num_tokens, unsigned long* bits_written, size_t* out_len, unsigned char *returned_btype);
 
+/* Same as huffman_encode_tokens for packed (4-byte) tokens; no conversion pass. */
+unsigned char* huffman_encode_packed(const lz_packed_t* tokens, size_t num_tokens, unsigned long* bits_written, size_t* out_len, unsigned char *returned_btype);
+
 #endif
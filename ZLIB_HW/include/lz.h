@@ -2,6 +2,7 @@
 #define LZ_H
 
 #include <stddef.h>
+#include <stdint.h>
 #define LITLENGTH_BITS 9
 #define DISTANCE_BITS 5
 
@@ -12,8 +13,54 @@ typedef struct {
     unsigned int distance;
 } lz_token_t;
 
+/* Packed 4-byte token, 16 of them fit in a cache line:
+ *   literal: bit 31 clear, bits 0-7 hold the byte
+ *   match:   bit 31 set, bits 15-22 hold length - 3, bits 0-14 hold distance - 1 */
+typedef uint32_t lz_packed_t;
+
+#define LZ_PACKED_MATCH_FLAG  0x80000000u
+#define LZ_PACKED_DIST_BITS   15
+#define LZ_PACKED_LEN_BASE    3
+
+#define LZ_PACK_LITERAL(c)          ((lz_packed_t)(unsigned char)(c))
+#define LZ_PACK_MATCH(len, dist)    (LZ_PACKED_MATCH_FLAG | \
+                                     ((lz_packed_t)((len) - LZ_PACKED_LEN_BASE) << LZ_PACKED_DIST_BITS) | \
+                                     (lz_packed_t)((dist) - 1))
+#define LZ_PACKED_IS_LITERAL(t)     (((t) & LZ_PACKED_MATCH_FLAG) == 0)
+#define LZ_PACKED_LITERAL(t)        ((unsigned char)((t) & 0xFF))
+#define LZ_PACKED_LENGTH(t)         ((((t) >> LZ_PACKED_DIST_BITS) & 0xFF) + LZ_PACKED_LEN_BASE)
+#define LZ_PACKED_DISTANCE(t)       (((t) & ((1u << LZ_PACKED_DIST_BITS) - 1)) + 1)
+
+#define LZ_NUM_LITLEN_SYMS    288
+#define LZ_NUM_DIST_SYMS      30
+
+/* Per-block symbol histogram gathered while tokenizing */
+typedef struct {
+    unsigned int lit_freq[LZ_NUM_LITLEN_SYMS];   /* literals 0-255, EOB 256, lengths 257-285 */
+    unsigned int dist_freq[LZ_NUM_DIST_SYMS];
+} lz_hist_t;
+
+/* DEFLATE code index for a match length (0-28, symbol = 257 + index) and distance (0-29) */
+int lz_length_code(unsigned int length);
+int lz_distance_code(unsigned int distance);
+
+/* Length of the common prefix of a and b, at most max_len bytes.
+ * Compares 8/16/32 bytes per step depending on the CPU. */
+size_t lz_match_length(const unsigned char* a, const unsigned char* b, size_t max_len);
+
 lz_token_t* lz_compress_tokens(const unsigned char* data, size_t len, size_t* num_tokens);
 
+/* Same as lz_compress_tokens but emits packed tokens (4 bytes each). */
+lz_packed_t* lz_compress_packed(const unsigned char* data, size_t len, size_t* num_tokens);
+
+/* Tokenize one block into tokens (room for len entries), adding symbol counts to hist
+ * (may be NULL) on the fly. Returns the number of tokens written. */
+size_t lz_compress_block(const unsigned char* data, size_t len, lz_packed_t* tokens, lz_hist_t* hist);
+
+/* Conversion layer between the packed and wide token layouts. Both return malloc'd arrays. */
+lz_token_t* lz_unpack_tokens(const lz_packed_t* packed, size_t num_tokens);
+lz_packed_t* lz_pack_tokens(const lz_token_t* tokens, size_t num_tokens);
+
 unsigned char * lz_to_length_distance_codes(unsigned char *data, size_t len, size_t *out_len);
 
 #endif
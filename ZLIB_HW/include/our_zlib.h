@@ -5,6 +5,7 @@
 #define M_DEFLATE	0
 #define M_INFLATE	1
 #define M_INFO		2
+#define M_TEST		3
 
 // compressed block header
 #define BF_SET				1
@@ -63,9 +64,31 @@ typedef struct {
 } gz_header_t;
 
 #define ID 0x1f8b
+/* Results of parse_member and verify_member */
+#define MEMBER_OK			0
+#define MEMBER_NO_HEADER	1	// no gzip member starts at the file pointer
+#define MEMBER_BAD_DATA		2	// the header was read, its blocks or trailer are truncated or malformed
+
+/* Reads a member's header and trailer, leaving file at the start of the next member. */
 int parse_member(FILE* file, gz_header_t* header);
+/* parse_member that also decodes through a 32 KB window and sets *crc_valid from CRC32 and ISIZE. */
+int verify_member(FILE* file, gz_header_t* header, int* crc_valid);
+/* Parses a member header from memory; returns its length, or 0 if buf holds no complete header. */
+size_t parse_member_header(const unsigned char* buf, size_t len, gz_header_t* header);
+/* Length in bytes of the DEFLATE stream at bytes, found without keeping its output; 0 if malformed.
+ * A non-NULL window (huff_window_t) is fed the decoded data. */
+struct huff_window;
+size_t skip_deflate_stream(const unsigned char* bytes, size_t comp_len, size_t* dec_len, struct huff_window* window);
 int skip_gz_header_to_compressed_data(FILE* file, gz_header_t* header);
 /* Inflate: decompress. bytes = compressed data, comp_len = its length. Returns malloc'd decompressed buffer, length in header->full_size or first 4 bytes of format. */
 char* inflate(char* bytes, size_t comp_len);
+/* Inflate that also reports the decompressed length; NULL on truncated or malformed input. */
+char* inflate_sized(char* bytes, size_t comp_len, size_t* dec_len);
+/* inflate_sized that also computes the CRC32 of the output, block by block. */
+char* inflate_crc(char* bytes, size_t comp_len, size_t* dec_len, unsigned int* crc);
+/* Decompresses the first member of a .gz file to out_path, checking CRC32 and ISIZE; 0 on success, -1 on error. */
+int inflate_file(const char* in_path, const char* out_path);
 /* Deflate: compress. bytes = input, len = input length. Returns malloc'd compressed buffer. */
-char* deflate(char* filename, char* bytes, size_t len, size_t* out_len);
\ No newline at end of file
+char* deflate(char* filename, char* bytes, size_t len, size_t* out_len);
+/* Writes the gzip member header deflate() produces into buffer; returns its length. */
+size_t fill_member_header(char* buffer, const char* fname, unsigned int mtime);
\ No newline at end of file
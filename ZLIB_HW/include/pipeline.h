@@ -0,0 +1,49 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include "lz.h"
+#include "huff.h"
+
+/* Jobs in flight per compression thread; bounds memory to about
+ * (PIPELINE_JOBS_PER_WORKER * workers + 2) * 5 * DEFLATE_BLOCK_SIZE bytes
+ * (input and tokens), plus the writer's block group */
+#define PIPELINE_JOBS_PER_WORKER 2
+
+/**
+ * Compresses in into a single gzip member written to out. A reader thread,
+ * `workers` compression threads and the calling thread (writer) are connected
+ * by bounded queues, so reading, compressing and writing overlap.
+ * The member is byte-identical to what deflate() produces for the same data.
+ * @param workers: Compression threads, 0 for one per online CPU
+ * @return 0 on success, -1 on error
+ */
+int deflate_stream_pipelined(FILE* in, FILE* out, const char* name, unsigned int mtime, int workers);
+
+/* deflate_stream_pipelined on a path, storing its name and modification time */
+int deflate_file_pipelined(const char* in_path, const char* out_path, int workers);
+
+/* Largest block (BTYPE header to end-of-block) len input bytes can turn into:
+ * a dynamic block is only used when smaller than the fixed one, and fixed
+ * codes spend at most 9 bits per input byte plus the header and end-of-block */
+#define DEFLATE_BLOCK_BOUND(len) (((size_t)(len) * 9 + 3 + 7 + 7) / 8 + 1)
+
+/* Buffers for compressing files one after another on a single thread */
+typedef struct {
+	lz_packed_t*	tokens;
+	unsigned char*	in[2];		// current chunk and the lookahead
+	unsigned char*	out;		// room for a block of HUFF_GROUP_MAX_CHUNKS chunks
+	huff_group_t	group;
+} deflate_ctx_t;
+
+int deflate_ctx_init(deflate_ctx_t* ctx);
+void deflate_ctx_free(deflate_ctx_t* ctx);
+
+/**
+ * Same member as deflate_stream_pipelined, produced on the calling thread
+ * with ctx's buffers, so many small files cost no thread or allocation setup.
+ * @return 0 on success, -1 on error
+ */
+int deflate_stream_ctx(deflate_ctx_t* ctx, FILE* in, FILE* out, const char* name, unsigned int mtime);
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,70 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Stages that get wall-clock (and, on x86, TSC cycle) totals */
+typedef enum {
+	ZSTAT_LZ_SEARCH,		// lz_compress_block
+	ZSTAT_HUFF_PLAN,		// tree building and block type choice
+	ZSTAT_HUFF_EMIT,		// bit emission of one block
+	ZSTAT_HUFF_DECODE,		// huffman_decode of one block
+	ZSTAT_CRC,				// get_crc
+	ZSTAT_NUM_STAGES
+} zstat_stage_t;
+
+typedef struct {
+	uint64_t stage_ns[ZSTAT_NUM_STAGES];
+	uint64_t stage_cycles[ZSTAT_NUM_STAGES];
+	uint64_t stage_calls[ZSTAT_NUM_STAGES];
+
+	uint64_t lz_positions;			// find_match calls
+	uint64_t lz_window_probes;		// window offsets visited by find_match
+	uint64_t lz_match_compares;		// probes that passed the first-byte check
+	uint64_t lz_matches;
+	uint64_t lz_match_bytes;		// input bytes covered by matches
+	uint64_t lz_literals;
+
+	uint64_t deflate_blocks[4];		// indexed by BTYPE
+	uint64_t inflate_blocks[4];
+
+	uint64_t realloc_calls;
+	uint64_t realloc_bytes;			// bytes the old buffer held, i.e. worst-case copy
+} zstats_t;
+
+/* Counters only exist in builds made with -DZSTATS (make stats); otherwise
+ * every macro below compiles to nothing and zstats_enabled() returns 0. */
+#ifdef ZSTATS
+
+typedef struct {
+	uint64_t ns;
+	uint64_t cycles;
+} zstat_mark_t;
+
+extern zstats_t zstats;
+
+zstat_mark_t zstat_now(void);
+void zstat_stage_add(zstat_stage_t stage, const zstat_mark_t* start);
+
+#define ZSTAT_ADD(field, n)		__atomic_fetch_add(&zstats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+#define ZSTAT_BEGIN(stage)		zstat_mark_t zstat_mark_##stage = zstat_now()
+#define ZSTAT_END(stage)		zstat_stage_add(stage, &zstat_mark_##stage)
+#define ZSTAT_LOCAL(decl)		decl
+
+#else
+
+#define ZSTAT_ADD(field, n)		do {} while (0)
+#define ZSTAT_BEGIN(stage)		do {} while (0)
+#define ZSTAT_END(stage)		do {} while (0)
+#define ZSTAT_LOCAL(decl)
+
+#endif
+
+int zstats_enabled(void);
+void zstats_reset(void);
+/* Copies the counters; safe to call while other threads are still counting */
+void zstats_snapshot(zstats_t* out);
+void zstats_print(FILE* out);
+
+#endif /* STATS_H */
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "global.h"
+#include "our_zlib.h"
+#include "pipeline.h"
+#include "batch.h"
+
+#define GZ_SUFFIX ".gz"
+
+typedef struct {
+	char*			path;
+	char*			out_path;
+	long			size;
+	unsigned int	mtime;
+	int				failed;
+} batch_file_t;
+
+typedef struct {
+	batch_file_t*	files;
+	size_t			count;
+	size_t			cap;
+	size_t			next;		// next file for the pool, taken with an atomic add
+	int				mode;
+	int				check_crc;	// -m also decodes members to check their CRC
+} batch_t;
+
+static int has_gz_suffix(const char* path) {
+	size_t len = strlen(path);
+	return len > strlen(GZ_SUFFIX) && strcmp(path + len - strlen(GZ_SUFFIX), GZ_SUFFIX) == 0;
+}
+
+/**
+ * Queues one regular file, skipping the ones the mode does not apply to
+ * (already compressed files for M_DEFLATE, anything but .gz for M_INFLATE).
+ * @return 0 if queued or skipped, -1 on error
+ */
+static int add_file(batch_t* b, const char* path, const struct stat* st) {
+	if (!S_ISREG(st->st_mode)) return 0;
+	if (has_gz_suffix(path) != (b->mode != M_DEFLATE)) return 0;
+
+	if (b->count == b->cap) {
+		size_t cap = b->cap ? b->cap * 2 : 64;
+		batch_file_t* tmp = realloc(b->files, cap * sizeof(batch_file_t));
+		if (!tmp) return -1;
+		b->files = tmp;
+		b->cap = cap;
+	}
+	batch_file_t* f = &b->files[b->count];
+	memset(f, 0, sizeof(*f));
+	size_t len = strlen(path);
+	f->path = strdup(path);
+	f->out_path = malloc(len + strlen(GZ_SUFFIX) + 1);
+	if (!f->path || !f->out_path) {
+		free(f->path);
+		free(f->out_path);
+		return -1;
+	}
+	if (b->mode == M_DEFLATE) {
+		memcpy(f->out_path, path, len);
+		strcpy(f->out_path + len, GZ_SUFFIX);
+	} else {
+		memcpy(f->out_path, path, len - strlen(GZ_SUFFIX));
+		f->out_path[len - strlen(GZ_SUFFIX)] = '\0';
+	}
+	f->size = (long)st->st_size;
+	f->mtime = (unsigned int)st->st_mtim.tv_sec;
+	b->count++;
+	return 0;
+}
+
+/**
+ * Queues a file, or the regular files directly inside a directory.
+ * @return 0 on success, -1 on error
+ */
+static int add_path(batch_t* b, const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		PRINT_ERROR_OPEN_FILE(path);
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode)) return add_file(b, path, &st);
+
+	DIR* dir = opendir(path);
+	if (!dir) {
+		PRINT_ERROR_OPEN_FILE(path);
+		return -1;
+	}
+	int rc = 0;
+	struct dirent* ent;
+	while (rc == 0 && (ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') continue;
+		size_t len = strlen(path) + 1 + strlen(ent->d_name) + 1;
+		char* child = malloc(len);
+		if (!child) { rc = -1; break; }
+		snprintf(child, len, "%s/%s", path, ent->d_name);
+		struct stat child_st;
+		if (stat(child, &child_st) == 0) rc = add_file(b, child, &child_st);
+		free(child);
+	}
+	closedir(dir);
+	return rc;
+}
+
+static int add_list_file(batch_t* b, const char* list_file) {
+	FILE* list = strcmp(list_file, "-") == 0 ? stdin : fopen(list_file, "r");
+	if (!list) {
+		PRINT_ERROR_OPEN_FILE(list_file);
+		return -1;
+	}
+	char* line = NULL;
+	size_t line_cap = 0;
+	ssize_t n;
+	int rc = 0;
+	while (rc == 0 && (n = getline(&line, &line_cap, list)) != -1) {
+		while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+		if (n > 0) rc = add_path(b, line);
+	}
+	free(line);
+	if (list != stdin) fclose(list);
+	return rc;
+}
+
+static int cmp_path(const void* a, const void* b) {
+	return strcmp(((const batch_file_t*)a)->path, ((const batch_file_t*)b)->path);
+}
+
+/* Largest first, so the last files handed out are the quick ones */
+static int cmp_size_desc(const void* a, const void* b) {
+	long sa = ((const batch_file_t*)a)->size, sb = ((const batch_file_t*)b)->size;
+	return (sa < sb) - (sa > sb);
+}
+
+static int compress_one(deflate_ctx_t* ctx, const batch_file_t* f) {
+	FILE* in = fopen(f->path, "rb");
+	if (!in) return -1;
+	FILE* out = fopen(f->out_path, "wb");
+	if (!out) {
+		fclose(in);
+		return -1;
+	}
+	int rc = deflate_stream_ctx(ctx, in, out, f->path, f->mtime);
+	fclose(in);
+	if (fclose(out) != 0) rc = -1;
+	return rc;
+}
+
+/**
+ * Pool thread: takes the next unclaimed file until none are left. One
+ * compressor context is reused for every file the thread handles.
+ */
+static void* batch_worker(void* arg) {
+	batch_t* b = arg;
+	deflate_ctx_t ctx;
+	int have_ctx = b->mode != M_DEFLATE || deflate_ctx_init(&ctx) == 0;
+	for (;;) {
+		size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+		if (i >= b->count) break;
+		batch_file_t* f = &b->files[i];
+		if (!have_ctx)
+			f->failed = 1;
+		else if (b->mode == M_DEFLATE)
+			f->failed = compress_one(&ctx, f) != 0;
+		else
+			f->failed = inflate_file(f->path, f->out_path) != 0;
+	}
+	if (b->mode == M_DEFLATE && have_ctx) deflate_ctx_free(&ctx);
+	return NULL;
+}
+
+int check_members(const char* path, int mode, int check_crc) {
+	FILE* file = fopen(path, "rb");
+	if (!file) return -1;
+	gz_header_t info = {0};
+	int member_idx = 0, num_invalid = 0, crc_valid = -1;
+	// A summary only walks the headers and block boundaries; checking the CRC
+	// decodes each member through a 32 KB window, still without storing it
+	check_crc = check_crc || mode == M_TEST;
+	int rc;
+	while ((rc = check_crc ? verify_member(file, &info, &crc_valid) : parse_member(file, &info)) == MEMBER_OK) {
+		char label[256];
+		if (info.name && info.name[0])
+			snprintf(label, sizeof(label), "%s", info.name);
+		else
+			snprintf(label, sizeof(label), "%d", member_idx);
+		if (mode == M_INFO) {
+			if (member_idx == 0)
+				PRINT_MEMBER_SUMMARY_HEADER(path);
+			PRINT_MEMBER_LINE(label, info.cm, info.mtime, info.os,
+				(unsigned)info.extra_len, info.comment, info.full_size, crc_valid);
+		} else {
+			PRINT_TEST_MEMBER(path, label, crc_valid);
+		}
+		num_invalid += crc_valid == 0;
+		member_idx++;
+		free(info.extra);
+		free(info.name);
+		free(info.comment);
+		memset(&info, 0, sizeof(info));
+	}
+	// A member whose blocks cannot be walked has no known end, so stop there
+	free(info.extra);
+	free(info.name);
+	free(info.comment);
+	fclose(file);
+	if (rc == MEMBER_BAD_DATA) return 2;
+	if (member_idx == 0) return -1;
+	return num_invalid > 0;
+}
+
+/* Summaries are printed in path order from one thread, so they never interleave */
+static void summarize_all(batch_t* b) {
+	qsort(b->files, b->count, sizeof(batch_file_t), cmp_path);
+	for (size_t i = 0; i < b->count; i++) {
+		int rc = check_members(b->files[i].path, b->mode, b->check_crc);
+		b->files[i].failed = rc < 0 || rc == 2 || (rc > 0 && b->mode == M_TEST);
+	}
+}
+
+int batch_run(char** paths, int num_paths, const char* list_file, int mode, int check_crc, int threads) {
+	if (mode != M_DEFLATE && mode != M_INFLATE && mode != M_INFO && mode != M_TEST) return -1;
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int)cpus : 1;
+	}
+
+	batch_t b;
+	memset(&b, 0, sizeof(b));
+	b.mode = mode;
+	b.check_crc = check_crc;
+	int rc = 0;
+	for (int i = 0; rc == 0 && i < num_paths; i++)
+		rc = add_path(&b, paths[i]);
+	if (rc == 0 && list_file)
+		rc = add_list_file(&b, list_file);
+
+	if (rc == 0 && b.count > 0 && (mode == M_INFO || mode == M_TEST)) {
+		summarize_all(&b);
+	}
+	else if (rc == 0 && b.count > 0) {
+		qsort(b.files, b.count, sizeof(batch_file_t), cmp_size_desc);
+
+		// Big files first, each one split across all threads by the pipeline
+		while (mode == M_DEFLATE && b.next < b.count && b.files[b.next].size >= BATCH_SPLIT_SIZE) {
+			batch_file_t* f = &b.files[b.next++];
+			f->failed = deflate_file_pipelined(f->path, f->out_path, threads) != 0;
+		}
+
+		// The rest go to a pool, whole files per thread
+		size_t remaining = b.count - b.next;
+		int pool = remaining < (size_t)threads ? (int)remaining : threads;
+		pthread_t* tids = malloc((size_t)(pool ? pool : 1) * sizeof(pthread_t));
+		int started = 0;
+		while (tids && started < pool && pthread_create(&tids[started], NULL, batch_worker, &b) == 0)
+			started++;
+		if (started == 0 && remaining > 0)
+			batch_worker(&b);
+		for (int i = 0; i < started; i++)
+			pthread_join(tids[i], NULL);
+		free(tids);
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < b.count; i++) {
+		if (b.files[i].failed) {
+			if (mode == M_INFO || mode == M_TEST) {
+				PRINT_ERROR_BAD_MEMBER(b.files[i].path);
+			} else {
+				if (mode == M_DEFLATE)
+					PRINT_ERROR_COMPRESS(b.files[i].path);
+				else
+					PRINT_ERROR_DECOMPRESS(b.files[i].path);
+				remove(b.files[i].out_path);
+			}
+			failed++;
+		}
+		free(b.files[i].path);
+		free(b.files[i].out_path);
+	}
+	if (rc == 0)
+		PRINT_BATCH_SUMMARY(b.count, failed);
+	free(b.files);
+	return rc == 0 ? failed : -1;
+}
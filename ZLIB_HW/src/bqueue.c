@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include "bqueue.h"
+#include "debug.h"
+
+/**
+ * @param q: Queue to set up
+ * @param cap: Most items it holds before bqueue_push blocks
+ * @return 0 on success, -1 on error
+ */
+int bqueue_init(bqueue_t* q, size_t cap) {
+	q->items = malloc((cap ? cap : 1) * sizeof(void*));
+	if (!q->items) {
+		debug("malloc error");
+		return -1;
+	}
+	q->cap = cap ? cap : 1;
+	q->head = 0;
+	q->count = 0;
+	q->closed = 0;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+void bqueue_destroy(bqueue_t* q) {
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	free(q->items);
+	q->items = NULL;
+}
+
+int bqueue_push(bqueue_t* q, void* item) {
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->cap && !q->closed)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	if (q->closed) {
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+	q->items[(q->head + q->count) % q->cap] = item;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+void* bqueue_pop(bqueue_t* q) {
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->closed)
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	void* item = NULL;
+	if (q->count > 0) {
+		item = q->items[q->head];
+		q->head = (q->head + 1) % q->cap;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return item;
+}
+
+/**
+ * Refuses further pushes. Items already queued can still be popped.
+ */
+void bqueue_close(bqueue_t* q) {
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
@@ -1,8 +1,10 @@
+#include <pthread.h>
 #include "crc.h"
+#include "stats.h"
 
 /* PNG uses CRC-32 with polynomial 0xEDB88320 */
 static unsigned int crc_table[256];
-static int crc_table_computed = 0;
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
 
 static void make_crc_table(void)
 {
@@ -21,22 +23,90 @@ static void make_crc_table(void)
         }
         crc_table[n] = c;
     }
-    crc_table_computed = 1;
 }
 
 unsigned int get_crc(const unsigned char *buf, size_t len)
 {
-    unsigned int c = 0xFFFFFFFFUL;
+    return crc_update(0, buf, len);
+}
+
+/**
+ * Continues a CRC over more data: crc_update(get_crc(a), b) == get_crc(a + b).
+ * Start from 0 for the first piece.
+ */
+unsigned int crc_update(unsigned int crc, const unsigned char *buf, size_t len)
+{
+    unsigned int c = crc ^ 0xFFFFFFFFUL;
     size_t n;
 
-    if (!crc_table_computed) {
-        make_crc_table();
-    }
+    pthread_once(&crc_table_once, make_crc_table);
 
+    ZSTAT_BEGIN(ZSTAT_CRC);
     for (n = 0; n < len; n++) {
         c = crc_table[(c ^ buf[n]) & 0xFF] ^ (c >> 8);
     }
+    ZSTAT_END(ZSTAT_CRC);
 
     return c ^ 0xFFFFFFFFUL;
 }
 
+
+/* Multiplies the 32x32 GF(2) matrix mat by the vector vec */
+static unsigned int gf2_matrix_times(const unsigned int *mat, unsigned int vec)
+{
+    unsigned int sum = 0;
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(unsigned int *square, const unsigned int *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/**
+ * CRC of two pieces joined, from their separate CRCs:
+ * crc_combine(get_crc(a), get_crc(b), len(b)) == get_crc(a + b).
+ * Costs O(log len2) and never touches the data, so pieces can be
+ * checksummed on different threads.
+ */
+unsigned int crc_combine(unsigned int crc1, unsigned int crc2, size_t len2)
+{
+    unsigned int even[32];  /* operator for an even power-of-two number of zero bits */
+    unsigned int odd[32];   /* operator for an odd power-of-two number of zero bits */
+
+    if (len2 == 0)
+        return crc1;
+
+    /* Operator for one zero bit */
+    odd[0] = 0xEDB88320UL;
+    unsigned int row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd);   /* two zero bits */
+    gf2_matrix_square(odd, even);   /* four zero bits */
+
+    /* Append len2 zero bytes to crc1, squaring up to one byte, then doubling */
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+        gf2_matrix_square(odd, even);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
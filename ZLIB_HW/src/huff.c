@@ -1,12 +1,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 #include "huff.h"
 #include "lz.h"
 #include "queue.h"
 #include "utility.h"
 #include "debug.h"
 #include "our_zlib.h"
+#include "crc.h"
 
 #define NUM_SYMS 256
 #define NUM_SYMS_AND_LENGTHS 288
@@ -117,14 +120,13 @@ static void canonical_codes(unsigned char* lens, unsigned long* codes, unsigned
  * @return Index of the length in the table, or 0 if it isn't in the table
 */
 static int length_to_code(unsigned int length, unsigned int *extra_val) {
-    for (int i = 28; i >= 0; i--) {
-        if (length >= len_table[i].base) {
-            *extra_val = length - len_table[i].base;
-            return i; // code = 257 + i
-        }
+    if (length < len_table[0].base || length > len_table[28].base) {
+        *extra_val = 0;
+        return 0;
     }
-    *extra_val = 0;
-    return 0;
+    int i = lz_length_code(length); // code = 257 + i
+    *extra_val = length - len_table[i].base;
+    return i;
 }
 
 /** 
@@ -134,14 +136,13 @@ static int length_to_code(unsigned int length, unsigned int *extra_val) {
  * @return Index of the distance code in the table or 0 if it doesn't exist
 */
 static int distance_to_code(unsigned int distance, unsigned int *extra_val) {
-    for (int i = 29; i >= 0; i--) {
-        if (distance >= dist_table[i].base) {
-            *extra_val = distance - dist_table[i].base;
-            return i;
-        }
+    if (distance < 1 || distance > 32768) {
+        *extra_val = 0;
+        return 0;
     }
-    *extra_val = 0;
-    return 0;
+    int i = lz_distance_code(distance);
+    *extra_val = distance - dist_table[i].base;
+    return i;
 }
 
 /**
@@ -253,13 +254,21 @@ typedef struct {
  * @param dec A Huffman decoder struct to store Huffman coding information for this block
  * @param lens An array storing encoding lengths: lens[i] = code length for symbol i (0 means symbol not present)
  * @param num_symbols The length of lens
+ * @return 0 on success, -1 if the lengths describe more codes than fit (over-subscribed)
 */
-static void build_decoder(huff_decoder_t* dec, unsigned char* lens, int num_symbols) {
+static int build_decoder(huff_decoder_t* dec, unsigned char* lens, int num_symbols) {
 	memset(dec, 0, sizeof(*dec));
 
 	for (int i = 0; i < num_symbols; i++)
 		if (lens[i] > 0 && lens[i] <= MAX_CODE_LEN) dec->count[lens[i]]++;
 
+	// Each length doubles the code space; running out means a malformed header
+	int left = 1;
+	for (int i = 1; i <= MAX_CODE_LEN; i++) {
+		left = (left << 1) - dec->count[i];
+		if (left < 0) return -1;
+	}
+
 	dec->first_code[0] = 0;
 	for (int i = 1; i <= MAX_CODE_LEN; i++)
 		dec->first_code[i] = (dec->first_code[i - 1] + dec->count[i - 1]) << 1;
@@ -276,6 +285,7 @@ static void build_decoder(huff_decoder_t* dec, unsigned char* lens, int num_symb
 		if (lens[i] > 0 && lens[i] <= MAX_CODE_LEN)
 			dec->symbols[next_offset[lens[i]]++] = i;
 	}
+	return 0;
 }
 
 /**
@@ -285,11 +295,13 @@ static void build_decoder(huff_decoder_t* dec, unsigned char* lens, int num_symb
  * @param dec The Huffman decoder struct for this block
  * @param data The Huffman-encoded data
  * @param bits_read The total number of bits read in the block
+ * @param bit_limit Total number of bits in data, never read past
  * @return The decoded symbol, or -1 on error.
  */
-static int decode_symbol(huff_decoder_t* dec, const unsigned char* data, unsigned long* bits_read) {
+static int decode_symbol(const huff_decoder_t* dec, const unsigned char* data, unsigned long* bits_read, unsigned long bit_limit) {
 	unsigned int code = 0;
 	for (int len = 1; len <= MAX_CODE_LEN; len++) {
+		if (*bits_read >= bit_limit) return -1;
 		unsigned int bit = 0;
 		bit_reader(data + (*bits_read / 8), 1, bits_read, &bit, false);
 		code = (code << 1) | bit;
@@ -301,99 +313,267 @@ static int decode_symbol(huff_decoder_t* dec, const unsigned char* data, unsigne
 	return -1;
 }
 
-/** ================================================================
- *  ENCODE: Fixed Huffman with LZ77 tokens (BTYPE=1)
- *  ================================================================ 
- * @param tokens: An array of tokens that contain a concise form of LZ77 data, rather literal or length-distance entries stored in raw data form 
- * @param num_tokens: number of entries in tokens
- * @param bits_written The total number of bits written to the output
- * @param out_len The size of the encoded data
- * @return Dynamically allocated array of Huffman-encoded data
+/**
+ * bit_reader that refuses to read past the end of the encoded data.
+ * @return 0 on success, -1 if fewer than count bits are left
  */
-static unsigned char* encode_fixed_huffman_tokens(const lz_token_t* tokens, size_t num_tokens, unsigned long* bits_written, size_t* out_len) {
-    size_t alloc = num_tokens * 4 + 16;
-    unsigned char* out = calloc(alloc, 1);
-    if (!out || !out_len) return NULL;
-    *bits_written = 0;
+static int read_bits(const unsigned char* data, unsigned int count, unsigned long* bits_read, unsigned long bit_limit, unsigned int* val) {
+	if (*bits_read + count > bit_limit) return -1;
+	bit_reader(data + (*bits_read / 8), count, bits_read, val, false);
+	return 0;
+}
 
-    // Fixed Huffman code tables per RFC 1951 3.2.6
-    struct { unsigned short code; unsigned char len; } fixed_codes[288];
-    for (int i = 0; i <= 143; i++)   { fixed_codes[i].code = 0x30 + i;           fixed_codes[i].len = 8; }
-    for (int i = 144; i <= 255; i++) { fixed_codes[i].code = 0x190 + (i - 144);  fixed_codes[i].len = 9; }
-    for (int i = 256; i <= 279; i++) { fixed_codes[i].code = (i - 256);          fixed_codes[i].len = 7; }
-    for (int i = 280; i <= 287; i++) { fixed_codes[i].code = 0xC0 + (i - 280);   fixed_codes[i].len = 8; }
+static const unsigned char cl_order[NUM_CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
 
-    for (size_t i = 0; i < num_tokens; i++) {
-        size_t byte_pos = *bits_written / 8;
-        if (byte_pos + 8 >= alloc) {
-            alloc *= 2;
-            unsigned char* tmp = realloc(out, alloc);
-            if (!tmp) { free(out); return NULL; }
-            memset(tmp + byte_pos, 0, alloc - byte_pos);
-            out = tmp;
-        }
+/**
+ * Bits spent on length and distance extra bits for a histogram. They are
+ * the same for fixed and dynamic blocks.
+ */
+static unsigned long extra_bits_cost(const lz_hist_t* hist) {
+    unsigned long bits = 0;
+    for (int i = 0; i < 29; i++)
+        bits += (unsigned long)hist->lit_freq[257 + i] * len_table[i].extra;
+    for (int i = 0; i < NUM_DISTANCES; i++)
+        bits += (unsigned long)hist->dist_freq[i] * dist_table[i].extra;
+    return bits;
+}
 
-        if (tokens[i].is_literal) {
-            unsigned int sym = tokens[i].literal;
-            bit_writer(fixed_codes[sym].code, fixed_codes[sym].len, bits_written, out, true);
-        } else {
-            // Length
-            unsigned int extra_val;
-            int len_idx = length_to_code(tokens[i].length, &extra_val);
-            unsigned int sym = 257 + len_idx;
-            bit_writer(fixed_codes[sym].code, fixed_codes[sym].len, bits_written, out, true);
-            if (len_table[len_idx].extra > 0)
-                bit_writer(extra_val, len_table[len_idx].extra, bits_written, out, false);
+/**
+ * Fill plan with the fixed Huffman codes (RFC 1951 3.2.6) and their cost.
+ */
+static void plan_fixed_block(const lz_hist_t* hist, huff_plan_t* plan) {
+    for (int i = 0; i <= 143; i++)   plan->lit_lens[i] = 8;
+    for (int i = 144; i <= 255; i++) plan->lit_lens[i] = 9;
+    for (int i = 256; i <= 279; i++) plan->lit_lens[i] = 7;
+    for (int i = 280; i <= 287; i++) plan->lit_lens[i] = 8;
+    for (int i = 0; i < NUM_DISTANCES; i++) plan->dist_lens[i] = 5;
+    canonical_codes(plan->lit_lens, plan->lit_codes, NUM_SYMS_AND_LENGTHS);
+    canonical_codes(plan->dist_lens, plan->dist_codes, NUM_DISTANCES);
+
+    unsigned long bits = plan->lit_lens[256] + extra_bits_cost(hist); // end-of-block
+    for (int i = 0; i < NUM_SYMS_AND_LENGTHS; i++)
+        if (i != 256) bits += (unsigned long)hist->lit_freq[i] * plan->lit_lens[i];
+    for (int i = 0; i < NUM_DISTANCES; i++)
+        bits += (unsigned long)hist->dist_freq[i] * 5;
+
+    plan->btype = BT_STATIC;
+    plan->bits = bits;
+}
 
-            // Distance (fixed: 5-bit codes, MSB-first)
-            unsigned int dist_extra;
-            int dist_idx = distance_to_code(tokens[i].distance, &dist_extra);
-            bit_writer((unsigned int)dist_idx, 5, bits_written, out, true);
-            if (dist_table[dist_idx].extra > 0)
-                bit_writer(dist_extra, dist_table[dist_idx].extra, bits_written, out, false);
+#define CL_REPEAT_PREV  16  // previous length 3-6 times, 2 extra bits
+#define CL_REPEAT_ZERO  17  // zero 3-10 times, 3 extra bits
+#define CL_REPEAT_ZERO_LONG 18  // zero 11-138 times, 7 extra bits
+
+static const unsigned char cl_extra_bits[NUM_CODE_LENGTH_CODES] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7
+};
+
+/**
+ * Run-length codes lens the way zlib does: the longest run each time,
+ * zeros with 17/18 and repeats of the previous length with 16.
+ * @param lens Literal/length code lengths followed by distance code lengths
+ * @param n Number of entries in lens
+ * @param seq Filled with HUFF_CL_ENTRY values
+ * @return Number of entries in seq
+ */
+static unsigned int rle_greedy(const unsigned char* lens, unsigned int n, unsigned short* seq) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < n;) {
+        unsigned int run = 1;
+        while (i + run < n && lens[i + run] == lens[i]) run++;
+
+        if (lens[i] == 0 && run >= 3) {
+            unsigned int r = run > 138 ? 138 : run;
+            seq[count++] = r >= 11 ? HUFF_CL_ENTRY(CL_REPEAT_ZERO_LONG, r - 11) : HUFF_CL_ENTRY(CL_REPEAT_ZERO, r - 3);
+            i += r;
+        }
+        else if (lens[i] != 0 && run >= 4) {
+            // The first one is sent as itself, then repeated
+            seq[count++] = HUFF_CL_ENTRY(lens[i], 0);
+            unsigned int r = run - 1 > 6 ? 6 : run - 1;
+            if (r >= 3) {
+                seq[count++] = HUFF_CL_ENTRY(CL_REPEAT_PREV, r - 3);
+                i += 1 + r;
+            } else {
+                i += 1;
+            }
+        }
+        else {
+            seq[count++] = HUFF_CL_ENTRY(lens[i], 0);
+            i += 1;
         }
     }
+    return count;
+}
 
-    // Write end-of-block (symbol 256)
-    bit_writer(fixed_codes[256].code, fixed_codes[256].len, bits_written, out, true);
-
-    *out_len = (*bits_written + 7) / 8;
-    return out;
+/**
+ * Run-length codes lens with the fewest bits for given code-length code
+ * lengths, by dynamic programming over the position in lens. Symbols with
+ * no code (cl_lens 0) are not used.
+ * @return Number of entries in seq, 0 if lens cannot be coded with cl_lens
+ */
+static unsigned int rle_optimal(const unsigned char* lens, unsigned int n, const unsigned char* cl_lens, unsigned short* seq) {
+    const unsigned long none = (unsigned long)-1;
+    unsigned long cost[HUFF_MAX_HEADER_LENS + 1];
+    unsigned short choice[HUFF_MAX_HEADER_LENS];
+
+    // cost[i]: fewest bits for lens[i..n)
+    cost[n] = 0;
+    for (int i = (int)n - 1; i >= 0; i--) {
+        cost[i] = none;
+        unsigned char v = lens[i];
+        if (cl_lens[v] && cost[i + 1] != none) {
+            cost[i] = cl_lens[v] + cost[i + 1];
+            choice[i] = HUFF_CL_ENTRY(v, 0);
+        }
+        // Longest run of v starting here, only as far as any code can reach
+        unsigned int run = 1;
+        while (run < 138 && i + run < n && lens[i + run] == v) run++;
+
+        if (v == 0) {
+            for (unsigned int r = 3; r <= run; r++) {
+                unsigned int sym = r >= 11 ? CL_REPEAT_ZERO_LONG : CL_REPEAT_ZERO;
+                if (!cl_lens[sym] || cost[i + r] == none) continue;
+                unsigned long c = cl_lens[sym] + cl_extra_bits[sym] + cost[i + r];
+                if (c < cost[i]) {
+                    cost[i] = c;
+                    choice[i] = HUFF_CL_ENTRY(sym, r - (sym == CL_REPEAT_ZERO_LONG ? 11 : 3));
+                }
+            }
+        }
+        // 16 repeats whatever length came before, however it was sent
+        if (i > 0 && lens[i - 1] == v && cl_lens[CL_REPEAT_PREV]) {
+            for (unsigned int r = 3; r <= run && r <= 6; r++) {
+                if (cost[i + r] == none) continue;
+                unsigned long c = cl_lens[CL_REPEAT_PREV] + cl_extra_bits[CL_REPEAT_PREV] + cost[i + r];
+                if (c < cost[i]) {
+                    cost[i] = c;
+                    choice[i] = HUFF_CL_ENTRY(CL_REPEAT_PREV, r - 3);
+                }
+            }
+        }
+    }
+    if (cost[0] == none) return 0;
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < n;) {
+        unsigned short e = choice[i];
+        seq[count++] = e;
+        unsigned int sym = HUFF_CL_SYM(e);
+        i += sym < 16 ? 1 : HUFF_CL_EXTRA(e) + (sym == CL_REPEAT_ZERO_LONG ? 11 : 3);
+    }
+    return count;
 }
 
-/** ================================================================
- *  ENCODE: Dynamic Huffman with LZ77 tokens (BTYPE=2)
- *  ================================================================ 
- * @param tokens An array of tokens that contain a concise form of LZ77 data, rather literal or length-distance entries stored in raw data form 
- * @param num_tokens The number of entries inside tokens
- * @param bits_written The total number of bits written to the output
- * @param out_len The size of the encoded data
- * @return Dynamically allocated space containing some block headers (starting with `HLIT`) and encoded data, or `NULL` on error 
+/**
+ * Builds the code-length code for a run-length coded sequence and sets HCLEN
+ * to send only up to the last used entry of the RFC's order.
+ * @return Header bits for this sequence, 0 if the code-length code is unusable
  */
-static unsigned char* encode_dynamic_huffman_tokens(const lz_token_t* tokens, size_t num_tokens, unsigned long* bits_written, size_t* out_len) {
-    if (!tokens || !out_len) return NULL;
+static unsigned long plan_cl_code(huff_plan_t* plan, const unsigned short* seq, unsigned int seq_len) {
+    unsigned int cl_freq[NUM_CODE_LENGTH_CODES] = {0};
+    for (unsigned int i = 0; i < seq_len; i++) cl_freq[HUFF_CL_SYM(seq[i])]++;
+    // A lone symbol would get an incomplete one-bit code, which zlib refuses
+    int used = 0;
+    for (int i = 0; i < NUM_CODE_LENGTH_CODES; i++) used += cl_freq[i] > 0;
+    if (used == 1) cl_freq[cl_freq[0] ? 1 : 0] = 1;
+
+    huff_node_t *cl_root = build_huffman_tree_from_freq(cl_freq, NUM_CODE_LENGTH_CODES, plan->cl_codes, plan->cl_lens);
+    if (!cl_root) return 0;
+    free_tree(cl_root);
+    for (int i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
+        if (plan->cl_lens[i] > 7) return 0;
+    }
+    canonical_codes(plan->cl_lens, plan->cl_codes, NUM_CODE_LENGTH_CODES);
 
-    size_t alloc = num_tokens * 4 + 1024;
-    unsigned char* out = calloc(alloc, 1);
-    if (!out) return NULL;
-    *bits_written = 0;
+    int last_cl_idx = 3;
+    for (int j = 18; j >= 3; j--) {
+        if (plan->cl_lens[cl_order[j]] != 0) { last_cl_idx = j; break; }
+    }
+    plan->hclen = last_cl_idx - 3;
 
-    // === PART 1: COUNT FREQUENCIES from tokens ===
-    unsigned int lit_freq[NUM_SYMS_AND_LENGTHS] = {0};
-    unsigned int d_freq[NUM_DISTANCES] = {0};
+    unsigned long bits = 5 + 5 + 4 + (plan->hclen + 4) * 3;
+    for (unsigned int i = 0; i < seq_len; i++) {
+        unsigned int sym = HUFF_CL_SYM(seq[i]);
+        bits += plan->cl_lens[sym] + cl_extra_bits[sym];
+    }
+    return bits;
+}
 
-    for (size_t i = 0; i < num_tokens; i++) {
-        if (tokens[i].is_literal) {
-            lit_freq[tokens[i].literal]++;
-        } else {
-            unsigned int extra_val;
-            int len_idx = length_to_code(tokens[i].length, &extra_val);
-            lit_freq[257 + len_idx]++;
-            unsigned int dist_extra;
-            int dist_idx = distance_to_code(tokens[i].distance, &dist_extra);
-            d_freq[dist_idx]++;
-        }
+/**
+ * Plans the dynamic header for the code lengths in plan: HLIT and HDIST
+ * without trailing unused codes, the run-length coding of the lengths and the
+ * code-length code. The greedy coding gives the first code-length code;
+ * the optimal coding for that code is kept if it ends up smaller.
+ * @return Header bits, 0 if no valid header exists
+ */
+static unsigned long plan_header(huff_plan_t* plan) {
+    // HLIT = (# of literal/length codes) - 257, up to the last symbol that is used
+    int max_lit_sym = 256;
+    for (int j = NUM_SYMS_AND_LENGTHS - 1; j > 256; j--) {
+        if (plan->lit_lens[j] > 0) { max_lit_sym = j; break; }
+    }
+    plan->hlit = max_lit_sym - 256;
+
+    // HDIST = (# of distance codes) - 1
+    int max_dist_sym = 0;
+    for (int j = NUM_DISTANCES - 1; j >= 0; j--) {
+        if (plan->dist_lens[j] > 0) { max_dist_sym = j; break; }
     }
+    plan->hdist = max_dist_sym;
+
+    // Both alphabets are one sequence, so runs may cross from one to the other
+    unsigned int num_lit = plan->hlit + 257, num_dist = plan->hdist + 1;
+    unsigned char lens[HUFF_MAX_HEADER_LENS];
+    memcpy(lens, plan->lit_lens, num_lit);
+    memcpy(lens + num_lit, plan->dist_lens, num_dist);
+    unsigned int n = num_lit + num_dist;
+
+    plan->cl_seq_len = rle_greedy(lens, n, plan->cl_seq);
+    unsigned long bits = plan_cl_code(plan, plan->cl_seq, plan->cl_seq_len);
+    if (bits == 0) return 0;
+
+    huff_plan_t tuned;
+    memcpy(tuned.cl_lens, plan->cl_lens, sizeof(tuned.cl_lens));
+    tuned.cl_seq_len = rle_optimal(lens, n, plan->cl_lens, tuned.cl_seq);
+    if (tuned.cl_seq_len == 0) return bits;
+    unsigned long tuned_bits = plan_cl_code(&tuned, tuned.cl_seq, tuned.cl_seq_len);
+    if (tuned_bits == 0 || tuned_bits >= bits) return bits;
+
+    memcpy(plan->cl_codes, tuned.cl_codes, sizeof(plan->cl_codes));
+    memcpy(plan->cl_lens, tuned.cl_lens, sizeof(plan->cl_lens));
+    memcpy(plan->cl_seq, tuned.cl_seq, tuned.cl_seq_len * sizeof(unsigned short));
+    plan->cl_seq_len = tuned.cl_seq_len;
+    plan->hclen = tuned.hclen;
+    return tuned_bits;
+}
+
+/**
+ * Cost of the dynamic header that plan_dynamic_block would write for these
+ * code lengths, so callers can compare block layouts without emitting.
+ * @param lit_lens Literal/length code lengths (LZ_NUM_LITLEN_SYMS entries)
+ * @param dist_lens Distance code lengths (LZ_NUM_DIST_SYMS entries)
+ * @return Header bits after BTYPE, 0 if no valid header exists
+ */
+unsigned long huffman_header_bits(const unsigned char* lit_lens, const unsigned char* dist_lens) {
+    huff_plan_t plan;
+    memcpy(plan.lit_lens, lit_lens, sizeof(plan.lit_lens));
+    memcpy(plan.dist_lens, dist_lens, sizeof(plan.dist_lens));
+    return plan_header(&plan);
+}
+
+/**
+ * Build dynamic Huffman codes for a histogram and the code-length header that
+ * describes them, and compute the encoded block size without emitting anything.
+ * @return 0 on success, -1 if no valid dynamic code could be built (lengths over the limits)
+ */
+static int plan_dynamic_block(const lz_hist_t* hist, huff_plan_t* plan) {
+    unsigned int lit_freq[NUM_SYMS_AND_LENGTHS];
+    unsigned int d_freq[NUM_DISTANCES];
+    memcpy(lit_freq, hist->lit_freq, sizeof(lit_freq));
+    memcpy(d_freq, hist->dist_freq, sizeof(d_freq));
     lit_freq[256] = 1; // end-of-block
 
     // Ensure at least 1 distance code
@@ -403,139 +583,267 @@ static unsigned char* encode_dynamic_huffman_tokens(const lz_token_t* tokens, si
     }
     if (!has_dist) d_freq[0] = 1;
 
-    // === PART 2: BUILD HUFFMAN CODES ===
-    unsigned long lit_codes[NUM_SYMS_AND_LENGTHS] = {0};
-    unsigned char lit_lens[NUM_SYMS_AND_LENGTHS] = {0};
-
-    huff_node_t *lit_root = build_huffman_tree_from_freq(lit_freq, NUM_SYMS_AND_LENGTHS, lit_codes, lit_lens);
-    if (!lit_root) { free(out); return NULL; }
-
-    int valid = 1;
+    // === BUILD HUFFMAN CODES ===
+    huff_node_t *lit_root = build_huffman_tree_from_freq(lit_freq, NUM_SYMS_AND_LENGTHS, plan->lit_codes, plan->lit_lens);
+    if (!lit_root) return -1;
+    free_tree(lit_root);
     for (int i = 0; i < NUM_SYMS_AND_LENGTHS; i++) {
-        if (lit_lens[i] > MAX_CODE_LEN) valid = 0;
+        if (plan->lit_lens[i] > MAX_CODE_LEN) return -1;
     }
-    if (!valid) { free_tree(lit_root); free(out); return NULL; }
-    canonical_codes(lit_lens, lit_codes, NUM_SYMS_AND_LENGTHS);
+    canonical_codes(plan->lit_lens, plan->lit_codes, NUM_SYMS_AND_LENGTHS);
 
-    unsigned char dist_lens[NUM_DISTANCES] = {0};
-    unsigned long dist_codes[NUM_DISTANCES] = {0};
-    huff_node_t *dist_root = build_huffman_tree_from_freq(d_freq, NUM_DISTANCES, dist_codes, dist_lens);
+    huff_node_t *dist_root = build_huffman_tree_from_freq(d_freq, NUM_DISTANCES, plan->dist_codes, plan->dist_lens);
     if (!dist_root) {
         // Fall back: minimal distance tree
-        dist_lens[0] = 1;
+        plan->dist_lens[0] = 1;
     } else {
+        free_tree(dist_root);
         for (int i = 0; i < NUM_DISTANCES; i++) {
-            if (dist_lens[i] > MAX_CODE_LEN) { free_tree(dist_root); free_tree(lit_root); free(out); return NULL; }
+            if (plan->dist_lens[i] > MAX_CODE_LEN) return -1;
         }
     }
-    canonical_codes(dist_lens, dist_codes, NUM_DISTANCES);
+    canonical_codes(plan->dist_lens, plan->dist_codes, NUM_DISTANCES);
+
+    // === HEADER: HLIT, HDIST, HCLEN and the run-length coded lengths ===
+    unsigned long header_bits = plan_header(plan);
+    if (header_bits == 0) return -1;
+
+    // === COST: header + code lengths + data + end-of-block ===
+    unsigned long bits = header_bits;
+    bits += plan->lit_lens[256] + extra_bits_cost(hist);
+    for (int i = 0; i < NUM_SYMS_AND_LENGTHS; i++)
+        if (i != 256) bits += (unsigned long)hist->lit_freq[i] * plan->lit_lens[i];
+    for (int i = 0; i < NUM_DISTANCES; i++)
+        bits += (unsigned long)hist->dist_freq[i] * plan->dist_lens[i];
+
+    plan->btype = BT_DYNAMIC;
+    plan->bits = bits;
+    return 0;
+}
 
-    // Find HLIT
-    int max_lit_sym = 256;
-    for (int j = 257; j < NUM_SYMS_AND_LENGTHS; j++) {
-        if (lit_lens[j] > 0) { max_lit_sym = j; break; }
-    }
-    unsigned int hlit = max_lit_sym - 256;
+/** ================================================================
+ *  PLAN: choose the block type from a symbol histogram
+ *  ================================================================
+ * Builds both the fixed and the dynamic code for the histogram and keeps the
+ * one whose encoded block is smaller, without touching the tokens.
+ * @param hist Literal/length and distance symbol counts of the block (end-of-block not included)
+ * @param plan Filled with the chosen codes, header fields and encoded size in bits
+ * @return 0 on success, -1 on error
+ */
+int huffman_plan_block(const lz_hist_t* hist, huff_plan_t* plan) {
+    if (!hist || !plan) return -1;
 
-    // Find HDIST
-    int max_dist_sym = 0;
-    for (int j = NUM_DISTANCES - 1; j >= 0; j--) {
-        if (dist_lens[j] > 0) { max_dist_sym = j; break; }
-    }
-    unsigned int hdist = max_dist_sym; // HDIST = (# of distance codes) - 1
+    huff_plan_t dynamic;
+    memset(&dynamic, 0, sizeof(dynamic));
+    memset(plan, 0, sizeof(*plan));
+    plan_fixed_block(hist, plan);
 
-    // === PART 3: ENCODE CODE LENGTHS ===
-    int num_lit = max_lit_sym + 1;
-    int num_dist = hdist + 1;
-    int total_cl = num_lit + num_dist;
-    unsigned char combined_lens[NUM_SYMS_AND_LENGTHS + NUM_DISTANCES];
-    for (int i = 0; i < num_lit; i++) combined_lens[i] = lit_lens[i];
-    for (int i = 0; i < num_dist; i++) combined_lens[num_lit + i] = dist_lens[i];
+    if (plan_dynamic_block(hist, &dynamic) == 0 && (dynamic.bits + 7) / 8 <= (plan->bits + 7) / 8)
+        *plan = dynamic;
+    return 0;
+}
 
-    unsigned int cl_freq[NUM_CODE_LENGTH_CODES] = {0};
-    for (int i = 0; i < total_cl; i++) {
-        cl_freq[combined_lens[i]]++;
+/** ================================================================
+ *  EMIT: write a planned block body
+ *  ================================================================
+ * Writes the dynamic header (if any), the tokens and the end-of-block symbol
+ * starting at *bit_pos. The caller writes BFINAL/BTYPE and must have room
+ * for plan->bits more bits in a zero-initialized out.
+ * @param plan Codes chosen by huffman_plan_block for these tokens
+ * @param tokens Packed LZ77 tokens of the block
+ * @param num_tokens Number of entries in tokens
+ * @param out Output buffer
+ * @param bit_pos Bit position in out, advanced by plan->bits
+ */
+void huffman_emit_block(const huff_plan_t* plan, const lz_packed_t* tokens, size_t num_tokens, unsigned char* out, unsigned long* bit_pos) {
+    if (plan->btype == BT_DYNAMIC) {
+        bit_writer(plan->hlit,  5, bit_pos, out, false);
+        bit_writer(plan->hdist, 5, bit_pos, out, false);
+        bit_writer(plan->hclen, 4, bit_pos, out, false);
+
+        for (unsigned int j = 0; j < plan->hclen + 4; j++)
+            bit_writer(plan->cl_lens[cl_order[j]], 3, bit_pos, out, false);
+
+        for (unsigned int j = 0; j < plan->cl_seq_len; j++) {
+            unsigned int sym = HUFF_CL_SYM(plan->cl_seq[j]);
+            bit_writer(plan->cl_codes[sym], plan->cl_lens[sym], bit_pos, out, true);
+            if (cl_extra_bits[sym])
+                bit_writer(HUFF_CL_EXTRA(plan->cl_seq[j]), cl_extra_bits[sym], bit_pos, out, false);
+        }
     }
 
-    unsigned long cl_codes[NUM_CODE_LENGTH_CODES] = {0};
-    unsigned char cl_lens[NUM_CODE_LENGTH_CODES] = {0};
-    huff_node_t *cl_root = build_huffman_tree_from_freq(cl_freq, NUM_CODE_LENGTH_CODES, cl_codes, cl_lens);
-    if (!cl_root) { free_tree(lit_root); if (dist_root) free_tree(dist_root); free(out); return NULL; }
+    for (size_t i = 0; i < num_tokens; i++) {
+        if (LZ_PACKED_IS_LITERAL(tokens[i])) {
+            unsigned int sym = LZ_PACKED_LITERAL(tokens[i]);
+            bit_writer(plan->lit_codes[sym], plan->lit_lens[sym], bit_pos, out, true);
+        } else {
+            unsigned int extra_val;
+            int len_idx = length_to_code(LZ_PACKED_LENGTH(tokens[i]), &extra_val);
+            unsigned int sym = 257 + len_idx;
+            bit_writer(plan->lit_codes[sym], plan->lit_lens[sym], bit_pos, out, true);
+            if (len_table[len_idx].extra > 0)
+                bit_writer(extra_val, len_table[len_idx].extra, bit_pos, out, false);
 
-    for (int i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
-        if (cl_lens[i] > 7) { free_tree(cl_root); free_tree(lit_root); if (dist_root) free_tree(dist_root); free(out); return NULL; }
+            unsigned int dist_extra;
+            int dist_idx = distance_to_code(LZ_PACKED_DISTANCE(tokens[i]), &dist_extra);
+            bit_writer(plan->dist_codes[dist_idx], plan->dist_lens[dist_idx], bit_pos, out, true);
+            if (dist_table[dist_idx].extra > 0)
+                bit_writer(dist_extra, dist_table[dist_idx].extra, bit_pos, out, false);
+        }
     }
 
-    canonical_codes(cl_lens, cl_codes, NUM_CODE_LENGTH_CODES);
+    // Write end-of-block (symbol 256)
+    bit_writer(plan->lit_codes[256], plan->lit_lens[256], bit_pos, out, true);
+}
 
-    static const unsigned char cl_order[NUM_CODE_LENGTH_CODES] = {
-        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-    };
-    int last_cl_idx = 3;
-    for (int j = 18; j >= 3; j--) {
-        if (cl_lens[cl_order[j]] != 0) { last_cl_idx = j; break; }
+/** ================================================================
+ *  GROUP: merge chunks whose statistics are alike into one block
+ *  ================================================================
+ * DEFLATE cannot point a block at the previous block's codes, so the way to
+ * reuse a table is to keep coding with it: a chunk joins the open block when
+ * the open block's codes cost it no more than HUFF_GROUP_REUSE_SLACK over a
+ * block of its own, header included. Only a chunk over that threshold gets
+ * its own trees. The decision needs only histograms; tokens are kept back
+ * until the block is complete, which is also when BFINAL is known.
+ */
+
+/**
+ * @param group Group to set up, empty
+ * @param chunk_tokens Most tokens a single chunk can produce
+ * @return 0 on success, -1 on allocation failure
+ */
+int huff_group_init(huff_group_t* group, size_t chunk_tokens) {
+    memset(group, 0, sizeof(*group));
+    group->cap = chunk_tokens * HUFF_GROUP_MAX_CHUNKS;
+    group->tokens = malloc(group->cap * sizeof(lz_packed_t));
+    return group->tokens ? 0 : -1;
+}
+
+void huff_group_free(huff_group_t* group) {
+    free(group->tokens);
+    memset(group, 0, sizeof(*group));
+}
+
+/**
+ * Bits the tokens of hist take under plan's codes, end-of-block not included.
+ * @return The cost, or ULONG_MAX if hist uses a symbol plan has no code for
+ */
+static unsigned long reuse_cost(const huff_plan_t* plan, const lz_hist_t* hist) {
+    unsigned long bits = extra_bits_cost(hist);
+    for (int i = 0; i < NUM_SYMS_AND_LENGTHS; i++) {
+        if (!hist->lit_freq[i]) continue;
+        if (!plan->lit_lens[i]) return ULONG_MAX;
+        bits += (unsigned long)hist->lit_freq[i] * plan->lit_lens[i];
     }
-    int hclen = last_cl_idx - 3;
+    for (int i = 0; i < NUM_DISTANCES; i++) {
+        if (!hist->dist_freq[i]) continue;
+        if (!plan->dist_lens[i]) return ULONG_MAX;
+        bits += (unsigned long)hist->dist_freq[i] * plan->dist_lens[i];
+    }
+    return bits;
+}
 
-    // === PART 4: WRITE HEADER ===
-    bit_writer(hlit,  5, bits_written, out, false);
-    bit_writer(hdist, 5, bits_written, out, false);
-    bit_writer(hclen, 4, bits_written, out, false);
+/**
+ * Decides whether the next chunk joins the open block, coded with the codes
+ * the block already has.
+ * @param group The open block
+ * @param hist Histogram of the chunk
+ * @param chunk_plan huffman_plan_block for hist alone
+ * @return 1 if the chunk joins the open block (or the group is empty),
+ *         0 if the open block has to be emitted first
+ */
+int huff_group_fits(huff_group_t* group, const lz_hist_t* hist, const huff_plan_t* chunk_plan) {
+    if (group->chunks == 0) return 1;
+    if (group->chunks == HUFF_GROUP_MAX_CHUNKS) return 0;
+
+    unsigned long cost = reuse_cost(&group->plan, hist);
+    if (cost == ULONG_MAX) return 0;
+    // A block of its own also pays BFINAL/BTYPE
+    unsigned long own = chunk_plan->bits + 3;
+    if (cost > own + own / HUFF_GROUP_REUSE_SLACK) return 0;
+    group->reuse_bits = cost;
+    return 1;
+}
 
-    for (int j = 0; j < hclen + 4; j++) {
-        bit_writer(cl_lens[cl_order[j]], 3, bits_written, out, false);
+/**
+ * Adds a chunk to the open block, with the cost huff_group_fits worked out.
+ * @param group The open block, emitted first if huff_group_fits returned 0
+ * @param tokens Tokens of the chunk, copied
+ * @param num_tokens Number of entries in tokens
+ * @param chunk_plan huffman_plan_block for the chunk alone
+ * @param in_len Input bytes the chunk covers
+ */
+void huff_group_append(huff_group_t* group, const lz_packed_t* tokens, size_t num_tokens, const huff_plan_t* chunk_plan, size_t in_len) {
+    if (group->chunks == 0) {
+        group->plan = *chunk_plan;
+    } else {
+        group->plan.bits += group->reuse_bits;
     }
+    memcpy(group->tokens + group->num_tokens, tokens, num_tokens * sizeof(lz_packed_t));
+    group->num_tokens += num_tokens;
+    group->in_len += in_len;
+    group->chunks++;
+}
+
+/**
+ * Writes the open block and empties the group.
+ * @param group The open block, at least one chunk
+ * @param is_last Whether to set BFINAL
+ * @param out Zeroed output with room for 3 + group->plan.bits more bits
+ * @param bit_pos Bit position in out, advanced past the block
+ */
+void huff_group_emit(huff_group_t* group, int is_last, unsigned char* out, unsigned long* bit_pos) {
+    unsigned int header_val = (is_last ? BF_SET : 0) | ((unsigned int)group->plan.btype << 1);
+    bit_writer(header_val, 3, bit_pos, out, false);
+    huffman_emit_block(&group->plan, group->tokens, group->num_tokens, out, bit_pos);
+    group->num_tokens = 0;
+    group->in_len = 0;
+    group->chunks = 0;
+}
 
-    for (int j = 0; j < total_cl; j++) {
-        unsigned char len = combined_lens[j];
-        bit_writer(cl_codes[len], cl_lens[len], bits_written, out, true);
+/** ================================================================
+ * HUFFMAN ENCODE PACKED: Top-level encoder for packed LZ77 token arrays
+ * @param tokens An array of packed LZ tokens (either a literal value or length-distance pair)
+ * @param num_tokens Length of `tokens`
+ * @param bits_written Total number of bits written
+ * @param out_len To be set to the length of the returned encoded data
+ * @param returned_btype To be set to the most efficient Huffman BTYPE for the data (01 - static or 10 - dynamic)
+ * @return Dynamically allocated array of compressed block data
+ */
+unsigned char* huffman_encode_packed(const lz_packed_t* tokens, size_t num_tokens, unsigned long* bits_written, size_t* out_len, unsigned char *returned_btype) {
+    if (!tokens || num_tokens == 0) {
+        if (out_len) *out_len = 0;
+        return NULL;
     }
 
-    // === PART 5: WRITE ENCODED DATA ===
+    lz_hist_t hist;
+    memset(&hist, 0, sizeof(hist));
     for (size_t i = 0; i < num_tokens; i++) {
-        // Grow buffer if needed
-        size_t byte_pos = *bits_written / 8;
-        if (byte_pos + 8 >= alloc) {
-            alloc *= 2;
-            unsigned char* tmp = realloc(out, alloc);
-            if (!tmp) { free(out); free_tree(lit_root); if (dist_root) free_tree(dist_root); free_tree(cl_root); return NULL; }
-            memset(tmp + byte_pos, 0, alloc - byte_pos);
-            out = tmp;
-        }
-
-        if (tokens[i].is_literal) {
-            unsigned int sym = tokens[i].literal;
-            bit_writer(lit_codes[sym], lit_lens[sym], bits_written, out, true);
+        if (LZ_PACKED_IS_LITERAL(tokens[i])) {
+            hist.lit_freq[LZ_PACKED_LITERAL(tokens[i])]++;
         } else {
             unsigned int extra_val;
-            int len_idx = length_to_code(tokens[i].length, &extra_val);
-            unsigned int sym = 257 + len_idx;
-            bit_writer(lit_codes[sym], lit_lens[sym], bits_written, out, true);
-            if (len_table[len_idx].extra > 0)
-                bit_writer(extra_val, len_table[len_idx].extra, bits_written, out, false);
-
-            unsigned int dist_extra;
-            int dist_idx = distance_to_code(tokens[i].distance, &dist_extra);
-            bit_writer(dist_codes[dist_idx], dist_lens[dist_idx], bits_written, out, true);
-            if (dist_table[dist_idx].extra > 0)
-                bit_writer(dist_extra, dist_table[dist_idx].extra, bits_written, out, false);
+            hist.lit_freq[257 + length_to_code(LZ_PACKED_LENGTH(tokens[i]), &extra_val)]++;
+            hist.dist_freq[distance_to_code(LZ_PACKED_DISTANCE(tokens[i]), &extra_val)]++;
         }
     }
 
-    // Write end-of-block (symbol 256)
-    bit_writer(lit_codes[256], lit_lens[256], bits_written, out, true);
+    huff_plan_t plan;
+    if (huffman_plan_block(&hist, &plan) != 0) return NULL;
 
-    // Cleanup
-    free_tree(lit_root);
-    if (dist_root) free_tree(dist_root);
-    free_tree(cl_root);
+    unsigned char* out = calloc((plan.bits + 7) / 8 + 1, 1);
+    if (!out) return NULL;
+    *bits_written = 0;
+    huffman_emit_block(&plan, tokens, num_tokens, out, bits_written);
 
     *out_len = (*bits_written + 7) / 8;
+    *returned_btype = plan.btype;
     return out;
 }
 
 /** ================================================================
  * HUFFMAN ENCODE TOKENS: Top-level encoder for LZ77 token arrays
+ * Packs the tokens and defers to huffman_encode_packed.
  * @param tokens An array of LZ objects (either a literal value or length-distance pair)
  * @param num_tokens Length of `tokens`
  * @param bits_written Total number of bits written
@@ -549,103 +857,84 @@ unsigned char* huffman_encode_tokens(const lz_token_t* tokens, size_t num_tokens
         return NULL;
     }
 
-    unsigned long bw_fixed = 0, bw_dynamic = 0;
-    size_t size_fixed = 0, size_dynamic = 0;
-
-    unsigned char *fixed_out = encode_fixed_huffman_tokens(tokens, num_tokens, &bw_fixed, &size_fixed);
-    unsigned char *dynamic_out = encode_dynamic_huffman_tokens(tokens, num_tokens, &bw_dynamic, &size_dynamic);
+    lz_packed_t* packed = lz_pack_tokens(tokens, num_tokens);
+    if (!packed) return NULL;
+    unsigned char* out = huffman_encode_packed(packed, num_tokens, bits_written, out_len, returned_btype);
+    free(packed);
+    return out;
+}
 
-    if (dynamic_out && (!fixed_out || size_dynamic <= size_fixed)) {
-        free(fixed_out);
-        *out_len = size_dynamic;
-        *bits_written = bw_dynamic;
-        *returned_btype = BT_DYNAMIC;
-        return dynamic_out;
-    } else {
-        free(dynamic_out);
-        *out_len = size_fixed;
-        *bits_written = bw_fixed;
-        *returned_btype = BT_STATIC;
-        return fixed_out;
-    }
+/* Fixed-code decoders (RFC 1951 3.2.6), built once and only read afterwards */
+static huff_decoder_t fixed_lit_dec;
+static huff_decoder_t fixed_dist_dec;
+static pthread_once_t fixed_decoders_once = PTHREAD_ONCE_INIT;
+
+static void make_fixed_decoders(void) {
+	unsigned char lit_lens[NUM_SYMS_AND_LENGTHS];
+	unsigned char d_lens[NUM_DISTANCES];
+	for (int i = 0; i <= 143; i++)   lit_lens[i] = 8;
+	for (int i = 144; i <= 255; i++) lit_lens[i] = 9;
+	for (int i = 256; i <= 279; i++) lit_lens[i] = 7;
+	for (int i = 280; i <= 287; i++) lit_lens[i] = 8;
+	build_decoder(&fixed_lit_dec, lit_lens, NUM_SYMS_AND_LENGTHS);
+
+	// Fixed distance codes: all 5-bit codes (0-29)
+	for (int i = 0; i < NUM_DISTANCES; i++) d_lens[i] = 5;
+	build_decoder(&fixed_dist_dec, d_lens, NUM_DISTANCES);
 }
 
-/* ================================================================
- * HUFFMAN DECODE
- *
- * Decodes a Huffman-encoded bitstream back to raw bytes.
- * btype_val tells us how the stream is structured:
- *   BT_STATIC (1): fixed Huffman codes, data starts at bit 0
- *   BT_DYNAMIC (2): dynamic header + data
- *
- * Returns malloc'd buffer of decoded bytes, sets *out_len.
- * ================================================================ */
 /**
- * @param data: Huffman data to be processed (possibly LZ77 as well)
- * @param enc_len: Length of encoded data
- * @param btype_val: The type of huffman encoding used to encode the data
- * @param returned_btype: The encoding of smaller size out of static and dynamic
- * @param history: Previously uncompressed data
- * @param history_len: Length of history
- * @return Decompressed data
+ * Reads the code description at the start of a block.
+ * @param lit_store, dist_store: Filled in for a dynamic block
+ * @param lit_dec, dist_dec: Set to the decoders to use, the shared fixed
+ *        ones for BT_STATIC and lit_store/dist_store for BT_DYNAMIC
+ * @return 0 on success, -1 if the header is truncated or malformed
  */
-unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigned int btype_val, unsigned long *bits_read, size_t* out_len, const unsigned char* history, size_t history_len) {
-	if (!data || enc_len == 0 || !out_len) return NULL;
-
-	huff_decoder_t lit_dec;
-	huff_decoder_t dist_dec;
+static int read_block_codes(const unsigned char* data, unsigned long bit_limit, unsigned int btype_val, unsigned long* bits_read, huff_decoder_t* lit_store, huff_decoder_t* dist_store, const huff_decoder_t** lit_dec, const huff_decoder_t** dist_dec) {
 	unsigned char lit_lens[NUM_SYMS_AND_LENGTHS] = {0};
-	unsigned long lit_codes[NUM_SYMS_AND_LENGTHS] = {0};
 	unsigned char d_lens[NUM_DISTANCES] = {0};
-	unsigned long d_codes[NUM_DISTANCES] = {0};
 
 	if (btype_val == BT_STATIC)
 	{
-		// Build fixed Huffman code lengths per RFC 1951 3.2.6
-		for (int i = 0; i <= 143; i++)   lit_lens[i] = 8;
-		for (int i = 144; i <= 255; i++) lit_lens[i] = 9;
-		lit_lens[256] = 7; // EOB
-		for (int i = 257; i <= 279; i++) lit_lens[i] = 7;
-		for (int i = 280; i <= 287; i++) lit_lens[i] = 8;
-
-		canonical_codes(lit_lens, lit_codes, NUM_SYMS_AND_LENGTHS);
-		build_decoder(&lit_dec, lit_lens, NUM_SYMS_AND_LENGTHS);
-
-		// Fixed distance codes: all 5-bit codes (0-29)
-		for (int i = 0; i < NUM_DISTANCES; i++) d_lens[i] = 5;
-		canonical_codes(d_lens, d_codes, NUM_DISTANCES);
-		build_decoder(&dist_dec, d_lens, NUM_DISTANCES);
+		pthread_once(&fixed_decoders_once, make_fixed_decoders);
+		*lit_dec = &fixed_lit_dec;
+		*dist_dec = &fixed_dist_dec;
 	}
 	else if (btype_val == BT_DYNAMIC)
 	{
 		// Read dynamic Huffman header
 		unsigned int hlit_val = 0, hdist_val = 0, hclen_val = 0;
-		bit_reader(data + (*bits_read / 8), 5, bits_read, &hlit_val, false);
-		bit_reader(data + (*bits_read / 8), 5, bits_read, &hdist_val, false);
-		bit_reader(data + (*bits_read / 8), 4, bits_read, &hclen_val, false);
+		if (read_bits(data, 5, bits_read, bit_limit, &hlit_val) != 0 ||
+			read_bits(data, 5, bits_read, bit_limit, &hdist_val) != 0 ||
+			read_bits(data, 4, bits_read, bit_limit, &hclen_val) != 0) {
+			debug("huffman: decode: truncated dynamic header");
+			return -1;
+		}
 
 		int num_lit = hlit_val + 257;
 		int num_dist = hdist_val + 1;
 		int num_cl = hclen_val + 4;
+		// 286/287 and 30/31 can be encoded but are not valid codes (RFC 1951 3.2.7)
+		if (num_lit > 286 || num_dist > NUM_DISTANCES) {
+			debug("huffman: decode: bad HLIT %d / HDIST %d", num_lit, num_dist);
+			return -1;
+		}
 
 		// Read code length code lengths (3 bits each, LSB first)
-		static const unsigned char cl_order[NUM_CODE_LENGTH_CODES] = {
-			16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-		};
 		unsigned char cl_lens_arr[NUM_CODE_LENGTH_CODES] = {0};
-		unsigned long cl_codes_arr[NUM_CODE_LENGTH_CODES] = {0};
 
 		for (int i = 0; i < num_cl; i++) {
 			unsigned int val = 0;
-			bit_reader(data + (*bits_read / 8), 3, bits_read, &val, false);
+			if (read_bits(data, 3, bits_read, bit_limit, &val) != 0) return -1;
 			cl_lens_arr[cl_order[i]] = (unsigned char)val;
 		}
 
-		canonical_codes(cl_lens_arr, cl_codes_arr, NUM_CODE_LENGTH_CODES);
-
 		// Build code length decoder
 		huff_decoder_t cl_dec;
-		build_decoder(&cl_dec, cl_lens_arr, NUM_CODE_LENGTH_CODES);
+		if (build_decoder(&cl_dec, cl_lens_arr, NUM_CODE_LENGTH_CODES) != 0) {
+			debug("huffman: decode: over-subscribed code length code");
+			return -1;
+		}
 
 		// Decode lit/len + distance code lengths
 		int total_codes = num_lit + num_dist;
@@ -653,55 +942,89 @@ unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigne
 		int idx = 0;
 
 		while (idx < total_codes) {
-			int sym = decode_symbol(&cl_dec, data, bits_read);
+			int sym = decode_symbol(&cl_dec, data, bits_read, bit_limit);
 			if (sym < 0) {
 				debug("huffman: decode: failed to decode code length symbol at idx %d", idx);
-				return NULL;
+				return -1;
 			}
 
 			if (sym <= 15) {
 				all_lens[idx++] = (unsigned char)sym;
 			}
-			else if (sym == 16) {
-				unsigned int extra = 0;
-				bit_reader(data + (*bits_read / 8), 2, bits_read, &extra, false);
-				int repeat = extra + 3;
-				unsigned char prev = (idx > 0) ? all_lens[idx - 1] : 0;
-				for (int r = 0; r < repeat && idx < total_codes; r++)
-					all_lens[idx++] = prev;
-			}
-			else if (sym == 17) {
-				unsigned int extra = 0;
-				bit_reader(data + (*bits_read / 8), 3, bits_read, &extra, false);
-				int repeat = extra + 3;
-				for (int r = 0; r < repeat && idx < total_codes; r++)
-					all_lens[idx++] = 0;
-			}
-			else if (sym == 18) {
+			else {
+				// 16 repeats the previous length 3-6 times, 17/18 repeat zero 3-10/11-138 times
 				unsigned int extra = 0;
-				bit_reader(data + (*bits_read / 8), 7, bits_read, &extra, false);
-				int repeat = extra + 11;
-				for (int r = 0; r < repeat && idx < total_codes; r++)
-					all_lens[idx++] = 0;
+				unsigned int extra_bits = sym == 16 ? 2 : sym == 17 ? 3 : 7;
+				if (read_bits(data, extra_bits, bits_read, bit_limit, &extra) != 0) return -1;
+				int repeat = extra + (sym == 18 ? 11 : 3);
+				if ((sym == 16 && idx == 0) || idx + repeat > total_codes) {
+					debug("huffman: decode: code length repeat out of range at idx %d", idx);
+					return -1;
+				}
+				unsigned char fill = sym == 16 ? all_lens[idx - 1] : 0;
+				for (int r = 0; r < repeat; r++)
+					all_lens[idx++] = fill;
 			}
 		}
+		if (all_lens[256] == 0) {
+			debug("huffman: decode: block has no end-of-block code");
+			return -1;
+		}
 
 		// Split into lit/len and distance code lengths
 		memcpy(lit_lens, all_lens, num_lit);
-		canonical_codes(lit_lens, lit_codes, NUM_SYMS_AND_LENGTHS);
-		build_decoder(&lit_dec, lit_lens, NUM_SYMS_AND_LENGTHS);
+		if (build_decoder(lit_store, lit_lens, NUM_SYMS_AND_LENGTHS) != 0) {
+			debug("huffman: decode: over-subscribed literal/length code");
+			return -1;
+		}
 
 		// Build distance decoder
 		for (int i = 0; i < num_dist && i < NUM_DISTANCES; i++)
 			d_lens[i] = all_lens[num_lit + i];
-		canonical_codes(d_lens, d_codes, NUM_DISTANCES);
-		build_decoder(&dist_dec, d_lens, NUM_DISTANCES);
+		if (build_decoder(dist_store, d_lens, NUM_DISTANCES) != 0) {
+			debug("huffman: decode: over-subscribed distance code");
+			return -1;
+		}
+		*lit_dec = lit_store;
+		*dist_dec = dist_store;
 	}
 	else
 	{
 		debug("huffman: decode: unsupported btype %u", btype_val);
-		return NULL;
+		return -1;
 	}
+	return 0;
+}
+
+/* ================================================================
+ * HUFFMAN DECODE
+ *
+ * Decodes a Huffman-encoded bitstream back to raw bytes.
+ * btype_val tells us how the stream is structured:
+ *   BT_STATIC (1): fixed Huffman codes, data starts at bit 0
+ *   BT_DYNAMIC (2): dynamic header + data
+ *
+ * Returns malloc'd buffer of decoded bytes, sets *out_len.
+ * ================================================================ */
+/**
+ * @param data: Huffman data to be processed (possibly LZ77 as well)
+ * @param enc_len: Length of encoded data
+ * @param btype_val: The type of huffman encoding used to encode the data
+ * @param returned_btype: The encoding of smaller size out of static and dynamic
+ * @param history: Previously uncompressed data
+ * @param history_len: Length of history
+ * @return Decompressed data
+ */
+unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigned int btype_val, unsigned long *bits_read, size_t* out_len, const unsigned char* history, size_t history_len) {
+	if (!data || enc_len == 0 || !out_len || !bits_read) return NULL;
+
+	// Every read below is checked against this, the input is untrusted
+	unsigned long bit_limit = (unsigned long)enc_len * 8;
+	huff_decoder_t lit_store, dist_store;
+	const huff_decoder_t* lit_dec;
+	const huff_decoder_t* dist_dec;
+	if (read_block_codes(data, bit_limit, btype_val, bits_read, &lit_store, &dist_store, &lit_dec, &dist_dec) != 0)
+		return NULL;
 
 	// Decode data symbols - full DEFLATE: literals, lengths+distances, EOB
 	// Prepend history so distance references across blocks work naturally.
@@ -714,7 +1037,7 @@ unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigne
 		memcpy(out, history, history_len);
 
 	for (;;) {
-		int sym = decode_symbol(&lit_dec, data, bits_read);
+		int sym = decode_symbol(lit_dec, data, bits_read, bit_limit);
 		if (sym < 0) {
 			debug("huffman: decode: failed to decode symbol at out_ix %zu", out_ix);
 			free(out);
@@ -739,12 +1062,14 @@ unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigne
 			unsigned int length = len_table[len_idx].base;
 			if (len_table[len_idx].extra > 0) {
 				unsigned int extra_val = 0;
-				bit_reader(data + (*bits_read / 8), len_table[len_idx].extra, bits_read, &extra_val, false);
-				*bits_read = *bits_read + 1;
+				if (read_bits(data, len_table[len_idx].extra, bits_read, bit_limit, &extra_val) != 0) {
+					free(out);
+					return NULL;
+				}
 				length += extra_val;
 			}
 
-			int dist_sym = decode_symbol(&dist_dec, data, bits_read);
+			int dist_sym = decode_symbol(dist_dec, data, bits_read, bit_limit);
 			if (dist_sym < 0 || dist_sym >= 30) {
 				debug("huffman: decode: invalid distance code %d", dist_sym);
 				free(out);
@@ -753,10 +1078,18 @@ unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigne
 			unsigned int distance = dist_table[dist_sym].base;
 			if (dist_table[dist_sym].extra > 0) {
 				unsigned int extra_val = 0;
-				bit_reader(data + (*bits_read / 8), dist_table[dist_sym].extra, bits_read, &extra_val, false);
-				*bits_read = *bits_read + 1;
+				if (read_bits(data, dist_table[dist_sym].extra, bits_read, bit_limit, &extra_val) != 0) {
+					free(out);
+					return NULL;
+				}
 				distance += extra_val;
 			}
+			// A reference may reach into history, but not before the start of the member
+			if (distance > out_ix) {
+				debug("huffman: decode: distance %u too far back at out_ix %zu", distance, out_ix);
+				free(out);
+				return NULL;
+			}
 
 			while (out_ix + length > cap) {
 				cap *= 2;
@@ -788,3 +1121,96 @@ unsigned char* huffman_decode(const unsigned char* data, size_t enc_len, unsigne
 	free(out);
 	return result;
 }
+
+/**
+ * Folds the bytes decoded since the last flush into the window's CRC. The
+ * ring holds twice the match distance, so they are still there.
+ * @param window The window to flush
+ */
+void huff_window_flush(huff_window_t* window) {
+	while (window->checked < window->pos) {
+		size_t start = window->checked & (HUFF_RING_SIZE - 1);
+		size_t len = window->pos - window->checked;
+		if (len > HUFF_RING_SIZE - start) len = HUFF_RING_SIZE - start;
+		window->crc = crc_update(window->crc, window->ring + start, len);
+		window->checked += len;
+	}
+}
+
+/**
+ * @param window The window to append to
+ * @param buf Decoded bytes, e.g. the contents of a stored block
+ * @param len Length of buf
+ */
+void huff_window_write(huff_window_t* window, const unsigned char* buf, size_t len) {
+	while (len > 0) {
+		size_t start = window->pos & (HUFF_RING_SIZE - 1);
+		size_t n = HUFF_WINDOW_SIZE - (window->pos - window->checked);
+		if (n > HUFF_RING_SIZE - start) n = HUFF_RING_SIZE - start;
+		if (n > len) n = len;
+		memcpy(window->ring + start, buf, n);
+		window->pos += n;
+		buf += n;
+		len -= n;
+		if (window->pos - window->checked >= HUFF_WINDOW_SIZE)
+			huff_window_flush(window);
+	}
+}
+
+/**
+ * Walks one compressed block the way huffman_decode does, with the same
+ * checks, but without keeping its output: no growing buffer and, without
+ * a window, no match copies either.
+ * @param data: Huffman data to be processed
+ * @param enc_len: Length of encoded data
+ * @param btype_val: BT_STATIC or BT_DYNAMIC
+ * @param bits_read: Bit position of the block body, advanced past its end-of-block code
+ * @param produced: Bytes the member decoded to before this block, bounds distances
+ * @param out_len: Set to the number of bytes the block decodes to
+ * @param window: Decodes the block into this window when not NULL
+ * @return 0 on success, -1 if the block is truncated or malformed
+ */
+int huffman_skip_block(const unsigned char* data, size_t enc_len, unsigned int btype_val, unsigned long* bits_read, size_t produced, size_t* out_len, huff_window_t* window) {
+	if (!data || enc_len == 0 || !out_len || !bits_read) return -1;
+
+	unsigned long bit_limit = (unsigned long)enc_len * 8;
+	huff_decoder_t lit_store, dist_store;
+	const huff_decoder_t* lit_dec;
+	const huff_decoder_t* dist_dec;
+	if (read_block_codes(data, bit_limit, btype_val, bits_read, &lit_store, &dist_store, &lit_dec, &dist_dec) != 0)
+		return -1;
+
+	size_t out_ix = produced;
+	for (;;) {
+		int sym = decode_symbol(lit_dec, data, bits_read, bit_limit);
+		if (sym < 0 || sym > 285) return -1;
+		if (sym == 256) break;
+		if (sym < 256) {
+			out_ix++;
+			if (window)
+				window->ring[window->pos++ & (HUFF_RING_SIZE - 1)] = (unsigned char)sym;
+		}
+		else {
+			unsigned int extra_val = 0;
+			int len_idx = sym - 257;
+			if (read_bits(data, len_table[len_idx].extra, bits_read, bit_limit, &extra_val) != 0) return -1;
+			unsigned int length = len_table[len_idx].base + extra_val;
+
+			int dist_sym = decode_symbol(dist_dec, data, bits_read, bit_limit);
+			if (dist_sym < 0 || dist_sym >= NUM_DISTANCES) return -1;
+			if (read_bits(data, dist_table[dist_sym].extra, bits_read, bit_limit, &extra_val) != 0) return -1;
+			unsigned int distance = dist_table[dist_sym].base + extra_val;
+			if (distance > out_ix) return -1;
+			out_ix += length;
+			if (window) {
+				for (unsigned int i = 0; i < length; i++, window->pos++)
+					window->ring[window->pos & (HUFF_RING_SIZE - 1)] = window->ring[(window->pos - distance) & (HUFF_RING_SIZE - 1)];
+			}
+		}
+		// At most one match past the window, far from overwriting unchecked bytes
+		if (window && window->pos - window->checked >= HUFF_WINDOW_SIZE)
+			huff_window_flush(window);
+	}
+	*out_len = out_ix - produced;
+	return 0;
+}
@@ -1,13 +1,118 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "lz.h"
 #include "debug.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LZ_HAVE_X86_SIMD 1
+#endif
 
 #define WINDOW_SIZE 32768 // Allowed reference of previous strings (allowed to span previous blocks)
 #define MAX_MATCH   258 // Max range of matches 3.2.5 (max(3-258) => max(0-255))
 #define MIN_MATCH  3
 
 
+/**
+ * Portable match extension: compares 8 bytes per step by XORing two words
+ * and counting the trailing (leading on big-endian) zero bits of the result.
+ * @return Number of leading bytes that are equal in a and b, at most max_len
+ */
+static size_t match_length_word(const unsigned char* a, const unsigned char* b, size_t max_len) {
+	size_t n = 0;
+	while (n + sizeof(uint64_t) <= max_len) {
+		uint64_t wa, wb;
+		memcpy(&wa, a + n, sizeof(wa));
+		memcpy(&wb, b + n, sizeof(wb));
+		uint64_t diff = wa ^ wb;
+		if (diff) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			return n + ((size_t)__builtin_clzll(diff) >> 3);
+#else
+			return n + ((size_t)__builtin_ctzll(diff) >> 3);
+#endif
+		}
+		n += sizeof(uint64_t);
+	}
+	while (n < max_len && a[n] == b[n])
+		n++;
+	return n;
+}
+
+#ifdef LZ_HAVE_X86_SIMD
+/**
+ * SSE2 match extension: 16 bytes per step, the first differing byte is the
+ * lowest clear bit of the byte-equality mask.
+ */
+__attribute__((target("sse2")))
+static size_t match_length_sse2(const unsigned char* a, const unsigned char* b, size_t max_len) {
+	size_t n = 0;
+	while (n + 16 <= max_len) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + n));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + n));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+		if (mask != 0xFFFF)
+			return n + (size_t)__builtin_ctz(~mask);
+		n += 16;
+	}
+	return n + match_length_word(a + n, b + n, max_len - n);
+}
+
+/**
+ * AVX2 match extension: 32 bytes per step.
+ */
+__attribute__((target("avx2")))
+static size_t match_length_avx2(const unsigned char* a, const unsigned char* b, size_t max_len) {
+	size_t n = 0;
+	while (n + 32 <= max_len) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + n));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + n));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+		if (mask != 0xFFFFFFFFu)
+			return n + (size_t)__builtin_ctz(~mask);
+		n += 32;
+	}
+	return n + match_length_sse2(a + n, b + n, max_len - n);
+}
+#endif
+
+typedef size_t (*match_length_fn)(const unsigned char*, const unsigned char*, size_t);
+
+static match_length_fn match_length_impl = NULL;
+
+/**
+ * Picks the widest match extension routine the running CPU supports.
+ */
+static match_length_fn select_match_length(void) {
+#ifdef LZ_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return match_length_avx2;
+	if (__builtin_cpu_supports("sse2")) return match_length_sse2;
+#endif
+	return match_length_word;
+}
+
+/**
+ * Count how many bytes starting at a and b are equal, up to max_len.
+ * The implementation is chosen once per process by runtime CPU dispatch.
+ * @param a: First byte stream (the earlier reference in the LZ window)
+ * @param b: Second byte stream (the current position)
+ * @param max_len: Maximum number of bytes that may be compared
+ * @return Length of the common prefix of a and b
+ */
+size_t lz_match_length(const unsigned char* a, const unsigned char* b, size_t max_len) {
+	// Racing threads all store the same pointer, so a relaxed atomic is enough
+	match_length_fn impl = __atomic_load_n(&match_length_impl, __ATOMIC_RELAXED);
+	if (!impl) {
+		impl = select_match_length();
+		__atomic_store_n(&match_length_impl, impl, __ATOMIC_RELAXED);
+	}
+	return impl(a, b, max_len);
+}
+
 /**
  * Find longest match of data[pos..] in data[pos - offset_limit .. pos - 1].
  * Return length (0 if none); store best offset in *out_offset.
@@ -25,34 +130,98 @@ static int find_match(const unsigned char* data, size_t pos, size_t len,
 	size_t start = pos > offset_limit ? pos - offset_limit : 0; // if there is from here to outlast sliding window.len (offset_limit), use all offset_limit, otherwise max= chars behind pos = pos
 	size_t max_len = len - pos;
 	if (max_len > MAX_MATCH) max_len = MAX_MATCH;
+	ZSTAT_LOCAL(uint64_t probes = 0; uint64_t compares = 0;)
 	for (size_t off = 1; off <= pos - start && off <= WINDOW_SIZE; off++) {
 		size_t ref = pos - off;
-		int match_len = 0;
-		// Continue extending the length for the string as long as it can 
-		while (match_len < (int)max_len && data[ref + match_len] == data[pos + match_len])
-			match_len++;
-		
-        best_len = match_len;
-        best_offset = off;
+		ZSTAT_LOCAL(probes++;)
+		// Cheap first-byte reject before calling into the wide comparator
+		if (data[ref] != data[pos]) continue;
+		ZSTAT_LOCAL(compares++;)
+		// Continue extending the length for the string as long as it can
+		int match_len = (int)lz_match_length(data + ref, data + pos, max_len);
+
+		// Strictly longer only, so the closest reference wins ties
+		if (match_len > best_len) {
+			best_len = match_len;
+			best_offset = off;
+			if (best_len == (int)max_len) break;
+		}
 	}
+	ZSTAT_ADD(lz_window_probes, probes);
+	ZSTAT_ADD(lz_match_compares, compares);
 	*out_offset = best_offset; // return best match offset
 	return best_len; // Return length of the best match found
 }
 
 
+/* Base values of the DEFLATE length and distance codes (RFC 1951 3.2.5) */
+static const unsigned short length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned short distance_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+/* length_code[len - 3] = length code index; distances 1-256 index dist_code_lo[dist - 1],
+ * larger ones index dist_code_hi[(dist - 1) >> 7] (codes >= 16 cover multiples of 128) */
+static unsigned char length_code[MAX_MATCH - MIN_MATCH + 1];
+static unsigned char dist_code_lo[256];
+static unsigned char dist_code_hi[256];
+static pthread_once_t code_tables_once = PTHREAD_ONCE_INIT;
+
+static void make_code_tables(void) {
+	int code = 0;
+	for (int len = MIN_MATCH; len <= MAX_MATCH; len++) {
+		while (code < 28 && len >= length_base[code + 1]) code++;
+		length_code[len - MIN_MATCH] = (unsigned char)code;
+	}
+	code = 0;
+	for (int dist = 1; dist <= 256; dist++) {
+		while (code < 29 && dist >= distance_base[code + 1]) code++;
+		dist_code_lo[dist - 1] = (unsigned char)code;
+	}
+	for (int i = 0; i < 256; i++) {
+		int dist = (i << 7) + 1;
+		code = 0;
+		while (code < 29 && dist >= distance_base[code + 1]) code++;
+		dist_code_hi[i] = (unsigned char)code;
+	}
+}
+
 /**
- * @param: data: stream of data 
- * @param: len: length of the data
- * @param num_tokens: the number of tokens stored when running on the data
- * @return An array of tokens that contain a concise form of LZ77 data, rather literal or length-distance entries stored in raw data form 
+ * Map a match length (3-258) to its DEFLATE length code index (0-28).
  */
-lz_token_t* lz_compress_tokens(const unsigned char* data, size_t len, size_t* num_tokens) {
-    if (!data || !num_tokens) return NULL;
-    size_t cap = len; // worst case: all literals
-    lz_token_t* tokens = NULL;
-    if (!tokens) return NULL;
+int lz_length_code(unsigned int length) {
+	pthread_once(&code_tables_once, make_code_tables);
+	return length_code[length - MIN_MATCH];
+}
+
+/**
+ * Map a match distance (1-32768) to its DEFLATE distance code index (0-29).
+ */
+int lz_distance_code(unsigned int distance) {
+	pthread_once(&code_tables_once, make_code_tables);
+	return distance <= 256 ? dist_code_lo[distance - 1] : dist_code_hi[(distance - 1) >> 7];
+}
+
+/**
+ * Tokenize one block into a caller-owned buffer, counting literal/length
+ * and distance symbol frequencies as tokens are produced so the Huffman
+ * stage does not need a separate counting pass.
+ * @param data: Block data
+ * @param len: Length of the block
+ * @param tokens: Output buffer with room for at least len tokens
+ * @param hist: Histogram to add symbol counts to, or NULL
+ * @return Number of tokens written
+ */
+size_t lz_compress_block(const unsigned char* data, size_t len, lz_packed_t* tokens, lz_hist_t* hist) {
+    pthread_once(&code_tables_once, make_code_tables);
+    ZSTAT_BEGIN(ZSTAT_LZ_SEARCH);
     size_t count = 0;
-    size_t pos;
+    size_t pos = 0;
+    ZSTAT_LOCAL(size_t matches = 0;)
     size_t offset_limit = WINDOW_SIZE;
     if (offset_limit > len) offset_limit = len;
 
@@ -60,31 +229,94 @@ lz_token_t* lz_compress_tokens(const unsigned char* data, size_t len, size_t* nu
         size_t best_offset;
         int match_len = find_match(data, pos, len, offset_limit, &best_offset);
 
-        if (match_len >= 0) {
-            tokens[count].is_literal = 0;
-            tokens[count].literal = 0;
-            tokens[count].length = (unsigned int)match_len;
-            tokens[count].distance = (unsigned int)best_offset;
-            count++;
-            pos++;
-        } else 
-        {
-            tokens[count].is_literal = 1;
-            tokens[count].literal = data[pos];
-            tokens[count].length = 0;
-            tokens[count].distance = 0;
-            count++;
+        if (match_len >= MIN_MATCH) {
+            tokens[count++] = LZ_PACK_MATCH((unsigned int)match_len, (unsigned int)best_offset);
+            if (hist) {
+                hist->lit_freq[257 + length_code[match_len - MIN_MATCH]]++;
+                hist->dist_freq[best_offset <= 256 ? dist_code_lo[best_offset - 1]
+                                                   : dist_code_hi[(best_offset - 1) >> 7]]++;
+            }
+            pos += (size_t)match_len;
+            ZSTAT_LOCAL(matches++;)
+        } else {
+            tokens[count++] = LZ_PACK_LITERAL(data[pos]);
+            if (hist) hist->lit_freq[data[pos]]++;
             pos++;
         }
+    }
+    ZSTAT_ADD(lz_positions, count);
+    ZSTAT_ADD(lz_matches, matches);
+    ZSTAT_ADD(lz_match_bytes, len - (count - matches));
+    ZSTAT_ADD(lz_literals, count - matches);
+    ZSTAT_END(ZSTAT_LZ_SEARCH);
+    return count;
+}
 
-        if (count >= cap) {
-            cap *= 2;
-            lz_token_t* tmp = realloc(tokens, cap * sizeof(lz_token_t));
-            if (!tmp) { free(tokens); return NULL; }
-            tokens = tmp;
-        }
+/**
+ * @param: data: stream of data
+ * @param: len: length of the data
+ * @param num_tokens: the number of tokens stored when running on the data
+ * @return An array of 4-byte packed tokens (see lz.h), one per literal or length-distance pair
+ */
+lz_packed_t* lz_compress_packed(const unsigned char* data, size_t len, size_t* num_tokens) {
+    if (!data || !num_tokens) return NULL;
+    // Every token consumes at least one input byte, so len + 1 never overflows
+    lz_packed_t* tokens = malloc((len + 1) * sizeof(lz_packed_t));
+    if (!tokens) return NULL;
+    *num_tokens = lz_compress_block(data, len, tokens, NULL);
+    return tokens;
+}
+
+/**
+ * Expand packed tokens into the wide lz_token_t layout.
+ * @param packed: Packed token stream
+ * @param num_tokens: Number of entries in packed
+ * @return malloc'd array of num_tokens lz_token_t, or NULL on error
+ */
+lz_token_t* lz_unpack_tokens(const lz_packed_t* packed, size_t num_tokens) {
+    lz_token_t* tokens = malloc((num_tokens ? num_tokens : 1) * sizeof(lz_token_t));
+    if (!tokens) return NULL;
+    for (size_t i = 0; i < num_tokens; i++) {
+        lz_packed_t t = packed[i];
+        tokens[i].is_literal = LZ_PACKED_IS_LITERAL(t);
+        tokens[i].literal    = tokens[i].is_literal ? LZ_PACKED_LITERAL(t) : 0;
+        tokens[i].length     = tokens[i].is_literal ? 0 : LZ_PACKED_LENGTH(t);
+        tokens[i].distance   = tokens[i].is_literal ? 0 : LZ_PACKED_DISTANCE(t);
     }
-    *num_tokens = count;
     return tokens;
 }
 
+/**
+ * Pack wide tokens into 4-byte tokens.
+ * @param tokens: Wide token stream (lengths 3-258, distances 1-32768)
+ * @param num_tokens: Number of entries in tokens
+ * @return malloc'd array of num_tokens lz_packed_t, or NULL on error
+ */
+lz_packed_t* lz_pack_tokens(const lz_token_t* tokens, size_t num_tokens) {
+    lz_packed_t* packed = malloc((num_tokens ? num_tokens : 1) * sizeof(lz_packed_t));
+    if (!packed) return NULL;
+    for (size_t i = 0; i < num_tokens; i++) {
+        if (tokens[i].is_literal)
+            packed[i] = LZ_PACK_LITERAL(tokens[i].literal);
+        else
+            packed[i] = LZ_PACK_MATCH(tokens[i].length, tokens[i].distance);
+    }
+    return packed;
+}
+
+/**
+ * @param: data: stream of data
+ * @param: len: length of the data
+ * @param num_tokens: the number of tokens stored when running on the data
+ * @return An array of tokens that contain a concise form of LZ77 data, rather literal or length-distance entries stored in raw data form
+ */
+lz_token_t* lz_compress_tokens(const unsigned char* data, size_t len, size_t* num_tokens) {
+    size_t count = 0;
+    lz_packed_t* packed = lz_compress_packed(data, len, &count);
+    if (!packed) return NULL;
+    lz_token_t* tokens = lz_unpack_tokens(packed, count);
+    free(packed);
+    if (!tokens) return NULL;
+    *num_tokens = count;
+    return tokens;
+}
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "our_zlib.h"
+#include "pipeline.h"
+#include "bqueue.h"
+#include "huff.h"
+#include "lz.h"
+#include "crc.h"
+#include "utility.h"
+#include "stats.h"
+
+#define JOB_QUEUED	0
+#define JOB_DONE	1
+#define JOB_FAILED	2
+
+/* One DEFLATE_BLOCK_SIZE chunk of input and its LZ77 tokens and codes */
+typedef struct {
+	unsigned char*	in;
+	size_t			in_len;
+	int				is_last;
+	lz_packed_t*	tokens;
+	size_t			num_tokens;
+	lz_hist_t		hist;
+	huff_plan_t		plan;		// codes for this chunk alone
+	unsigned int	crc;		// CRC32 of in alone, combined by the writer
+	int				state;		// JOB_*, guarded by pipeline_t.done_lock
+} pipeline_job_t;
+
+typedef struct {
+	FILE*			in;
+	bqueue_t		work;		// jobs waiting for a compressor
+	bqueue_t		order;		// the same jobs in input order, for the writer
+	pthread_mutex_t	done_lock;
+	pthread_cond_t	done_cond;
+	int				failed;		// set by any stage, read with atomics
+} pipeline_t;
+
+/* Bits not yet flushed to the file: blocks are not byte aligned */
+typedef struct {
+	FILE*			out;
+	unsigned int	acc;
+	unsigned int	acc_bits;	// 0-7
+} bit_sink_t;
+
+static void free_job(pipeline_job_t* job) {
+	if (!job) return;
+	free(job->in);
+	free(job->tokens);
+	free(job);
+}
+
+static int pipeline_failed(pipeline_t* p) {
+	return __atomic_load_n(&p->failed, __ATOMIC_RELAXED);
+}
+
+static void pipeline_fail(pipeline_t* p) {
+	__atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reads the next chunk of input.
+ * @return A job holding up to DEFLATE_BLOCK_SIZE bytes (in_len 0 at end of input), NULL on error
+ */
+static pipeline_job_t* read_job(pipeline_t* p) {
+	pipeline_job_t* job = calloc(1, sizeof(*job));
+	if (!job) return NULL;
+	job->in = malloc(DEFLATE_BLOCK_SIZE);
+	if (!job->in) { free(job); return NULL; }
+	job->in_len = fread(job->in, 1, DEFLATE_BLOCK_SIZE, p->in);
+	if (job->in_len < DEFLATE_BLOCK_SIZE && ferror(p->in)) {
+		debug("pipeline: read error");
+		free_job(job);
+		return NULL;
+	}
+	return job;
+}
+
+/**
+ * Reader stage. Keeps one chunk of lookahead so the last block can be marked
+ * BFINAL; an empty input still yields one (empty) final block.
+ */
+static void* reader_main(void* arg) {
+	pipeline_t* p = arg;
+	pipeline_job_t* cur = read_job(p);
+	if (!cur) pipeline_fail(p);
+
+	while (cur) {
+		pipeline_job_t* next = NULL;
+		if (cur->in_len == DEFLATE_BLOCK_SIZE && !pipeline_failed(p)) {
+			next = read_job(p);
+			if (!next) {
+				pipeline_fail(p);
+			} else if (next->in_len == 0) {
+				free_job(next);
+				next = NULL;
+			}
+		}
+		cur->is_last = next == NULL;
+		// order first: the writer must learn about a job before it can finish
+		if (bqueue_push(&p->order, cur) != 0) {
+			free_job(cur);
+			free_job(next);
+			break;
+		}
+		bqueue_push(&p->work, cur);
+		if (pipeline_failed(p)) {
+			free_job(next);
+			break;
+		}
+		cur = next;
+	}
+	bqueue_close(&p->work);
+	bqueue_close(&p->order);
+	return NULL;
+}
+
+/**
+ * LZ77 for one chunk, and the codes it would get as a block of its own.
+ * Emitting is left to the writer, which may merge it with its neighbours.
+ * @param tokens: Room for len + 1 tokens
+ * @return 0 on success, -1 on error
+ */
+static int compress_chunk(const unsigned char* in, size_t len, lz_packed_t* tokens, size_t* num_tokens,
+		lz_hist_t* hist, huff_plan_t* plan) {
+	memset(hist, 0, sizeof(*hist));
+	*num_tokens = lz_compress_block(in, len, tokens, hist);
+	ZSTAT_BEGIN(ZSTAT_HUFF_PLAN);
+	int ret = huffman_plan_block(hist, plan);
+	ZSTAT_END(ZSTAT_HUFF_PLAN);
+	return ret;
+}
+
+static int compress_job(pipeline_job_t* job) {
+	job->tokens = malloc((job->in_len + 1) * sizeof(lz_packed_t));
+	if (!job->tokens) return -1;
+	if (compress_chunk(job->in, job->in_len, job->tokens, &job->num_tokens, &job->hist, &job->plan) != 0) return -1;
+	// Checksum the chunk on this thread while LZ77 has just pulled it into cache
+	job->crc = get_crc(job->in, job->in_len);
+	return 0;
+}
+
+static void* worker_main(void* arg) {
+	pipeline_t* p = arg;
+	pipeline_job_t* job;
+	while ((job = bqueue_pop(&p->work)) != NULL) {
+		int ok = !pipeline_failed(p) && compress_job(job) == 0;
+		pthread_mutex_lock(&p->done_lock);
+		job->state = ok ? JOB_DONE : JOB_FAILED;
+		pthread_cond_broadcast(&p->done_cond);
+		pthread_mutex_unlock(&p->done_lock);
+	}
+	return NULL;
+}
+
+/**
+ * Appends nbits bits of buf to the sink. buf is shifted in place to line up
+ * with the bits still pending from the previous block.
+ * @return 0 on success, -1 on write error
+ */
+static int sink_bits(bit_sink_t* sink, unsigned char* buf, unsigned long nbits) {
+	size_t full = nbits / 8;
+	unsigned int rem = nbits % 8;
+	if (sink->acc_bits) {
+		for (size_t i = 0; i < full; i++) {
+			unsigned int b = buf[i];
+			buf[i] = (unsigned char)(sink->acc | (b << sink->acc_bits));
+			sink->acc = b >> (8 - sink->acc_bits);
+		}
+	}
+	if (full && fwrite(buf, 1, full, sink->out) != full) return -1;
+	if (rem) {
+		sink->acc |= (buf[full] & ((1u << rem) - 1)) << sink->acc_bits;
+		sink->acc_bits += rem;
+		if (sink->acc_bits >= 8) {
+			if (fputc((int)(sink->acc & 0xff), sink->out) == EOF) return -1;
+			sink->acc >>= 8;
+			sink->acc_bits -= 8;
+		}
+	}
+	return 0;
+}
+
+/* Largest block the group can emit: all its chunks merged, each costing up to
+ * the reuse slack more than it would alone */
+#define GROUP_RAW_BOUND DEFLATE_BLOCK_BOUND((size_t)HUFF_GROUP_MAX_CHUNKS * DEFLATE_BLOCK_SIZE)
+#define GROUP_OUT_BOUND (GROUP_RAW_BOUND + GROUP_RAW_BOUND / HUFF_GROUP_REUSE_SLACK + 1)
+
+static void emit_group(huff_group_t* group, int is_last, unsigned char* out, bit_sink_t* sink, int* failed) {
+	unsigned long bits = 0;
+	memset(out, 0, (3 + group->plan.bits + 7) / 8 + 1);
+	ZSTAT_ADD(deflate_blocks[group->plan.btype], 1);
+	ZSTAT_BEGIN(ZSTAT_HUFF_EMIT);
+	huff_group_emit(group, is_last, out, &bits);
+	ZSTAT_END(ZSTAT_HUFF_EMIT);
+	if (sink_bits(sink, out, bits) != 0) *failed = 1;
+}
+
+/**
+ * Hands one chunk to the block group, writing out the open block first when
+ * the chunk does not join it, and the last block once the input ends.
+ * @param out: Scratch of GROUP_OUT_BOUND bytes for the emitted block
+ * @return 0 on success, -1 on error
+ */
+static int add_chunk(huff_group_t* group, unsigned char* out, bit_sink_t* sink, const lz_packed_t* tokens,
+		size_t num_tokens, const lz_hist_t* hist, const huff_plan_t* plan, size_t in_len, int is_last) {
+	int failed = 0;
+	ZSTAT_BEGIN(ZSTAT_HUFF_PLAN);
+	int fits = huff_group_fits(group, hist, plan);
+	ZSTAT_END(ZSTAT_HUFF_PLAN);
+	if (!fits) emit_group(group, 0, out, sink, &failed);
+	huff_group_append(group, tokens, num_tokens, plan, in_len);
+	if (is_last) emit_group(group, 1, out, sink, &failed);
+	return failed ? -1 : 0;
+}
+
+static int write_member_header(FILE* out, const char* name, unsigned int mtime) {
+	char* header = malloc(10 + strlen(name) + 1);
+	if (!header) return -1;
+	size_t header_len = fill_member_header(header, name, mtime);
+	int write_failed = fwrite(header, 1, header_len, out) != header_len;
+	free(header);
+	return write_failed ? -1 : 0;
+}
+
+/**
+ * Byte-aligns the stream and writes the gzip trailer: CRC32 + ISIZE, little-endian.
+ */
+static int write_member_trailer(bit_sink_t* sink, unsigned int crc, unsigned int isize) {
+	unsigned char trailer[9];
+	size_t n = 0;
+	if (sink->acc_bits) trailer[n++] = (unsigned char)sink->acc;
+	for (int i = 0; i < 4; i++) trailer[n++] = (unsigned char)(crc >> (8 * i));
+	for (int i = 0; i < 4; i++) trailer[n++] = (unsigned char)(isize >> (8 * i));
+	return fwrite(trailer, 1, n, sink->out) == n ? 0 : -1;
+}
+
+int deflate_stream_pipelined(FILE* in, FILE* out, const char* name, unsigned int mtime, int workers) {
+	if (!in || !out || !name) return -1;
+	if (workers <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		workers = cpus > 0 ? (int)cpus : 1;
+	}
+	if (write_member_header(out, name, mtime) != 0) return -1;
+
+	pipeline_t p;
+	memset(&p, 0, sizeof(p));
+	p.in = in;
+	size_t jobs_in_flight = (size_t)workers * PIPELINE_JOBS_PER_WORKER + 2;
+	if (bqueue_init(&p.work, jobs_in_flight) != 0) return -1;
+	if (bqueue_init(&p.order, jobs_in_flight) != 0) { bqueue_destroy(&p.work); return -1; }
+	pthread_mutex_init(&p.done_lock, NULL);
+	pthread_cond_init(&p.done_cond, NULL);
+
+	pthread_t reader;
+	pthread_t* threads = malloc((size_t)workers * sizeof(pthread_t));
+	int started = 0;
+	int reader_started = threads && pthread_create(&reader, NULL, reader_main, &p) == 0;
+	if (!reader_started) {
+		pipeline_fail(&p);
+		bqueue_close(&p.work);
+		bqueue_close(&p.order);
+	}
+	while (reader_started && started < workers && pthread_create(&threads[started], NULL, worker_main, &p) == 0)
+		started++;
+	// Without a single compressor the writer would wait forever
+	if (started == 0) {
+		pipeline_fail(&p);
+		bqueue_close(&p.work);
+	}
+
+	// Writer stage: take jobs in input order as their compressors finish
+	bit_sink_t sink = { out, 0, 0 };
+	huff_group_t group;
+	unsigned char* block_out = malloc(GROUP_OUT_BOUND);
+	if (huff_group_init(&group, DEFLATE_BLOCK_SIZE + 1) != 0 || !block_out) pipeline_fail(&p);
+	unsigned int crc = 0;
+	unsigned int isize = 0;
+	pipeline_job_t* job;
+	while ((job = bqueue_pop(&p.order)) != NULL) {
+		pthread_mutex_lock(&p.done_lock);
+		while (job->state == JOB_QUEUED && started > 0)
+			pthread_cond_wait(&p.done_cond, &p.done_lock);
+		int state = job->state;
+		pthread_mutex_unlock(&p.done_lock);
+
+		if (state != JOB_DONE) {
+			pipeline_fail(&p);
+		} else if (!pipeline_failed(&p)) {
+			crc = crc_combine(crc, job->crc, job->in_len);
+			isize += (unsigned int)job->in_len;
+			if (add_chunk(&group, block_out, &sink, job->tokens, job->num_tokens, &job->hist, &job->plan,
+					job->in_len, job->is_last) != 0)
+				pipeline_fail(&p);
+		}
+		// Every job passes through the order queue, so it is freed here only
+		free_job(job);
+	}
+
+	if (reader_started) pthread_join(reader, NULL);
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	huff_group_free(&group);
+	free(block_out);
+	bqueue_destroy(&p.work);
+	bqueue_destroy(&p.order);
+	pthread_mutex_destroy(&p.done_lock);
+	pthread_cond_destroy(&p.done_cond);
+	if (pipeline_failed(&p)) return -1;
+	return write_member_trailer(&sink, crc, isize);
+}
+
+/**
+ * Allocates the buffers one thread needs to compress files serially.
+ * @return 0 on success, -1 on error
+ */
+int deflate_ctx_init(deflate_ctx_t* ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->tokens = malloc((DEFLATE_BLOCK_SIZE + 1) * sizeof(lz_packed_t));
+	ctx->in[0] = malloc(DEFLATE_BLOCK_SIZE);
+	ctx->in[1] = malloc(DEFLATE_BLOCK_SIZE);
+	ctx->out = malloc(GROUP_OUT_BOUND);
+	if (huff_group_init(&ctx->group, DEFLATE_BLOCK_SIZE + 1) != 0 || !ctx->tokens || !ctx->in[0] || !ctx->in[1] || !ctx->out) {
+		deflate_ctx_free(ctx);
+		return -1;
+	}
+	return 0;
+}
+
+void deflate_ctx_free(deflate_ctx_t* ctx) {
+	free(ctx->tokens);
+	free(ctx->in[0]);
+	free(ctx->in[1]);
+	free(ctx->out);
+	huff_group_free(&ctx->group);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+int deflate_stream_ctx(deflate_ctx_t* ctx, FILE* in, FILE* out, const char* name, unsigned int mtime) {
+	if (!ctx || !in || !out || !name) return -1;
+	if (write_member_header(out, name, mtime) != 0) return -1;
+
+	bit_sink_t sink = { out, 0, 0 };
+	unsigned int crc = 0;
+	unsigned int isize = 0;
+	int cur = 0;
+	size_t len = fread(ctx->in[cur], 1, DEFLATE_BLOCK_SIZE, in);
+	for (;;) {
+		if (ferror(in)) return -1;
+		// Same one-chunk lookahead as the reader stage, to find BFINAL
+		size_t next_len = len == DEFLATE_BLOCK_SIZE ? fread(ctx->in[!cur], 1, DEFLATE_BLOCK_SIZE, in) : 0;
+		if (ferror(in)) return -1;
+		int is_last = next_len == 0;
+
+		size_t num_tokens = 0;
+		lz_hist_t hist;
+		huff_plan_t plan;
+		if (compress_chunk(ctx->in[cur], len, ctx->tokens, &num_tokens, &hist, &plan) != 0) return -1;
+		crc = crc_update(crc, ctx->in[cur], len);
+		isize += (unsigned int)len;
+		if (add_chunk(&ctx->group, ctx->out, &sink, ctx->tokens, num_tokens, &hist, &plan, len, is_last) != 0) return -1;
+
+		if (is_last) break;
+		cur = !cur;
+		len = next_len;
+	}
+	return write_member_trailer(&sink, crc, isize);
+}
+
+int deflate_file_pipelined(const char* in_path, const char* out_path, int workers) {
+	struct stat st;
+	if (stat(in_path, &st) != 0) return -1;
+	FILE* in = fopen(in_path, "rb");
+	if (!in) return -1;
+	FILE* out = fopen(out_path, "wb");
+	if (!out) {
+		fclose(in);
+		return -1;
+	}
+	int rc = deflate_stream_pipelined(in, out, in_path, (unsigned int)st.st_mtim.tv_sec, workers);
+	fclose(in);
+	if (fclose(out) != 0) rc = -1;
+	return rc;
+}
@@ -10,8 +10,9 @@ typedef struct {
 	unsigned int priority;
 } item_t;
 
-static item_t heap[QUEUE_CAP];
-static size_t heap_size;
+/* One heap per thread, so Huffman trees can be built by concurrent compressors */
+static __thread item_t heap[QUEUE_CAP];
+static __thread size_t heap_size;
 
 /**
  * Enqueues arbitrary pointer node with priority
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STATS_HAVE_TSC 1
+#endif
+
+static const char* stage_names[ZSTAT_NUM_STAGES] = {
+	"lz search", "huffman plan", "huffman emit", "huffman decode", "crc"
+};
+static const char* btype_names[4] = { "stored", "fixed", "dynamic", "reserved" };
+
+#ifdef ZSTATS
+
+zstats_t zstats;
+
+zstat_mark_t zstat_now(void) {
+	zstat_mark_t mark;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	mark.ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#ifdef STATS_HAVE_TSC
+	mark.cycles = __rdtsc();
+#else
+	mark.cycles = 0;
+#endif
+	return mark;
+}
+
+/**
+ * Adds the time since start to a stage's totals.
+ * @param stage: Stage being timed
+ * @param start: Mark taken with zstat_now() when the stage began
+ */
+void zstat_stage_add(zstat_stage_t stage, const zstat_mark_t* start) {
+	zstat_mark_t end = zstat_now();
+	ZSTAT_ADD(stage_ns[stage], end.ns - start->ns);
+	ZSTAT_ADD(stage_cycles[stage], end.cycles - start->cycles);
+	ZSTAT_ADD(stage_calls[stage], 1);
+}
+
+int zstats_enabled(void) {
+	return 1;
+}
+
+void zstats_reset(void) {
+	uint64_t* fields = (uint64_t*)&zstats;
+	for (size_t i = 0; i < sizeof(zstats) / sizeof(uint64_t); i++)
+		__atomic_store_n(&fields[i], 0, __ATOMIC_RELAXED);
+}
+
+void zstats_snapshot(zstats_t* out) {
+	uint64_t* dst = (uint64_t*)out;
+	uint64_t* src = (uint64_t*)&zstats;
+	for (size_t i = 0; i < sizeof(zstats) / sizeof(uint64_t); i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+#else
+
+int zstats_enabled(void) {
+	return 0;
+}
+
+void zstats_reset(void) {
+}
+
+void zstats_snapshot(zstats_t* out) {
+	memset(out, 0, sizeof(*out));
+}
+
+#endif
+
+/**
+ * Prints the stage totals and event counters in a human readable form.
+ * @param out: Stream to print to (main uses stderr so -v never mixes with data)
+ */
+void zstats_print(FILE* out) {
+	if (!zstats_enabled()) {
+		fprintf(out, "Stats: not compiled in, rebuild with `make stats`\n");
+		return;
+	}
+	zstats_t s;
+	zstats_snapshot(&s);
+
+	fprintf(out, "Stats:\n");
+	fprintf(out, "  %-16s %10s %14s %16s\n", "stage", "calls", "ms", "cycles");
+	for (int i = 0; i < ZSTAT_NUM_STAGES; i++) {
+		if (!s.stage_calls[i]) continue;
+		fprintf(out, "  %-16s %10llu %14.3f %16llu\n", stage_names[i],
+			(unsigned long long)s.stage_calls[i], s.stage_ns[i] / 1e6,
+			(unsigned long long)s.stage_cycles[i]);
+	}
+
+	if (s.lz_positions) {
+		fprintf(out, "  lz positions: %llu, window probes: %llu (%.1f/position), compares: %llu (%.1f/position)\n",
+			(unsigned long long)s.lz_positions,
+			(unsigned long long)s.lz_window_probes, (double)s.lz_window_probes / s.lz_positions,
+			(unsigned long long)s.lz_match_compares, (double)s.lz_match_compares / s.lz_positions);
+		fprintf(out, "  lz matches: %llu (avg length %.2f), literals: %llu\n",
+			(unsigned long long)s.lz_matches,
+			s.lz_matches ? (double)s.lz_match_bytes / s.lz_matches : 0.0,
+			(unsigned long long)s.lz_literals);
+	}
+	for (int pass = 0; pass < 2; pass++) {
+		const uint64_t* blocks = pass ? s.inflate_blocks : s.deflate_blocks;
+		if (!(blocks[0] | blocks[1] | blocks[2] | blocks[3])) continue;
+		fprintf(out, "  %s blocks:", pass ? "inflate" : "deflate");
+		for (int b = 0; b < 4; b++)
+			if (blocks[b]) fprintf(out, " %s %llu", btype_names[b], (unsigned long long)blocks[b]);
+		fprintf(out, "\n");
+	}
+	if (s.realloc_calls)
+		fprintf(out, "  reallocs: %llu, bytes moved (worst case): %llu\n",
+			(unsigned long long)s.realloc_calls, (unsigned long long)s.realloc_bytes);
+}
@@ -2,12 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "debug.h"
 #include "our_zlib.h"
 #include "huff.h"
 #include "lz.h"
 #include "utility.h"
 #include "crc.h"
+#include "stats.h"
 
 /**
  * Checks ID header of gzip member
@@ -22,27 +24,17 @@ int check_id(FILE* file) {
 }
 
 /**
- * Dynamically allocates memory for a (null-terminated) string in a file
- * File pointer should point to the beginning of the string
+ * Copies the null-terminated string at buf into a new allocation.
+ * @param len Bytes available at buf
+ * @return Length including the null byte, or 0 if it is not terminated in len bytes
  */
-void get_string(FILE* file, char** dest) {
-	char next_char = -1;
-	int str_len = 0;
-	// while previous byte is not null:
-	while (next_char != 0) {
-		// read byte
-		if (fread(&next_char, sizeof(char), 1, file) != 1) return;
-		// increment necessary length
-		str_len++;
-	}
-	// dest will now point to a space for the string in memory
-	*dest = (char*)malloc((size_t)str_len);
-	// handle malloc error
-	if (!*dest) return;
-	// return to start of the string in the file
-	if (fseek(file, -1 * (long)str_len, SEEK_CUR) != 0) return;
-	// read string into allocated space
-	fread(*dest, sizeof(char), str_len, file);
+static size_t copy_string(const unsigned char* buf, size_t len, char** dest) {
+	const unsigned char* end = memchr(buf, 0, len);
+	if (!end) return 0;
+	size_t str_len = (size_t)(end - buf) + 1;
+	*dest = malloc(str_len);
+	if (*dest) memcpy(*dest, buf, str_len);
+	return str_len;
 }
 
 /**
@@ -82,124 +74,424 @@ int skip_gz_header_to_compressed_data(FILE* file, gz_header_t* header) {
 	return 0;
 }
 
+/* Frees what parse_member_header copied out of an incomplete header */
+static size_t header_fail(gz_header_t* header) {
+	free(header->extra);
+	free(header->name);
+	free(header->comment);
+	header->extra = header->name = header->comment = NULL;
+	return 0;
+}
+
 /**
- * Fills a struct with the metadata of a member.
- * File pointer should point to the start of the member.
- * File pointer ends up at the end of the member.
- * Presence of struct fields has to be used to
- * rewind to the start of the compressed data.
+ * Parses a member header held in memory, so FNAME and FCOMMENT are found
+ * with one scan instead of a read per byte.
+ * Allocates extra, name and comment when present; the caller frees them,
+ * unless the header turns out incomplete, in which case they are freed here.
+ * @param buf: Start of the member
+ * @param len: Bytes available at buf
+ * @return Length of the header, or 0 if it is not a complete gzip header
  */
-int parse_member(FILE* file, gz_header_t* header) {
-	if (!check_id(file)) return 1;
-	fread(&header->cm,    sizeof(char), 1, file);
-	fread(&header->flags, sizeof(char), 1, file);
-	fread(&header->mtime, sizeof(unsigned int), 1, file);
-	fread(&header->xflags, sizeof(char), 1, file);
-	fread(&header->os,    sizeof(char), 1, file);
+size_t parse_member_header(const unsigned char* buf, size_t len, gz_header_t* header) {
+	if (len < 10 || buf[0] != (ID >> 8) || buf[1] != (ID & 0xff)) return 0;
+	header->cm		= buf[2];
+	header->flags	= buf[3];
+	header->mtime	= buf[4] | buf[5] << 8 | buf[6] << 16 | (unsigned int)buf[7] << 24;
+	header->xflags	= buf[8];
+	header->os		= buf[9];
+	size_t pos = 10;
 
 	if ((header->flags & F_EXTRA) != 0) {
-		fread(&header->extra_len, sizeof(unsigned short), 1, file);
+		if (pos + 2 > len) return 0;
+		header->extra_len = (unsigned short)(buf[pos] | buf[pos + 1] << 8);
+		pos += 2;
+		if (pos + header->extra_len > len) return 0;
 		if (header->extra_len > 0) {
 			header->extra = malloc(header->extra_len);
 			if (header->extra)
-				fread(header->extra, sizeof(char), header->extra_len, file);
+				memcpy(header->extra, buf + pos, header->extra_len);
 		}
+		pos += header->extra_len;
 	}
 	if ((header->flags & F_NAME) != 0) {
-		get_string(file, &header->name);
+		size_t n = copy_string(buf + pos, len - pos, &header->name);
+		if (n == 0) return header_fail(header);
+		pos += n;
 	}
 	if ((header->flags & F_COMMENT) != 0) {
-		get_string(file, &header->comment);
+		size_t n = copy_string(buf + pos, len - pos, &header->comment);
+		if (n == 0) return header_fail(header);
+		pos += n;
 	}
 	if ((header->flags & F_HCRC) != 0) {
-		fread(&header->hcrc, sizeof(unsigned short), 1, file);
+		if (pos + 2 > len) return header_fail(header);
+		header->hcrc = (unsigned short)(buf[pos] | buf[pos + 1] << 8);
+		pos += 2;
 	}
+	return pos;
+}
 
+/**
+ * Finds the end of a DEFLATE stream by walking its blocks without
+ * decompressing them (stored blocks are jumped over whole).
+ * @param bytes: The start of the compressed bytes
+ * @param comp_len: Bytes available, may run past the end of the stream
+ * @param dec_len: Set to the length of decompressed data on success (may be NULL)
+ * @param window: When not NULL the stream is decoded through it, so its CRC
+ *                covers the data without the data ever being held whole
+ * @return Length of the stream in bytes, or 0 if it is truncated or malformed
+ */
+size_t skip_deflate_stream(const unsigned char* bytes, size_t comp_len, size_t* dec_len, huff_window_t* window) {
+	unsigned long bit_pointer = 0;
+	unsigned long bit_limit = (unsigned long)comp_len * 8;
+	size_t produced = 0;
+	unsigned int bit_header = 0;
 
-	if (fseek(file, 0, SEEK_END) != 0) {
-		debug("could not skip to end of file");
-		return 1;
+	do {
+		if (bit_pointer + 3 > bit_limit) return 0;
+		bit_reader(bytes + (bit_pointer / 8), 3, &bit_pointer, &bit_header, 0);
+		unsigned int btype = (bit_header >> 1) & BT_MASK;
+		if (btype == BT_NO_COMPRESSION) {
+			size_t byte_ix = (bit_pointer + 7) / 8;
+			if (byte_ix + 4 > comp_len) return 0;
+			size_t len = bytes[byte_ix] | bytes[byte_ix + 1] << 8;
+			size_t inverse_len = bytes[byte_ix + 2] | bytes[byte_ix + 3] << 8;
+			byte_ix += 4;
+			if (len != (~inverse_len & 0xffff) || len > comp_len - byte_ix) return 0;
+			if (window)
+				huff_window_write(window, bytes + byte_ix, len);
+			bit_pointer = (byte_ix + len) * 8;
+			produced += len;
+		}
+		else if (btype == BT_STATIC || btype == BT_DYNAMIC) {
+			size_t block_len = 0;
+			if (huffman_skip_block(bytes, comp_len, btype, &bit_pointer, produced, &block_len, window) != 0) return 0;
+			produced += block_len;
+		}
+		else {
+			return 0;
+		}
+	} while (!(bit_header & 0x01));
+
+	if (window)
+		huff_window_flush(window);
+	if (dec_len) *dec_len = produced;
+	return (bit_pointer + 7) / 8;
+}
+
+/**
+ * Reads the member at the file pointer, walking its blocks through window
+ * (may be NULL) and leaving the file pointer at the end of the member.
+ * The file is mapped when it can be, otherwise its rest is read in one go.
+ * @param window: Decodes the member into this window when not NULL
+ * @param hcrc_valid: Set to whether FHCRC (if present) matches, may be NULL
+ * @return MEMBER_OK, MEMBER_NO_HEADER, or MEMBER_BAD_DATA when the header
+ *         was parsed but the blocks or trailer are truncated or malformed
+ */
+static int read_member(FILE* file, gz_header_t* header, huff_window_t* window, int* hcrc_valid) {
+	long start = ftell(file);
+	if (start < 0) return MEMBER_NO_HEADER;
+
+	unsigned char* map = NULL;
+	size_t map_len = 0;
+	unsigned char* buf = NULL;
+	size_t len = 0;
+	struct stat st;
+	int fd = fileno(file);
+	if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > start) {
+		map_len = (size_t)st.st_size;
+		map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+		} else {
+			madvise(map, map_len, MADV_SEQUENTIAL);
+			buf = map + start;
+			len = map_len - (size_t)start;
+		}
 	}
-	fread(&header->crc,       sizeof(unsigned int), 1, file);
-	fread(&header->full_size, sizeof(unsigned int), 1, file);
-	return 0;
+	if (!map) {
+		// Not a regular file (or no mapping): read what is left of it
+		size_t cap = 0;
+		for (;;) {
+			if (len == cap) {
+				cap = cap ? cap * 2 : 1 << 16;
+				unsigned char* tmp = realloc(buf, cap);
+				if (!tmp) { free(buf); return MEMBER_NO_HEADER; }
+				buf = tmp;
+			}
+			size_t n = fread(buf + len, 1, cap - len, file);
+			if (n == 0) break;
+			len += n;
+		}
+	}
+
+	int rc = MEMBER_NO_HEADER;
+	size_t header_len = parse_member_header(buf, len, header);
+	if (header_len == 0) {
+		debug("not a complete gzip member header");
+	} else {
+		// FHCRC is the low 16 bits of the CRC32 of the header bytes before it
+		if (hcrc_valid)
+			*hcrc_valid = (header->flags & F_HCRC) == 0 ||
+				(get_crc(buf, header_len - 2) & 0xffff) == header->hcrc;
+		size_t comp_len = skip_deflate_stream(buf + header_len, len - header_len, NULL, window);
+		size_t end = header_len + comp_len;
+		if (comp_len == 0 || end + 8 > len) {
+			debug("truncated or malformed member");
+			rc = MEMBER_BAD_DATA;
+		} else {
+			const unsigned char* t = buf + end;
+			header->crc			= t[0] | t[1] << 8 | t[2] << 16 | (unsigned int)t[3] << 24;
+			header->full_size	= t[4] | t[5] << 8 | t[6] << 16 | (unsigned int)t[7] << 24;
+			rc = fseek(file, start + (long)(end + 8), SEEK_SET) == 0 ? MEMBER_OK : MEMBER_NO_HEADER;
+		}
+	}
+
+	if (map)
+		munmap(map, map_len);
+	else
+		free(buf);
+	return rc;
 }
 
 /**
+ * Fills a struct with the metadata of a member.
+ * File pointer should point to the start of the member.
+ * File pointer ends up at the end of the member (the start of the next one),
+ * found by walking the DEFLATE blocks without decompressing them; CRC and
+ * full_size come from that member's own trailer.
+ * @return MEMBER_OK, MEMBER_NO_HEADER if no member starts here, or
+ *         MEMBER_BAD_DATA if its blocks or trailer are truncated or malformed
+ */
+int parse_member(FILE* file, gz_header_t* header) {
+	return read_member(file, header, NULL, NULL);
+}
+
+/**
+ * parse_member that also decodes the member through a 32 KB window, so its
+ * CRC32 and length are checked against the trailer without allocating the
+ * output. The header CRC is checked too when FHCRC is set.
+ * @param crc_valid: Set to 1 if CRC32, ISIZE (and HCRC) match
+ * @return MEMBER_OK, MEMBER_NO_HEADER or MEMBER_BAD_DATA, as parse_member
+ */
+int verify_member(FILE* file, gz_header_t* header, int* crc_valid) {
+	*crc_valid = 0;
+	huff_window_t* window = calloc(1, sizeof(huff_window_t));
+	if (!window) return MEMBER_NO_HEADER;
+	int hcrc_valid = 0;
+	int rc = read_member(file, header, window, &hcrc_valid);
+	if (rc == MEMBER_OK)
+		*crc_valid = hcrc_valid && window->crc == header->crc && (unsigned int)window->pos == header->full_size;
+	free(window);
+	return rc;
+}
+
+/**
+ * Decompresses the DEFLATE blocks of one member. The input is untrusted:
+ * a truncated or malformed block makes it return NULL instead of reading
+ * past comp_len.
  * @param bytes The start of the compressed bytes
  * @param comp_len	The length of compressed data
- * @param dec_len	The expected length of decompressed data (NEVER USED)
+ * @param dec_len	Set to the length of decompressed data on success (may be NULL)
+ * @param crc	Set to the CRC32 of the decompressed data (may be NULL), updated
+ *				block by block while each block is still in cache
+ * @return Decompressed data (never NULL on success, even when empty), or NULL
  */
-char* inflate(char* bytes, size_t comp_len) {
+char* inflate_crc(char* bytes, size_t comp_len, size_t* dec_len, unsigned int* crc) {
 	// disregards dictionary
-	unsigned int *bit_header = NULL;
-	unsigned long bit_pointer;
+	unsigned int bit_header = 0;
+	unsigned long bit_pointer = 0;
+	unsigned long bit_limit = (unsigned long)comp_len * 8;
 	unsigned char* out_block;
 	unsigned char* out_member = NULL;
 	size_t len_out_member = 0;
 	size_t out_len = 0;
 
-	// It's possible to output a comp_len such that it doesn't go through the while loop, or pass data that doesn't get 
-	// passed the if statement, initialized to cover cases
-	
+	if (dec_len) *dec_len = 0;
+	if (crc) *crc = 0;
+	if (!bytes) return NULL;
+
 	for (;;)
 	{
-		bit_reader((unsigned char *)bytes + (bit_pointer / 8),3,&bit_pointer,bit_header,0);
+		if (bit_pointer + 3 > bit_limit) {
+			debug("inflate: truncated block header at bit %lu", bit_pointer);
+			free(out_member);
+			return NULL;
+		}
+		bit_reader((unsigned char *)bytes + (bit_pointer / 8),3,&bit_pointer,&bit_header,0);
 		// Check btypes and bfinal
-		unsigned int btype = (*bit_header >> 1) & BT_MASK;
+		unsigned int btype = (bit_header >> 1) & BT_MASK;
 
 		// Use macros for the btypes
 		if(btype == BT_DYNAMIC || btype == BT_STATIC)
 		{
 			// huffman_decode handles full DEFLATE (literals + length-distance)
 			// Pass previously decompressed data as history for cross-block distance refs
+			ZSTAT_BEGIN(ZSTAT_HUFF_DECODE);
 			out_block = huffman_decode((const unsigned char*)bytes, comp_len, btype, &bit_pointer, &out_len, out_member, len_out_member);
-			if (!out_block) return (char *)out_member;
+			ZSTAT_END(ZSTAT_HUFF_DECODE);
+			if (!out_block) {
+				free(out_member);
+				return NULL;
+			}
 		}
 		else if(btype == BT_NO_COMPRESSION)
 		{
 			// Proceed with no compression
-			unsigned long byte_ix = (bit_pointer + 7) / 8; // Start at the next byte if this one is started
-			long len = (unsigned char)bytes[byte_ix] | ((unsigned char)bytes[byte_ix+1] << 8);
-			// Should confirm inverse len
+			size_t byte_ix = (bit_pointer + 7) / 8; // Start at the next byte if this one is started
+			if (byte_ix + 4 > comp_len) {
+				debug("inflate: truncated stored block header");
+				free(out_member);
+				return NULL;
+			}
+			size_t len = (unsigned char)bytes[byte_ix] | ((unsigned char)bytes[byte_ix+1] << 8);
 			byte_ix +=2;
-			long inverse_len = (unsigned char)bytes[byte_ix] | ((unsigned char)bytes[byte_ix+1] << 8);
+			size_t inverse_len = (unsigned char)bytes[byte_ix] | ((unsigned char)bytes[byte_ix+1] << 8);
 			byte_ix +=2;
-			bit_pointer = byte_ix *8; // Reassign
-			if((len & 0xffff) == (~inverse_len & 0xffff))
+			if((len & 0xffff) != (~inverse_len & 0xffff) || len > comp_len - byte_ix)
 			{
-				out_block = malloc(len);
-				memcpy(out_block,bytes+byte_ix,len);
-				out_len = len;
+				debug("inflate: bad stored block LEN/NLEN");
+				free(out_member);
+				return NULL;
 			}
-			else
-			{
-				return (char *)out_member; // return all that has been gathered so far
+			bit_pointer = (byte_ix + len) * 8; // Reassign past the stored bytes
+			out_block = malloc(len ? len : 1);
+			if (!out_block) {
+				free(out_member);
+				return NULL;
 			}
+			memcpy(out_block,bytes+byte_ix,len);
+			out_len = len;
 		}
 		else
 		{
 			// Error (BTYPE = binary 11)
-			return (char *)out_member;
+			free(out_member);
+			return NULL;
 		}
+		ZSTAT_ADD(inflate_blocks[btype], 1);
+		if (crc) *crc = crc_update(*crc, out_block, out_len);
 
-		unsigned char *temporary = realloc(out_member,len_out_member + out_len);
+		ZSTAT_ADD(realloc_calls, 1);
+		ZSTAT_ADD(realloc_bytes, len_out_member);
+		unsigned char *temporary = realloc(out_member,len_out_member + out_len + 1);
 		if (temporary == NULL)
 		{
-			return (char *)out_member;
+			free(out_block);
+			free(out_member);
+			return NULL;
 		}
 		out_member = temporary;
 		memcpy(out_member+len_out_member,out_block,out_len);
 		free(out_block);
 		len_out_member += out_len;
 		// Check if BFINAL was set and stop reading this member's data if so
-		if(*bit_header & 0x01)
+		if(bit_header & 0x01)
 		{
 			break;
 		}
 	}
-	return (char *)out_member; // Should do logic on reaching end of block
-	
+	if (dec_len) *dec_len = len_out_member;
+	return (char *)out_member;
+}
+
+/**
+ * @param bytes The start of the compressed bytes
+ * @param comp_len	The length of compressed data
+ * @param dec_len	Set to the length of decompressed data on success (may be NULL)
+ * @return Decompressed data, or NULL if the blocks are malformed
+ */
+char* inflate_sized(char* bytes, size_t comp_len, size_t* dec_len) {
+	return inflate_crc(bytes, comp_len, dec_len, NULL);
+}
+
+/**
+ * @param bytes The start of the compressed bytes
+ * @param comp_len	The length of compressed data
+ * @return Decompressed data, or NULL if the blocks are malformed
+ */
+char* inflate(char* bytes, size_t comp_len) {
+	return inflate_sized(bytes, comp_len, NULL);
+}
+
+/**
+ * Decompresses the first member of a gzip file into out_path, checking the
+ * data against the CRC32 and ISIZE in the trailer.
+ * @return 0 on success, -1 on error (nothing is written for a malformed or
+ *         corrupt member)
+ */
+int inflate_file(const char* in_path, const char* out_path) {
+	FILE* file = fopen(in_path, "rb");
+	if (!file) return -1;
+	gz_header_t info = {0};
+	if (fseek(file, 0, SEEK_END) != 0) {
+		fclose(file);
+		return -1;
+	}
+	long file_size = ftell(file);
+	rewind(file);
+	if (file_size < 8 || skip_gz_header_to_compressed_data(file, &info) != 0) {
+		fclose(file);
+		return -1;
+	}
+	long comp_start = ftell(file);
+	if (comp_start < 0 || comp_start + 8 > file_size) {
+		fclose(file);
+		return -1;
+	}
+	size_t comp_len = (size_t)(file_size - 8 - comp_start);
+	char* comp_buf = malloc(comp_len + 8);
+	if (!comp_buf || fread(comp_buf, 1, comp_len + 8, file) != comp_len + 8) {
+		free(comp_buf);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	const unsigned char* trailer = (const unsigned char*)comp_buf + comp_len;
+	unsigned int want_crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (unsigned int)trailer[3] << 24;
+	unsigned int want_size = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (unsigned int)trailer[7] << 24;
+	size_t out_len = 0;
+	unsigned int crc = 0;
+	char* out_buf = inflate_crc(comp_buf, comp_len, &out_len, &crc);
+	free(comp_buf);
+	if (!out_buf) return -1;
+	if (crc != want_crc || (unsigned int)out_len != want_size) {
+		debug("inflate_file: CRC %08x / ISIZE %u do not match the trailer", crc, (unsigned int)out_len);
+		free(out_buf);
+		return -1;
+	}
+
+	FILE* out = fopen(out_path, "wb");
+	if (!out) {
+		free(out_buf);
+		return -1;
+	}
+	int rc = (out_len == 0 || fwrite(out_buf, 1, out_len, out) == out_len) ? 0 : -1;
+	if (fclose(out) != 0) rc = -1;
+	free(out_buf);
+	return rc;
+}
+
+/**
+ * Writes the member header deflate() uses: CM = deflate, FNAME set.
+ * @param buffer: Room for at least 10 + strlen(fname) + 1 bytes
+ * @param fname: Name stored in FNAME
+ * @param mtime: Modification time stored in MTIME
+ * @return Number of bytes written
+ */
+size_t fill_member_header(char* buffer, const char* fname, unsigned int mtime) {
+	buffer[0] = ID >> 8;								// ID1
+	buffer[1] = ID & 0xff;								// ID2
+	buffer[2] = 8;										// CM = deflate (RFC 1952)
+	buffer[3] = F_NAME;									// FLG
+	buffer[4] = mtime		& 0xff;
+	buffer[5] = mtime >> 8	& 0xff;
+	buffer[6] = mtime >> 16	& 0xff;
+	buffer[7] = mtime >> 24;							// MTIME
+	buffer[8] = 0;										// XFL
+	buffer[9] = 0;										// OS
+	strcpy(buffer + 10, fname);							// FNAME
+	return 10 + strlen(fname) + 1;
 }
 
 // allocates maximum space for the member and sets the header
@@ -212,19 +504,40 @@ char* set_member_header(char* fname, int* fsize) {
 		debug("malloc error");
 		return NULL;
 	}
-	buffer[0] = ID >> 8;								// ID1
-	buffer[1] = ID & 0xff;								// ID2
-	buffer[2] = 8;										// CM = deflate (RFC 1952)
-	buffer[3] = F_NAME;									// FLG
-	buffer[4] = stat_buff.st_mtim.tv_sec		& 0xff;
-	buffer[5] = stat_buff.st_mtim.tv_sec >> 8	& 0xff;
-	buffer[6] = stat_buff.st_mtim.tv_sec >> 16	& 0xff;
-	buffer[7] = stat_buff.st_mtim.tv_sec >> 24;			// MTIME
-	buffer[8] = 0;										// XFL
-	buffer[9] = 0;										// OS
-	strcpy(buffer + 10, fname);							// FNAME
+	size_t header_len = fill_member_header(buffer, fname, (unsigned int)stat_buff.st_mtim.tv_sec);
 	*fsize = stat_buff.st_size;							// get file size
-	return buffer + 10 + strlen(fname) + 1;
+	return buffer + header_len;
+}
+
+/**
+ * Writes the group's open block at *bit_pos in the member, growing it first
+ * if needed.
+ * @param real_start: Start of the member buffer (gzip header included)
+ * @param alloc: Its size, updated when it grows
+ * @param hdr_len: Length of the gzip header, the blocks start after it
+ * @return The member buffer, possibly moved, or NULL (and freed) on error
+ */
+static char* emit_group(huff_group_t* group, int is_last, char* real_start, size_t* alloc, size_t hdr_len, unsigned long* bit_pos) {
+	// Room for the block and the trailer
+	size_t needed = hdr_len + (*bit_pos + 3 + group->plan.bits + 7) / 8 + 8;
+	if (needed > *alloc) {
+		ZSTAT_ADD(realloc_calls, 1);
+		ZSTAT_ADD(realloc_bytes, *alloc);
+		size_t new_alloc = needed * 2;
+		char* tmp = realloc(real_start, new_alloc);
+		if (!tmp) { free(real_start); return NULL; }
+		real_start = tmp;
+		// Zero only the new portion
+		size_t cur_bytes = hdr_len + (*bit_pos + 7) / 8;
+		memset(real_start + cur_bytes, 0, new_alloc - cur_bytes);
+		*alloc = new_alloc;
+	}
+	ZSTAT_ADD(deflate_blocks[group->plan.btype], 1);
+	// Emit the block straight into the member, no intermediate buffer to merge
+	ZSTAT_BEGIN(ZSTAT_HUFF_EMIT);
+	huff_group_emit(group, is_last, (unsigned char*)real_start + hdr_len, bit_pos);
+	ZSTAT_END(ZSTAT_HUFF_EMIT);
+	return real_start;
 }
 
 /**
@@ -254,6 +567,15 @@ char* deflate(char* filename, char* bytes, size_t len, size_t* out_len) {
 	memset(out_member, 0, alloc - gzip_hdr_len);
 
 	unsigned long total_bit_pos = 0; // bit position within out_member
+	unsigned int checksum = 0;       // CRC32 of the input so far
+
+	// One token buffer reused by every block: each token covers at least one input byte
+	size_t token_cap = len < DEFLATE_BLOCK_SIZE ? len : DEFLATE_BLOCK_SIZE;
+	lz_packed_t* tokens = malloc((token_cap + 1) * sizeof(lz_packed_t));
+	if (!tokens) { free(real_start); return NULL; }
+	// Chunks with similar statistics share one block, and so one header
+	huff_group_t group;
+	if (huff_group_init(&group, token_cap + 1) != 0) { free(tokens); free(real_start); return NULL; }
 
 	size_t offset = 0;
 	while (offset < len) {
@@ -261,53 +583,43 @@ char* deflate(char* filename, char* bytes, size_t len, size_t* out_len) {
 		if (chunk > DEFLATE_BLOCK_SIZE) chunk = DEFLATE_BLOCK_SIZE;
 		int is_last = (offset + chunk >= len);
 
-		// LZ77 compress this chunk
-		size_t num_tokens = 0;
-		lz_token_t* tokens = lz_compress_tokens((const unsigned char*)bytes + offset, chunk, &num_tokens);
-
-		// Huffman encode the tokens
-		unsigned long bits_written = 0;
-		size_t huff_len = 0;
-		unsigned char btype = 0;
-		unsigned char* huff_buf = huffman_encode_tokens(tokens, num_tokens, &bits_written, &huff_len, &btype);
-		free(tokens);
-		if (!huff_buf) { free(real_start); return NULL; }
-
-		// Ensure output buffer is large enough
-		size_t needed = gzip_hdr_len + (total_bit_pos + 3 + bits_written + 7) / 8 + 8;
-		if (needed > alloc) {
-			alloc = needed * 2;
-			real_start = realloc(real_start, alloc);
-			if (!real_start) { free(huff_buf); return NULL; }
-			out_member = real_start + gzip_hdr_len;
-			// Zero only the new portion
-			size_t cur_bytes = (total_bit_pos + 7) / 8;
-			memset(out_member + cur_bytes, 0, alloc - gzip_hdr_len - cur_bytes);
-		}
+		// LZ77 compress this chunk, counting symbol frequencies on the fly
+		lz_hist_t hist;
+		memset(&hist, 0, sizeof(hist));
+		size_t num_tokens = lz_compress_block((const unsigned char*)bytes + offset, chunk, tokens, &hist);
+		// Checksum the chunk now, while LZ77 has it in cache
+		checksum = crc_update(checksum, (const unsigned char*)bytes + offset, chunk);
 
-		// Write 3-bit block header: BFINAL (1 bit) + BTYPE (2 bits), LSB-first
-		unsigned int header_val = (is_last ? 0 : 1) | ((unsigned int)btype << 1);
-		bit_writer(header_val, 3, &total_bit_pos, (unsigned char*)out_member, false);
-
-		// Merge Huffman-encoded data at current bit position
-		unsigned long bit_offset = total_bit_pos / 8;
-		unsigned long byte_pos = total_bit_pos % 8;
-		for (size_t i = 0; i < huff_len; i++) {
-			out_member[byte_pos + i]     |= (unsigned char)(huff_buf[i] << bit_offset);
-			if (bit_offset > 0)
-				out_member[byte_pos + i + 1] |= (unsigned char)(huff_buf[i] >> (8 - bit_offset));
+		// Pick the block type and codes from the histogram alone
+		huff_plan_t plan;
+		ZSTAT_BEGIN(ZSTAT_HUFF_PLAN);
+		int fits = huffman_plan_block(&hist, &plan) == 0 ? huff_group_fits(&group, &hist, &plan) : -1;
+		ZSTAT_END(ZSTAT_HUFF_PLAN);
+		if (fits < 0) { huff_group_free(&group); free(tokens); free(real_start); return NULL; }
+
+		// Finish the open block unless this chunk is cheaper coded with it
+		if (!fits) {
+			char* tmp = emit_group(&group, 0, real_start, &alloc, gzip_hdr_len, &total_bit_pos);
+			if (!tmp) { huff_group_free(&group); free(tokens); return NULL; }
+			real_start = tmp;
+		}
+		huff_group_append(&group, tokens, num_tokens, &plan, chunk);
+		if (is_last) {
+			char* tmp = emit_group(&group, 1, real_start, &alloc, gzip_hdr_len, &total_bit_pos);
+			if (!tmp) { huff_group_free(&group); free(tokens); return NULL; }
+			real_start = tmp;
 		}
-		total_bit_pos += bits_written;
 
-		free(huff_buf);
 		offset += chunk;
 	}
+	huff_group_free(&group);
+	free(tokens);
+	out_member = real_start + gzip_hdr_len;
 
 	// Byte-align after all blocks
 	size_t compressed_bytes = (total_bit_pos + 7) / 8;
 
 	// Gzip trailer: CRC32 + ISIZE (over ALL original data)
-	unsigned int checksum = get_crc((const unsigned char*)bytes, len);
 	out_member[compressed_bytes]     = checksum        & 0xff;
 	out_member[compressed_bytes + 1] = (checksum >> 8)  & 0xff;
 	out_member[compressed_bytes + 2] = (checksum >> 16) & 0xff;
@@ -0,0 +1,93 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "our_zlib.h"
+#include "batch.h"
+
+/* ─────────────────────────── helpers ─────────────────────────── */
+
+static char* read_file(const char* path, size_t* len) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long sz = ftell(f);
+	if (sz < 0) { fclose(f); return NULL; }
+	rewind(f);
+	char* buf = malloc((size_t)sz + 1);
+	if (!buf) { fclose(f); return NULL; }
+	if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { free(buf); fclose(f); return NULL; }
+	fclose(f);
+	*len = (size_t)sz;
+	return buf;
+}
+
+static int write_file(const char* path, const void* buf, size_t len) {
+	FILE* f = fopen(path, "wb");
+	if (!f) return -1;
+	int ok = (fwrite(buf, 1, len, f) == len) ? 0 : -1;
+	fclose(f);
+	return ok;
+}
+
+/* ───────────────────────── batch tests ───────────────────────── */
+
+/*
+ * Compressing a directory writes <name>.gz for every file; decompressing
+ * those .gz files from a list gives the original bytes back.
+ */
+Test(batch, directory_round_trip) {
+	const char* dir = "/tmp/test_batch_dir";
+	const char* list = "/tmp/test_batch_list.txt";
+	const int num_files = 5;
+	char path[128], gz_path[256];
+
+	mkdir(dir, 0700);
+	for (int i = 0; i < num_files; i++) {
+		snprintf(path, sizeof(path), "%s/file%d.txt", dir, i);
+		char content[512];
+		int len = snprintf(content, sizeof(content), "batch file %d, batch file %d, batch file %d\n", i, i, i);
+		cr_assert_eq(write_file(path, content, (size_t)len), 0);
+	}
+
+	char* paths[] = { (char*)dir };
+	cr_assert_eq(batch_run(paths, 1, NULL, M_DEFLATE, 0, 3), 0, "batch compression reported failures");
+
+	FILE* l = fopen(list, "w");
+	cr_assert_not_null(l);
+	for (int i = 0; i < num_files; i++) {
+		snprintf(gz_path, sizeof(gz_path), "%s/file%d.txt.gz", dir, i);
+		struct stat st;
+		cr_assert_eq(stat(gz_path, &st), 0, "%s was not written", gz_path);
+		fprintf(l, "%s\n", gz_path);
+		// Keep the originals aside so decompression has to recreate them
+		snprintf(path, sizeof(path), "%s/file%d.txt", dir, i);
+		char orig[256];
+		snprintf(orig, sizeof(orig), "%s.orig", path);
+		cr_assert_eq(rename(path, orig), 0);
+	}
+	fclose(l);
+
+	cr_assert_eq(batch_run(NULL, 0, list, M_INFLATE, 0, 2), 0, "batch decompression reported failures");
+	for (int i = 0; i < num_files; i++) {
+		char orig[256];
+		snprintf(path, sizeof(path), "%s/file%d.txt", dir, i);
+		snprintf(orig, sizeof(orig), "%s.orig", path);
+		size_t got_len = 0, want_len = 0;
+		char* got = read_file(path, &got_len);
+		char* want = read_file(orig, &want_len);
+		cr_assert_not_null(got, "%s was not recreated", path);
+		cr_assert_not_null(want);
+		cr_assert_eq(got_len, want_len);
+		cr_assert_eq(memcmp(got, want, want_len), 0, "%s differs after the round trip", path);
+		free(got);
+		free(want);
+		snprintf(gz_path, sizeof(gz_path), "%s.gz", path);
+		remove(path);
+		remove(orig);
+		remove(gz_path);
+	}
+	remove(list);
+	rmdir(dir);
+}
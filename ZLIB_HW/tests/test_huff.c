@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "huff.h"
 #include "lz.h"
+#include "our_zlib.h"
 
 #define LARGE_SIZE_100K  (100 * 1024)
 #define LARGE_SIZE_1M    (1024 * 1024)
@@ -202,3 +203,112 @@ Test(huff, encode_decode_single_byte) {
 
 
 
+
+/*
+ * The header cost estimate is exactly what the planned block spends before
+ * its first symbol, and the run-length coded header decodes back.
+ */
+Test(huff, header_bits_match_emitted_header) {
+	size_t len = 4000;
+	lz_packed_t* tokens = malloc(len * sizeof(lz_packed_t));
+	cr_assert_not_null(tokens);
+	lz_hist_t hist;
+	memset(&hist, 0, sizeof(hist));
+	for (size_t i = 0; i < len; i++) {
+		// A few letters, so most lengths are 0 and runs of equal lengths are long
+		unsigned char c = (unsigned char)("eeeeetttaaoinshrdlu"[(i * 7 + i / 13) % 19]);
+		tokens[i] = LZ_PACK_LITERAL(c);
+		hist.lit_freq[c]++;
+	}
+
+	huff_plan_t plan;
+	cr_assert_eq(huffman_plan_block(&hist, &plan), 0);
+	cr_assert_eq(plan.btype, BT_DYNAMIC);
+
+	unsigned long body_bits = plan.lit_lens[256];
+	for (int i = 0; i < 256; i++)
+		body_bits += (unsigned long)hist.lit_freq[i] * plan.lit_lens[i];
+	unsigned long header_bits = huffman_header_bits(plan.lit_lens, plan.dist_lens);
+	cr_assert_gt(header_bits, 0);
+	cr_assert_eq(header_bits + body_bits, plan.bits, "header %lu + body %lu != planned %lu", header_bits, body_bits, plan.bits);
+	// Repeat codes replace most of the 257 + 1 lengths a plain header would send
+	cr_assert_lt(plan.cl_seq_len, 40u, "%u code-length symbols", plan.cl_seq_len);
+
+	unsigned char* out = calloc((plan.bits + 7) / 8 + 1, 1);
+	cr_assert_not_null(out);
+	unsigned long bit_pos = 0;
+	huffman_emit_block(&plan, tokens, len, out, &bit_pos);
+	cr_assert_eq(bit_pos, plan.bits);
+
+	size_t dec_len = 0;
+	unsigned long bits_read = 0;
+	unsigned char* dec = huffman_decode(out, (plan.bits + 7) / 8, BT_DYNAMIC, &bits_read, &dec_len, NULL, 0);
+	cr_assert_not_null(dec);
+	cr_assert_eq(dec_len, len);
+	for (size_t i = 0; i < len; i++)
+		cr_assert_eq(dec[i], LZ_PACKED_LITERAL(tokens[i]), "byte %zu differs", i);
+
+	free(dec);
+	free(out);
+	free(tokens);
+}
+
+/*
+ * A chunk with the same statistics as the open block joins it and is coded
+ * with its codes (one header instead of two); a chunk with very different
+ * statistics starts a new one.
+ */
+Test(huff, group_merges_only_similar_chunks) {
+	size_t len = 3000;
+	lz_packed_t* text = malloc(len * sizeof(lz_packed_t));
+	lz_packed_t* noise = malloc(len * sizeof(lz_packed_t));
+	cr_assert_not_null(text);
+	cr_assert_not_null(noise);
+	lz_hist_t text_hist, noise_hist;
+	memset(&text_hist, 0, sizeof(text_hist));
+	memset(&noise_hist, 0, sizeof(noise_hist));
+	unsigned char* rnd = make_pseudo_random(len, 99);
+	cr_assert_not_null(rnd);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)"log line ok\n"[i % 12];
+		text[i] = LZ_PACK_LITERAL(c);
+		text_hist.lit_freq[c]++;
+		noise[i] = LZ_PACK_LITERAL(rnd[i]);
+		noise_hist.lit_freq[rnd[i]]++;
+	}
+	huff_plan_t text_plan, noise_plan;
+	cr_assert_eq(huffman_plan_block(&text_hist, &text_plan), 0);
+	cr_assert_eq(huffman_plan_block(&noise_hist, &noise_plan), 0);
+
+	huff_group_t group;
+	cr_assert_eq(huff_group_init(&group, len + 1), 0);
+	cr_assert_eq(huff_group_fits(&group, &text_hist, &text_plan), 1, "an empty group takes any chunk");
+	huff_group_append(&group, text, len, &text_plan, len);
+	cr_assert_eq(huff_group_fits(&group, &text_hist, &text_plan), 1, "identical statistics should share a block");
+	huff_group_append(&group, text, len, &text_plan, len);
+	cr_assert_eq(group.chunks, 2u);
+	cr_assert_eq(memcmp(group.plan.lit_lens, text_plan.lit_lens, sizeof(text_plan.lit_lens)), 0, "a joining chunk should keep the block's codes");
+	cr_assert_lt(group.plan.bits, 2 * text_plan.bits + 3);
+	cr_assert_eq(huff_group_fits(&group, &noise_hist, &noise_plan), 0, "random bytes should not join a text block");
+
+	// The merged block decodes to both chunks
+	unsigned char* out = calloc((3 + group.plan.bits + 7) / 8 + 1, 1);
+	cr_assert_not_null(out);
+	unsigned long bit_pos = 0;
+	unsigned char btype = group.plan.btype;
+	huff_group_emit(&group, 1, out, &bit_pos);
+	cr_assert_eq(group.chunks, 0u);
+	size_t dec_len = 0;
+	unsigned long bits_read = 3;
+	unsigned char* dec = huffman_decode(out, (bit_pos + 7) / 8, btype, &bits_read, &dec_len, NULL, 0);
+	cr_assert_not_null(dec);
+	cr_assert_eq(dec_len, 2 * len);
+	cr_assert_eq(memcmp(dec, dec + len, len), 0);
+
+	free(dec);
+	free(out);
+	huff_group_free(&group);
+	free(rnd);
+	free(noise);
+	free(text);
+}
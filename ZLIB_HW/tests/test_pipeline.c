@@ -0,0 +1,96 @@
+#include <criterion/criterion.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "our_zlib.h"
+#include "pipeline.h"
+
+/* ─────────────────────────── helpers ─────────────────────────── */
+
+static char* read_file(const char* path, size_t* len) {
+	FILE* f = fopen(path, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long sz = ftell(f);
+	if (sz < 0) { fclose(f); return NULL; }
+	rewind(f);
+	char* buf = malloc((size_t)sz + 1);
+	if (!buf) { fclose(f); return NULL; }
+	if (fread(buf, 1, (size_t)sz, f) != (size_t)sz) { free(buf); fclose(f); return NULL; }
+	fclose(f);
+	*len = (size_t)sz;
+	return buf;
+}
+
+static int write_file(const char* path, const void* buf, size_t len) {
+	FILE* f = fopen(path, "wb");
+	if (!f) return -1;
+	int ok = (fwrite(buf, 1, len, f) == len) ? 0 : -1;
+	fclose(f);
+	return ok;
+}
+
+/* Text-like input spanning several DEFLATE blocks */
+static char* make_input(size_t len) {
+	static const char* words[] = { "pipeline ", "reader ", "worker ", "writer ", "queue ", "block\n" };
+	char* data = malloc(len);
+	if (!data) return NULL;
+	for (size_t i = 0; i < len; i++) {
+		const char* w = words[(i * 7 / 53) % 6];
+		data[i] = w[i % strlen(w)];
+	}
+	return data;
+}
+
+/* ───────────────────────── pipeline tests ────────────────────── */
+
+/*
+ * The pipelined member is byte-identical to deflate() on the same file,
+ * for one and for several compression threads.
+ */
+Test(pipeline, matches_deflate_output) {
+	const char* tmp_txt = "/tmp/test_pipeline_in.txt";
+	const char* tmp_gz  = "/tmp/test_pipeline_out.gz";
+	size_t len = 3 * DEFLATE_BLOCK_SIZE + 1234;
+	char* input = make_input(len);
+	cr_assert_not_null(input);
+	cr_assert_eq(write_file(tmp_txt, input, len), 0);
+
+	size_t expected_len = 0;
+	char* expected = deflate((char*)tmp_txt, input, len, &expected_len);
+	cr_assert_not_null(expected);
+
+	int thread_counts[] = { 1, 4 };
+	for (int t = 0; t < 2; t++) {
+		cr_assert_eq(deflate_file_pipelined(tmp_txt, tmp_gz, thread_counts[t]), 0);
+		size_t got_len = 0;
+		char* got = read_file(tmp_gz, &got_len);
+		cr_assert_not_null(got);
+		cr_assert_eq(got_len, expected_len, "%d threads: %zu bytes, deflate() gave %zu",
+			thread_counts[t], got_len, expected_len);
+		cr_assert_eq(memcmp(got, expected, expected_len), 0, "%d threads: output differs from deflate()", thread_counts[t]);
+		free(got);
+	}
+
+	free(expected);
+	free(input);
+	remove(tmp_txt);
+	remove(tmp_gz);
+}
+
+/*
+ * An empty file still produces a complete member that gzip accepts.
+ */
+Test(pipeline, empty_input_is_valid_gzip) {
+	const char* tmp_txt = "/tmp/test_pipeline_empty.txt";
+	const char* tmp_gz  = "/tmp/test_pipeline_empty.gz";
+	cr_assert_eq(write_file(tmp_txt, "", 0), 0);
+	cr_assert_eq(deflate_file_pipelined(tmp_txt, tmp_gz, 2), 0);
+
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -t %s", tmp_gz);
+	cr_assert_eq(system(cmd), 0, "gzip rejected the member for an empty file");
+
+	remove(tmp_txt);
+	remove(tmp_gz);
+}
@@ -86,7 +86,8 @@ Test(parse_member, header_fields_from_system_gzip) {
 }
 
 /*
- * parse_member on a file that does NOT start with the gzip magic must return 1.
+ * parse_member on a file that does NOT start with the gzip magic must return
+ * MEMBER_NO_HEADER.
  */
 Test(parse_member, rejects_non_gz_file) {
 	const char* tmp = "/tmp/test_pm_bad.bin";
@@ -95,11 +96,30 @@ Test(parse_member, rejects_non_gz_file) {
 	FILE* f = fopen(tmp, "rb");
 	cr_assert_not_null(f);
 	gz_header_t hdr = {0};
-	cr_assert_neq(parse_member(f, &hdr), 0, "parse_member should fail on non-gz data");
+	cr_assert_eq(parse_member(f, &hdr), MEMBER_NO_HEADER, "parse_member should fail on non-gz data");
 	fclose(f);
 	remove(tmp);
 }
 
+/*
+ * A member whose header is fine but whose first block has the reserved
+ * BTYPE 11 is reported as bad data, not as a missing member, and the name
+ * it carried is still returned so the caller can free it.
+ */
+Test(parse_member, reports_malformed_blocks) {
+	const char* tmp = "/tmp/test_pm_blocks.gz";
+	unsigned char member[32] = { 0x1f, 0x8b, 8, 0x08, 0, 0, 0, 0, 0, 3, 'a', 0, 0xff, 0xff };
+	cr_assert_eq(write_file(tmp, member, sizeof(member)), 0);
+	FILE* f = fopen(tmp, "rb");
+	cr_assert_not_null(f);
+	gz_header_t hdr = {0};
+	cr_assert_eq(parse_member(f, &hdr), MEMBER_BAD_DATA);
+	cr_assert_str_eq(hdr.name, "a");
+	fclose(f);
+	free(hdr.name);
+	remove(tmp);
+}
+
 /*
  * skip_gz_header_to_compressed_data should position the file pointer
  * at the first byte of compressed data (past the header).
@@ -129,6 +149,96 @@ Test(parse_member, skip_header_positions_correctly) {
 	remove(tmp_gz);
 }
 
+/*
+ * parse_member leaves the file at the next member, so a concatenation of
+ * gzip members is walked one member at a time with each member's own trailer.
+ */
+Test(parse_member, walks_concatenated_members) {
+	const char* tmp_a  = "/tmp/test_pm_multi_a.txt";
+	const char* tmp_b  = "/tmp/test_pm_multi_b.txt";
+	const char* tmp_gz = "/tmp/test_pm_multi.gz";
+	const char* a = "first member\n";
+	size_t b_len = 100000;
+	char* b = malloc(b_len);
+	cr_assert_not_null(b);
+	for (size_t i = 0; i < b_len; i++) b[i] = "second member "[i % 14];
+	cr_assert_eq(write_file(tmp_a, a, strlen(a)), 0);
+	cr_assert_eq(write_file(tmp_b, b, b_len), 0);
+
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -c %s > %s && gzip -9 -c %s >> %s", tmp_a, tmp_gz, tmp_b, tmp_gz);
+	cr_assert_eq(system(cmd), 0, "system gzip failed");
+
+	FILE* f = fopen(tmp_gz, "rb");
+	cr_assert_not_null(f);
+	const char* names[] = { "test_pm_multi_a.txt", "test_pm_multi_b.txt" };
+	unsigned int sizes[] = { (unsigned int)strlen(a), (unsigned int)b_len };
+	unsigned int crcs[] = { get_crc((const unsigned char*)a, strlen(a)), get_crc((const unsigned char*)b, b_len) };
+	for (int m = 0; m < 2; m++) {
+		gz_header_t hdr = {0};
+		cr_assert_eq(parse_member(f, &hdr), 0, "member %d was not parsed", m);
+		cr_assert_not_null(hdr.name);
+		cr_assert_str_eq(hdr.name, names[m]);
+		cr_assert_eq(hdr.full_size, sizes[m], "member %d: ISIZE %u, expected %u", m, hdr.full_size, sizes[m]);
+		cr_assert_eq(hdr.crc, crcs[m], "member %d: CRC %08x, expected %08x", m, hdr.crc, crcs[m]);
+		free(hdr.name);
+	}
+	gz_header_t hdr = {0};
+	cr_assert_neq(parse_member(f, &hdr), 0, "there is no third member");
+	fclose(f);
+
+	free(b);
+	remove(tmp_a);
+	remove(tmp_b);
+	remove(tmp_gz);
+}
+
+/*
+ * verify_member decodes a member larger than its window and accepts it, and
+ * reports a flipped CRC byte in the trailer as invalid.
+ */
+Test(parse_member, verify_member_checks_trailer) {
+	const char* tmp_txt = "/tmp/test_pm_verify.txt";
+	const char* tmp_gz  = "/tmp/test_pm_verify.txt.gz";
+	size_t len = 200000;
+	char* data = malloc(len);
+	cr_assert_not_null(data);
+	unsigned int seed = 7;
+	for (size_t i = 0; i < len; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = (i % 1000 < 500) ? "window "[i % 7] : (char)('a' + (seed >> 16) % 8);
+	}
+	cr_assert_eq(write_file(tmp_txt, data, len), 0);
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -k -f %s", tmp_txt);
+	cr_assert_eq(system(cmd), 0, "system gzip failed");
+
+	size_t gz_len = 0;
+	char* gz = read_file(tmp_gz, &gz_len);
+	cr_assert_not_null(gz);
+	for (int corrupt = 0; corrupt < 2; corrupt++) {
+		if (corrupt) {
+			gz[gz_len - 8] ^= 0x01;
+			cr_assert_eq(write_file(tmp_gz, gz, gz_len), 0);
+		}
+		FILE* f = fopen(tmp_gz, "rb");
+		cr_assert_not_null(f);
+		gz_header_t hdr = {0};
+		int crc_valid = -1;
+		cr_assert_eq(verify_member(f, &hdr, &crc_valid), 0);
+		cr_assert_eq(crc_valid, !corrupt, "corrupt=%d: crc_valid=%d", corrupt, crc_valid);
+		cr_assert_eq(hdr.full_size, (unsigned int)len);
+		cr_assert_neq(verify_member(f, &hdr, &crc_valid), 0, "there is no second member");
+		fclose(f);
+		free(hdr.name);
+	}
+
+	free(gz);
+	free(data);
+	remove(tmp_txt);
+	remove(tmp_gz);
+}
+
 /* ───────────────────────── inflate tests ─────────────────────── */
 
 /*
@@ -265,6 +375,117 @@ Test(inflate, single_byte) {
 	remove(tmp_gz);
 }
 
+/*
+ * Two stored blocks back to back: the second header follows the first block's bytes.
+ */
+Test(inflate, consecutive_stored_blocks) {
+	unsigned char comp[] = {
+		0x00, 0x03, 0x00, 0xfc, 0xff, 'a', 'b', 'c',	// BFINAL=0, stored, LEN=3
+		0x01, 0x02, 0x00, 0xfd, 0xff, 'd', 'e'			// BFINAL=1, stored, LEN=2
+	};
+	size_t dec_len = 0;
+	char* result = inflate_sized((char*)comp, sizeof(comp), &dec_len);
+	cr_assert_not_null(result, "inflate rejected valid stored blocks");
+	cr_assert_eq(dec_len, 5);
+	cr_assert_eq(memcmp(result, "abcde", 5), 0);
+	free(result);
+}
+
+/*
+ * Truncated or inconsistent input is rejected without reading past comp_len.
+ */
+Test(inflate, rejects_truncated_and_corrupt_input) {
+	const char* tmp_txt = "/tmp/test_inflate_trunc.txt";
+	const char* tmp_gz  = "/tmp/test_inflate_trunc.txt.gz";
+	const char* original = "truncated streams must not be trusted, truncated streams must not be trusted";
+	cr_assert_eq(write_file(tmp_txt, original, strlen(original)), 0);
+
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -k -f %s", tmp_txt);
+	cr_assert_eq(system(cmd), 0);
+
+	size_t comp_len = 0;
+	gz_header_t hdr = {0};
+	char* comp = read_gz_compressed(tmp_gz, &comp_len, &hdr);
+	cr_assert_not_null(comp);
+
+	for (size_t cut = 0; cut < comp_len; cut++) {
+		// Exact-size copy so any over-read lands outside the allocation
+		char* part = malloc(cut ? cut : 1);
+		cr_assert_not_null(part);
+		memcpy(part, comp, cut);
+		char* result = inflate(part, cut);
+		cr_assert_null(result, "inflate accepted a stream cut to %zu of %zu bytes", cut, comp_len);
+		free(part);
+	}
+
+	unsigned char bad_nlen[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 'a', 'b', 'c' };
+	cr_assert_null(inflate((char*)bad_nlen, sizeof(bad_nlen)), "inflate accepted LEN != ~NLEN");
+	unsigned char short_stored[] = { 0x01, 0x10, 0x00, 0xef, 0xff, 'a' };
+	cr_assert_null(inflate((char*)short_stored, sizeof(short_stored)), "inflate accepted LEN past the input");
+
+	free(comp);
+	free(hdr.name);
+	free(hdr.comment);
+	free(hdr.extra);
+	remove(tmp_txt);
+	remove(tmp_gz);
+}
+
+/*
+ * The CRC inflate_crc computes block by block matches a separate pass and
+ * crc_combine of the halves; inflate_file refuses a member whose trailer
+ * CRC does not match and writes nothing.
+ */
+Test(inflate, crc_checked_against_trailer) {
+	const char* tmp_txt = "/tmp/test_inflate_crc.txt";
+	const char* tmp_gz  = "/tmp/test_inflate_crc.txt.gz";
+	const char* tmp_out = "/tmp/test_inflate_crc.out";
+	size_t len = 3 * DEFLATE_BLOCK_SIZE;
+	char* data = malloc(len);
+	cr_assert_not_null(data);
+	for (size_t i = 0; i < len; i++) data[i] = (char)("crc per block "[i % 14] + (i / 5000) % 3);
+	cr_assert_eq(write_file(tmp_txt, data, len), 0);
+	char cmd[256];
+	snprintf(cmd, sizeof(cmd), "gzip -k -f %s", tmp_txt);
+	cr_assert_eq(system(cmd), 0);
+
+	unsigned int want = get_crc((const unsigned char*)data, len);
+	size_t half = len / 2 + 17;
+	cr_assert_eq(crc_combine(get_crc((const unsigned char*)data, half),
+		get_crc((const unsigned char*)data + half, len - half), len - half), want);
+
+	size_t comp_len = 0;
+	gz_header_t hdr = {0};
+	char* comp = read_gz_compressed(tmp_gz, &comp_len, &hdr);
+	cr_assert_not_null(comp);
+	size_t dec_len = 0;
+	unsigned int crc = 0;
+	char* dec = inflate_crc(comp, comp_len, &dec_len, &crc);
+	cr_assert_not_null(dec);
+	cr_assert_eq(dec_len, len);
+	cr_assert_eq(crc, want, "inflate_crc gave %08x, expected %08x", crc, want);
+	cr_assert_eq(inflate_file(tmp_gz, tmp_out), 0);
+	remove(tmp_out);
+
+	size_t gz_len = 0;
+	char* gz = read_file(tmp_gz, &gz_len);
+	cr_assert_not_null(gz);
+	gz[gz_len - 6] ^= 0x40;
+	cr_assert_eq(write_file(tmp_gz, gz, gz_len), 0);
+	cr_assert_neq(inflate_file(tmp_gz, tmp_out), 0, "inflate_file accepted a bad trailer CRC");
+	FILE* out = fopen(tmp_out, "rb");
+	cr_assert_null(out, "inflate_file wrote output for a corrupt member");
+
+	free(gz);
+	free(dec);
+	free(comp);
+	free(data);
+	free(hdr.name);
+	remove(tmp_txt);
+	remove(tmp_gz);
+}
+
 /* ───────────────────────── deflate tests ─────────────────────── */
 
 /*